@@ -0,0 +1,274 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+/* Writes the output directory, and the data directory, in a site archive served by
+ * codebrowser_serve, see sitearchive.h.
+ *
+ * Each directory is stored under a prefix, its own name by default, so that the relative links
+ * between them keep working: with the default data path of the generator (../data),
+ *     codebrowser_archive site.cbar output data
+ * stores output/... and data/... . With -update, only the files whose size or modification time
+ * changed are appended to the existing archive, and the files that were removed are dropped.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sitearchive.h"
+
+namespace fs = std::filesystem;
+
+struct InputFile
+{
+    fs::path path;
+    std::string name; // in the archive
+    uint64_t size;
+    uint64_t mtime;
+    // The .gz copy written by the -precompress options, when the file itself was left empty
+    fs::path compressedCopy;
+};
+
+static bool readFile(const fs::path &path, std::string &content)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    file.seekg(0, std::ios::end);
+    content.resize(file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(content.data(), content.size());
+    return !file.fail();
+}
+
+// The files which are already compressed, or which are read by ranges like the refs packs
+static bool storeAsIs(const fs::path &path)
+{
+    static const std::set<std::string> extensions = { ".png", ".jpg",  ".jpeg", ".gif",
+                                                       ".ico", ".woff", ".woff2", ".gz",
+                                                       ".br",  ".zst",  ".zip",  ".pack" };
+    return extensions.count(path.extension().string());
+}
+
+// The files of 'dir', except the hidden ones (.manifest, .timings, refs/.layout, ...)
+static void listFiles(const fs::path &dir, const std::string &prefix,
+                      std::vector<InputFile> &files)
+{
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(dir, ec), end; it != end && !ec; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (name.empty() || name[0] == '.') {
+            if (it->is_directory())
+                it.disable_recursion_pending();
+            continue;
+        }
+        if (!it->is_regular_file())
+            continue;
+        // The claim markers and their locks, and the pages of a generation which is running or
+        // was interrupted
+        if (name.find(".html.claim") != std::string::npos
+            || name.find(".html.tmp") != std::string::npos)
+            continue;
+        std::string relative = it->path().lexically_relative(dir).generic_string();
+        auto mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            it->last_write_time(ec).time_since_epoch());
+        files.push_back({ it->path(), prefix.empty() ? relative : prefix + "/" + relative,
+                          it->file_size(ec), uint64_t(mtime.count()), {} });
+    }
+    if (ec)
+        std::cerr << "Error reading " << dir.string() << ": " << ec.message() << std::endl;
+
+    // The .gz copies written by the -precompress options are not stored twice: the file is
+    // compressed again anyway. The files left empty by -precompress-only are read from their copy.
+    std::map<std::string, InputFile *> byName;
+    for (auto &file : files)
+        byName[file.name] = &file;
+    std::set<std::string> copies;
+    for (auto &file : files) {
+        std::string_view name = file.name;
+        if (name.size() <= 3 || name.substr(name.size() - 3) != ".gz")
+            continue;
+        auto plain = byName.find(std::string(name.substr(0, name.size() - 3)));
+        if (plain == byName.end())
+            continue;
+        copies.insert(file.name);
+        if (plain->second->size == 0) {
+            plain->second->compressedCopy = file.path;
+            plain->second->mtime = file.mtime;
+        }
+    }
+    files.erase(std::remove_if(files.begin(), files.end(),
+                               [&](const InputFile &file) { return copies.count(file.name); }),
+                files.end());
+}
+
+// The content of a .gz copy
+static bool readCompressedCopy(const fs::path &path, std::string &content)
+{
+    std::string compressed;
+    if (!readFile(path, compressed) || compressed.size() < 18)
+        return false;
+    // The gzip trailer ends with the size of the content, modulo 2^32
+    const unsigned char *size =
+        reinterpret_cast<const unsigned char *>(compressed.data() + compressed.size() - 4);
+    return SiteArchive::gunzip(compressed, content,
+                               size[0] | size[1] << 8 | size[2] << 16 | uint32_t(size[3]) << 24);
+}
+
+// The name of the directory itself, also for "output/" or "."
+static std::string defaultPrefix(const fs::path &dir)
+{
+    fs::path path = fs::absolute(dir).lexically_normal();
+    if (!path.has_filename())
+        path = path.parent_path();
+    return path.filename().string();
+}
+
+int main(int argc, char **argv)
+{
+    std::string archivePath;
+    std::vector<std::pair<fs::path, std::string>> directories;
+    bool update = false;
+    bool list = false;
+    unsigned jobs = std::thread::hardware_concurrency();
+
+    bool usage = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            jobs = std::stoul(argv[++i]);
+        } else if (arg == "-update") {
+            update = true;
+        } else if (arg == "-list") {
+            list = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            usage = true;
+        } else if (archivePath.empty()) {
+            archivePath = arg;
+        } else {
+            // dir or dir=prefix
+            auto equal = arg.find('=');
+            fs::path dir = arg.substr(0, equal);
+            std::string prefix = equal == std::string::npos ? defaultPrefix(dir)
+                                                            : arg.substr(equal + 1);
+            while (!prefix.empty() && prefix.back() == '/')
+                prefix.pop_back();
+            directories.emplace_back(dir, prefix);
+        }
+    }
+    if (usage || archivePath.empty() || (directories.empty() && !list)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <archive> <directory>[=<prefix>]... [-update] [-j jobs]\n"
+                  << "       " << argv[0] << " <archive> -list" << std::endl;
+        return -1;
+    }
+
+    SiteArchive archive;
+    if (list) {
+        if (!archive.open(archivePath)) {
+            std::cerr << "Error reading " << archivePath << std::endl;
+            return 1;
+        }
+        for (const auto &it : archive.entries()) {
+            std::cout << it.first << " " << it.second.originalSize;
+            if (it.second.flags & SiteArchive::Gzip)
+                std::cout << " gzip " << it.second.size;
+            std::cout << "\n";
+        }
+        return 0;
+    }
+
+    bool opened = update && fs::exists(archivePath) ? archive.open(archivePath, true)
+                                                     : archive.create(archivePath);
+    if (!opened) {
+        std::cerr << "Error opening " << archivePath << std::endl;
+        return 1;
+    }
+
+    std::vector<InputFile> files;
+    for (const auto &dir : directories)
+        listFiles(dir.first, dir.second, files);
+
+    // Drop the entries of the files that were removed
+    std::set<std::string_view> names;
+    for (const auto &file : files)
+        names.insert(file.name);
+    std::vector<std::string> removed;
+    for (const auto &it : archive.entries()) {
+        if (names.count(it.first))
+            continue;
+        for (const auto &dir : directories) {
+            const std::string &prefix = dir.second;
+            if (prefix.empty()
+                || (it.first.size() > prefix.size() && it.first[prefix.size()] == '/'
+                    && it.first.compare(0, prefix.size(), prefix) == 0)) {
+                removed.push_back(it.first);
+                break;
+            }
+        }
+    }
+    for (const auto &name : removed)
+        archive.remove(name);
+
+    std::vector<const InputFile *> toAdd;
+    for (const auto &file : files) {
+        const SiteArchive::Entry *entry = archive.find(file.name);
+        if (!entry || entry->mtime != file.mtime
+            || (file.compressedCopy.empty() && entry->originalSize != file.size))
+            toAdd.push_back(&file);
+    }
+
+    std::atomic<size_t> next { 0 };
+    std::atomic<bool> success { true };
+    auto work = [&] {
+        std::string content;
+        for (size_t i = next++; i < toAdd.size(); i = next++) {
+            const InputFile &file = *toAdd[i];
+            bool read = file.compressedCopy.empty()
+                ? readFile(file.path, content)
+                : readCompressedCopy(file.compressedCopy, content);
+            if (!read || !archive.add(file.name, content, file.mtime, !storeAsIs(file.path))) {
+                std::cerr << "Error adding " << file.path.string() << std::endl;
+                success = false;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < std::min<size_t>(std::max(1u, jobs), toAdd.size()); ++i)
+        threads.emplace_back(work);
+    work();
+    for (auto &t : threads)
+        t.join();
+
+    if (!success || !archive.commit()) {
+        std::cerr << "Error writing " << archivePath << std::endl;
+        return 1;
+    }
+    std::cout << "Added " << toAdd.size() << " files, removed " << removed.size() << ", "
+              << archive.entries().size() << " files in " << archivePath << std::endl;
+    return 0;
+}
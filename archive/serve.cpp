@@ -0,0 +1,351 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+/* A small static HTTP server for a site archive, see sitearchive.h.
+ *
+ * Meant to browse the output locally, or to run behind a reverse proxy: it only supports GET and
+ * HEAD, with ranges, and sends the compressed bodies as they are to the clients accepting gzip.
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sitearchive.h"
+
+static const SiteArchive *archive;
+
+static const char *contentType(std::string_view path, const SiteArchive::Entry &entry)
+{
+    static const std::pair<std::string_view, const char *> types[] = {
+        { ".html", "text/html; charset=utf-8" },
+        { ".js", "application/javascript; charset=utf-8" },
+        { ".css", "text/css; charset=utf-8" },
+        { ".json", "application/json" },
+        { ".svg", "image/svg+xml" },
+        { ".png", "image/png" },
+        { ".jpg", "image/jpeg" },
+        { ".jpeg", "image/jpeg" },
+        { ".gif", "image/gif" },
+        { ".ico", "image/x-icon" },
+        { ".woff", "font/woff" },
+        { ".woff2", "font/woff2" },
+    };
+    auto slash = path.rfind('/');
+    auto dot = path.rfind('.');
+    if (dot != std::string_view::npos && (slash == std::string_view::npos || dot > slash)) {
+        for (const auto &type : types) {
+            if (path.substr(dot) == type.first)
+                return type.second;
+        }
+    }
+    // The refs and the fnSearch files have no extension
+    return entry.flags & SiteArchive::Gzip ? "text/plain; charset=utf-8"
+                                           : "application/octet-stream";
+}
+
+// The whole string as a number, or false. The values come from the clients: no exceptions
+template<typename T>
+static bool parseNumber(std::string_view str, T &value, int base = 10)
+{
+    auto result = std::from_chars(str.data(), str.data() + str.size(), value, base);
+    return !str.empty() && result.ec == std::errc() && result.ptr == str.data() + str.size();
+}
+
+static std::string percentDecode(std::string_view str)
+{
+    std::string result;
+    for (size_t i = 0; i < str.size(); ++i) {
+        unsigned char c;
+        if (str[i] == '%' && i + 2 < str.size() && parseNumber(str.substr(i + 1, 2), c, 16)) {
+            result += char(c);
+            i += 2;
+        } else {
+            result += str[i];
+        }
+    }
+    return result;
+}
+
+// The value of a header, or an empty string
+static std::string_view header(std::string_view request, std::string_view name)
+{
+    size_t pos = request.find("\r\n");
+    while (pos != std::string_view::npos && pos + 2 < request.size()) {
+        pos += 2;
+        size_t endOfLine = request.find("\r\n", pos);
+        std::string_view line = request.substr(pos, endOfLine - pos);
+        auto colon = line.find(':');
+        if (colon == name.size()
+            && std::equal(name.begin(), name.end(), line.begin(),
+                          [](char a, char b) { return tolower(a) == tolower(b); })) {
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ')
+                value.remove_prefix(1);
+            return value;
+        }
+        pos = endOfLine;
+    }
+    return {};
+}
+
+// Parse a single "bytes=first-last" range, clamped to 'size'
+static bool parseRange(std::string_view value, uint64_t size, uint64_t &first, uint64_t &last)
+{
+    if (value.substr(0, 6) != "bytes=" || value.find(',') != std::string_view::npos)
+        return false;
+    value.remove_prefix(6);
+    auto dash = value.find('-');
+    if (dash == std::string_view::npos)
+        return false;
+    std::string_view start = value.substr(0, dash), stop = value.substr(dash + 1);
+    if (start.empty()) { // suffix
+        uint64_t count;
+        if (!parseNumber(stop, count) || count == 0 || size == 0)
+            return false;
+        first = size - std::min(count, size);
+        last = size - 1;
+    } else {
+        if (!parseNumber(start, first))
+            return false;
+        last = size - 1;
+        uint64_t end;
+        if (!stop.empty()) {
+            if (!parseNumber(stop, end))
+                return false;
+            last = std::min(end, last);
+        }
+        if (first >= size || first > last)
+            return false;
+    }
+    return true;
+}
+
+static bool sendAll(int fd, std::string_view data)
+{
+    while (!data.empty()) {
+        ssize_t written = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (written <= 0)
+            return false;
+        data.remove_prefix(written);
+    }
+    return true;
+}
+
+static bool sendResponse(int fd, int status, std::string_view headers, std::string_view body,
+                         bool head)
+{
+    static const std::pair<int, const char *> reasons[] = {
+        { 200, "OK" },
+        { 206, "Partial Content" },
+        { 301, "Moved Permanently" },
+        { 400, "Bad Request" },
+        { 404, "Not Found" },
+        { 405, "Method Not Allowed" },
+        { 416, "Range Not Satisfiable" },
+        { 500, "Internal Server Error" },
+    };
+    const char *reason = "";
+    for (const auto &it : reasons) {
+        if (it.first == status)
+            reason = it.second;
+    }
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n";
+    response += headers;
+    response += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    if (!head)
+        response += body;
+    return sendAll(fd, response);
+}
+
+static bool handleRequest(int fd, std::string_view request)
+{
+    auto firstLine = request.substr(0, request.find("\r\n"));
+    auto space = firstLine.find(' ');
+    auto space2 = firstLine.find(' ', space + 1);
+    if (space == std::string_view::npos || space2 == std::string_view::npos) {
+        sendResponse(fd, 400, {}, "Bad Request\n", false);
+        return false;
+    }
+    std::string_view method = firstLine.substr(0, space);
+    std::string_view target = firstLine.substr(space + 1, space2 - space - 1);
+    bool head = method == "HEAD";
+    if (method != "GET" && !head)
+        return sendResponse(fd, 405, "Allow: GET, HEAD\r\n", "Method Not Allowed\n", false);
+
+    target = target.substr(0, target.find_first_of("?#"));
+    std::string path = percentDecode(target);
+    if (path.empty() || path[0] != '/' || path.find("/../") != std::string::npos)
+        return sendResponse(fd, 400, {}, "Bad Request\n", head);
+    path.erase(0, 1);
+
+    if (path.empty() || path.back() == '/') {
+        path += "index.html";
+    } else if (!archive->find(path) && archive->find(path + "/index.html")) {
+        // A directory: redirect so that the relative links are resolved from it
+        return sendResponse(fd, 301, "Location: " + std::string(target) + "/\r\n", {}, head);
+    }
+    const SiteArchive::Entry *entry = archive->find(path);
+    if (!entry)
+        return sendResponse(fd, 404, "Content-Type: text/plain\r\n", "Not Found\n", head);
+
+    std::string headers = std::string("Content-Type: ") + contentType(path, *entry) + "\r\n";
+    headers += "Accept-Ranges: bytes\r\nCache-Control: no-cache\r\n";
+    headers += "ETag: \"" + std::to_string(entry->offset) + "-" + std::to_string(entry->mtime)
+        + "\"\r\n";
+
+    std::string body;
+    bool gzip = entry->flags & SiteArchive::Gzip;
+    std::string_view range = header(request, "Range");
+    bool acceptsGzip = header(request, "Accept-Encoding").find("gzip") != std::string_view::npos;
+    if (gzip && range.empty() && acceptsGzip) {
+        // Send the stored body as it is
+        headers += "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n";
+        if (!head && !archive->read(*entry, body))
+            return sendResponse(fd, 500, {}, "Internal Server Error\n", false);
+        if (head)
+            body.resize(entry->size);
+        return sendResponse(fd, 200, headers, body, head);
+    }
+    if (gzip)
+        headers += "Vary: Accept-Encoding\r\n";
+
+    uint64_t first = 0, last = 0;
+    if (!range.empty()) {
+        if (!parseRange(range, entry->originalSize, first, last)) {
+            headers += "Content-Range: bytes */" + std::to_string(entry->originalSize) + "\r\n";
+            return sendResponse(fd, 416, headers, {}, head);
+        }
+        headers += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last)
+            + "/" + std::to_string(entry->originalSize) + "\r\n";
+    }
+
+    bool ok = true;
+    if (gzip) {
+        ok = archive->content(*entry, body);
+        if (ok && !range.empty())
+            body = body.substr(first, last - first + 1);
+    } else if (!range.empty()) {
+        ok = archive->read(*entry, body, first, last - first + 1);
+    } else if (!head) {
+        ok = archive->read(*entry, body);
+    } else {
+        body.resize(entry->size);
+    }
+    if (!ok)
+        return sendResponse(fd, 500, {}, "Internal Server Error\n", false);
+    return sendResponse(fd, range.empty() ? 200 : 206, headers, body, head);
+}
+
+static void serveConnection(int fd)
+{
+    timeval timeout = { 30, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::string buffer;
+    char chunk[4096];
+    while (true) {
+        auto endOfHeaders = buffer.find("\r\n\r\n");
+        if (endOfHeaders == std::string::npos) {
+            if (buffer.size() > 64 * 1024)
+                break;
+            ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+            if (received <= 0)
+                break;
+            buffer.append(chunk, received);
+            continue;
+        }
+        // The requests we accept have no body
+        std::string request = buffer.substr(0, endOfHeaders + 2);
+        buffer.erase(0, endOfHeaders + 4);
+        bool close = header(request, "Connection") == "close"
+            || request.substr(0, request.find("\r\n")).find("HTTP/1.0") != std::string::npos;
+        if (!handleRequest(fd, request) || close)
+            break;
+    }
+    ::close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    std::string archivePath;
+    std::string bindAddress = "127.0.0.1";
+    int port = 8080;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-port" && i + 1 < argc) {
+            port = std::stoi(argv[++i]);
+        } else if (arg == "-bind" && i + 1 < argc) {
+            bindAddress = argv[++i];
+        } else if (archivePath.empty() && !arg.empty() && arg[0] != '-') {
+            archivePath = arg;
+        } else {
+            archivePath.clear();
+            break;
+        }
+    }
+    if (archivePath.empty()) {
+        std::cerr << "Usage: " << argv[0] << " <archive> [-port 8080] [-bind 127.0.0.1]"
+                  << std::endl;
+        return -1;
+    }
+
+    SiteArchive site;
+    if (!site.open(archivePath)) {
+        std::cerr << "Error reading " << archivePath << std::endl;
+        return 1;
+    }
+    archive = &site;
+
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (server < 0 || inet_pton(AF_INET, bindAddress.c_str(), &address.sin_addr) != 1
+        || bind(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+        || listen(server, 64) != 0) {
+        std::cerr << "Error listening on " << bindAddress << ":" << port << ": "
+                  << strerror(errno) << std::endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    std::cout << "Serving " << archivePath << " (" << site.entries().size()
+              << " files) on http://" << bindAddress << ":" << port << "/" << std::endl;
+
+    while (true) {
+        int fd = accept(server, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Error accepting a connection: " << strerror(errno) << std::endl;
+            continue;
+        }
+        std::thread(serveConnection, fd).detach();
+    }
+}
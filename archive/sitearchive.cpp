@@ -0,0 +1,287 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "sitearchive.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const char ArchiveMagic[8] = { 'C', 'B', 'S', 'I', 'T', 'E', '0', '1' };
+const char IndexMagic[8] = { 'C', 'B', 'S', 'I', 'D', 'X', '0', '1' };
+constexpr size_t TrailerSize = 24;
+
+void appendU32(std::string &out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out += char(value >> (8 * i));
+}
+
+void appendU64(std::string &out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        out += char(value >> (8 * i));
+}
+
+uint32_t readU32(const char *data)
+{
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i)
+        value = (value << 8) | uint8_t(data[i]);
+    return value;
+}
+
+uint64_t readU64(const char *data)
+{
+    return readU32(data) | (uint64_t(readU32(data + 4)) << 32);
+}
+
+bool preadAll(int fd, char *data, uint64_t size, uint64_t offset)
+{
+    while (size) {
+        ssize_t n = ::pread(fd, data, size, offset);
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+bool pwriteAll(int fd, const char *data, uint64_t size, uint64_t offset)
+{
+    while (size) {
+        ssize_t n = ::pwrite(fd, data, size, offset);
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+}
+
+SiteArchive::~SiteArchive()
+{
+    if (fd >= 0)
+        ::close(fd);
+    if (!tmpFileName.empty())
+        std::remove(tmpFileName.c_str());
+}
+
+bool SiteArchive::open(const std::string &path, bool forUpdate)
+{
+    fd = ::open(path.c_str(), forUpdate ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        return false;
+    fileName = path;
+    return readIndex();
+}
+
+bool SiteArchive::create(const std::string &path)
+{
+    fileName = path;
+    tmpFileName = path + ".tmp";
+    fd = ::open(tmpFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        tmpFileName.clear();
+        return false;
+    }
+    end = sizeof(ArchiveMagic);
+    return pwriteAll(fd, ArchiveMagic, sizeof(ArchiveMagic), 0);
+}
+
+bool SiteArchive::readIndex()
+{
+    char header[sizeof(ArchiveMagic)];
+    char trailer[TrailerSize];
+    off_t fileSize = ::lseek(fd, 0, SEEK_END);
+    if (fileSize < off_t(sizeof(header) + TrailerSize)
+        || !preadAll(fd, header, sizeof(header), 0)
+        || std::memcmp(header, ArchiveMagic, sizeof(ArchiveMagic)) != 0
+        || !preadAll(fd, trailer, TrailerSize, fileSize - TrailerSize)
+        || std::memcmp(trailer + 16, IndexMagic, sizeof(IndexMagic)) != 0) {
+        return false;
+    }
+    uint64_t indexOffset = readU64(trailer);
+    uint64_t indexSize = readU64(trailer + 8);
+    if (indexOffset < sizeof(header) || indexOffset + indexSize != uint64_t(fileSize) - TrailerSize)
+        return false;
+    std::string data(indexSize, '\0');
+    if (!preadAll(fd, data.data(), indexSize, indexOffset))
+        return false;
+
+    const char *p = data.data();
+    const char *dataEnd = p + data.size();
+    if (dataEnd - p < 4)
+        return false;
+    uint32_t count = readU32(p);
+    p += 4;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (dataEnd - p < 4)
+            return false;
+        uint32_t pathSize = readU32(p);
+        p += 4;
+        if (uint64_t(dataEnd - p) < uint64_t(pathSize) + 36)
+            return false;
+        std::string path(p, pathSize);
+        p += pathSize;
+        Entry entry;
+        entry.offset = readU64(p);
+        entry.size = readU64(p + 8);
+        entry.originalSize = readU64(p + 16);
+        entry.mtime = readU64(p + 24);
+        entry.flags = readU32(p + 32);
+        p += 36;
+        if (entry.offset < sizeof(header) || entry.offset + entry.size > indexOffset)
+            return false;
+        index.emplace(std::move(path), entry);
+    }
+    // An update appends after the current index, which then becomes garbage
+    end = fileSize;
+    return true;
+}
+
+bool SiteArchive::gzip(std::string_view data, std::string &compressed)
+{
+    z_stream stream {};
+    // 15 + 16: the gzip format, which the clients accept as Content-Encoding: gzip
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY)
+        != Z_OK)
+        return false;
+    compressed.resize(deflateBound(&stream, data.size()));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = data.size();
+    stream.next_out = reinterpret_cast<Bytef *>(compressed.data());
+    stream.avail_out = compressed.size();
+    int result = deflate(&stream, Z_FINISH);
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+bool SiteArchive::gunzip(std::string_view data, std::string &result, uint64_t originalSize)
+{
+    z_stream stream {};
+    if (inflateInit2(&stream, 15 + 16) != Z_OK)
+        return false;
+    result.resize(originalSize);
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = data.size();
+    stream.next_out = reinterpret_cast<Bytef *>(result.data());
+    stream.avail_out = result.size();
+    int status = inflate(&stream, Z_FINISH);
+    bool ok = status == Z_STREAM_END && stream.total_out == originalSize;
+    inflateEnd(&stream);
+    return ok;
+}
+
+bool SiteArchive::add(const std::string &path, std::string_view data, uint64_t mtime,
+                      bool compress)
+{
+    Entry entry;
+    entry.originalSize = data.size();
+    entry.mtime = mtime;
+    std::string compressed;
+    if (compress && gzip(data, compressed) && compressed.size() < data.size()) {
+        data = compressed;
+        entry.flags |= Gzip;
+    }
+    entry.size = data.size();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entry.offset = end;
+        end += data.size();
+    }
+    if (!pwriteAll(fd, data.data(), data.size(), entry.offset))
+        return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    index[path] = entry;
+    return true;
+}
+
+void SiteArchive::remove(std::string_view path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(path);
+    if (it != index.end())
+        index.erase(it);
+}
+
+bool SiteArchive::commit()
+{
+    std::string data;
+    appendU32(data, index.size());
+    for (const auto &it : index) {
+        appendU32(data, it.first.size());
+        data += it.first;
+        appendU64(data, it.second.offset);
+        appendU64(data, it.second.size);
+        appendU64(data, it.second.originalSize);
+        appendU64(data, it.second.mtime);
+        appendU32(data, it.second.flags);
+    }
+    uint64_t indexOffset = end;
+    uint64_t indexSize = data.size();
+    appendU64(data, indexOffset);
+    appendU64(data, indexSize);
+    data.append(IndexMagic, sizeof(IndexMagic));
+    if (!pwriteAll(fd, data.data(), data.size(), end) || ::fsync(fd) != 0)
+        return false;
+    end += data.size();
+    if (!tmpFileName.empty()) {
+        if (std::rename(tmpFileName.c_str(), fileName.c_str()) != 0)
+            return false;
+        tmpFileName.clear();
+    }
+    return true;
+}
+
+const SiteArchive::Entry *SiteArchive::find(std::string_view path) const
+{
+    auto it = index.find(path);
+    return it == index.end() ? nullptr : &it->second;
+}
+
+bool SiteArchive::read(const Entry &entry, std::string &data, uint64_t offset,
+                       uint64_t size) const
+{
+    if (offset > entry.size)
+        return false;
+    size = std::min(size, entry.size - offset);
+    data.resize(size);
+    return preadAll(fd, data.data(), size, entry.offset + offset);
+}
+
+bool SiteArchive::content(const Entry &entry, std::string &data) const
+{
+    if (!(entry.flags & Gzip))
+        return read(entry, data);
+    std::string compressed;
+    return read(entry, compressed) && gunzip(compressed, data, entry.originalSize);
+}
@@ -0,0 +1,100 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+/* Site archive: a whole output directory, with the data directory, in a single file.
+ *
+ * Written by codebrowser_archive and served by codebrowser_serve, so that deploying the output
+ * is a single file copy instead of millions of small files.
+ * The bodies are appended one after the other, followed by an index, and by a trailer pointing
+ * to the index. Updating an archive appends the changed bodies and a new index: the last
+ * trailer is the valid one.
+ * The text files are stored compressed with gzip, so that they can be sent as they are to the
+ * clients which accept it. The other files, like the refs packs which are read by ranges, are
+ * stored as they are.
+ *
+ * With all the integers in little endian:
+ *   char magic[8] = "CBSITE01";
+ *   the bodies;
+ *   index: uint32_t count; count x { uint32_t pathSize; char path[pathSize];
+ *          uint64_t offset, size, originalSize, mtime; uint32_t flags; }, sorted by path;
+ *   trailer: uint64_t indexOffset, indexSize; char magic[8] = "CBSIDX01";
+ */
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class SiteArchive
+{
+public:
+    enum Flags { Gzip = 1 };
+
+    struct Entry
+    {
+        uint64_t offset = 0;
+        uint64_t size = 0; // stored size
+        uint64_t originalSize = 0;
+        uint64_t mtime = 0; // of the file it was read from, in nanoseconds
+        uint32_t flags = 0;
+    };
+
+    SiteArchive() = default;
+    SiteArchive(const SiteArchive &) = delete;
+    SiteArchive &operator=(const SiteArchive &) = delete;
+    ~SiteArchive();
+
+    // Open an existing archive, to read it or to update it
+    bool open(const std::string &path, bool forUpdate = false);
+    // Create a new archive, replacing the existing one when it is committed
+    bool create(const std::string &path);
+
+    // Append a body. 'compress' stores it with gzip, unless that does not make it smaller.
+    // Replaces the entry with the same path, if any. Can be called from several threads.
+    bool add(const std::string &path, std::string_view data, uint64_t mtime, bool compress);
+    void remove(std::string_view path);
+    // Write the index and the trailer
+    bool commit();
+
+    const Entry *find(std::string_view path) const;
+    const std::map<std::string, Entry, std::less<>> &entries() const { return index; }
+
+    // The stored body of an entry, or 'size' bytes of it from 'offset'
+    bool read(const Entry &entry, std::string &data, uint64_t offset = 0,
+              uint64_t size = UINT64_MAX) const;
+    // The original content of an entry, uncompressed
+    bool content(const Entry &entry, std::string &data) const;
+
+    static bool gzip(std::string_view data, std::string &compressed);
+    static bool gunzip(std::string_view data, std::string &result, uint64_t originalSize);
+
+private:
+    bool readIndex();
+
+    int fd = -1;
+    std::string fileName;
+    std::string tmpFileName; // when creating
+    uint64_t end = 0; // where the next body is written
+    std::mutex mutex; // protects 'end' and 'index' in add
+    std::map<std::string, Entry, std::less<>> index;
+};
@@ -90,6 +90,29 @@ $(function () {
         return str;
     }
 
+    // ATTENTION: Keep in sync with C++ function of the same name in filesystem.cpp
+    var refs_file_name = function (ref) {
+        var name = replace_invalid_filename_chars(ref);
+        if (window.refs_layout !== 2)
+            return name;
+        // hashed layout: ab/cd/name, from the FNV-1a hash of the UTF-8 bytes of the name
+        var bytes = unescape(encodeURIComponent(name));
+        var hash = 0x811c9dc5;
+        for (var i = 0; i < bytes.length; i++) {
+            hash ^= bytes.charCodeAt(i);
+            hash = Math.imul(hash, 0x01000193);
+        }
+        var hex = ("0000000" + (hash >>> 0).toString(16)).substr(-8);
+        return hex.substr(0, 2) + "/" + hex.substr(2, 2) + "/" + name;
+    }
+
+    // The refs of 'ref' in the output directory 'root': a promise of the content of its refs file
+    var get_refs = function (root, ref) {
+        if (window.refs_layout === 3)
+            return refspack_get(root, replace_invalid_filename_chars(ref));
+        return $.get(root + "/refs/" + refs_file_name(ref));
+    }
+
     var escape_selector = function (str) {
         return str.replace(/([ #;&,.+*~\':"!^$[\]()=<>|\/@{}\\])/g,'\\$1')
     }
@@ -517,8 +540,6 @@ $(function () {
         var proj_root_path = root_path;
         if (proj) { proj_root_path = projects[proj]; }
 
-        var url = proj_root_path + "/refs/" + replace_invalid_filename_chars(ref);
-
         if (!$(this).hasClass("highlight")) {
             highlight_items(ref);
         }
@@ -537,6 +558,8 @@ $(function () {
                 var absoluteRoot = absoluteUrl(proj_root_path);
                 var absoluteDataPath = absoluteUrl(data_path);
                 symbolUrl = data_path + "/symbol.html?root=" + computeRelativeUrlTo(absoluteDataPath, absoluteRoot) + "&ref=" + ref;
+                if (window.refs_layout)
+                    symbolUrl += "&refs_layout=" + window.refs_layout;
             }
 
             if (elem.hasClass("local") || elem.hasClass("tu") || elem.hasClass("lbl")
@@ -832,7 +855,7 @@ $(function () {
         if (ref && !this.tooltip_loaded && !elem.hasClass("local") && !elem.hasClass("tu")
                 && !elem.hasClass("typedef") && !elem.hasClass("lbl")) {
             this.tooltip_loaded = true;
-            $.get(url, function(data) {
+            get_refs(proj_root_path, ref).done(function(data) {
                 tt.tooltip_data = data;
                 if (tooltip.ref === ref)
                     computeTooltipContent(data, tt.title_, tt.id);
@@ -1027,8 +1050,7 @@ $(function () {
             } else if (type == "ref") {
                 var ref = searchTerms[val].ref;
 
-                var url = root_path + "/refs/" + replace_invalid_filename_chars(ref);
-                $.get(url, function(data) {
+                get_refs(root_path, ref).done(function(data) {
                     var res = $("<data>"+data+"</data>");
                     var def =  res.find("def");
                     var result = {  len: -1 };
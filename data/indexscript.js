@@ -30,6 +30,29 @@ $(function() {
         return str;
     }
 
+    // ATTENTION: Keep in sync with C++ function of the same name in filesystem.cpp
+    var refs_file_name = function (ref) {
+        var name = replace_invalid_filename_chars(ref);
+        if (window.refs_layout !== 2)
+            return name;
+        // hashed layout: ab/cd/name, from the FNV-1a hash of the UTF-8 bytes of the name
+        var bytes = unescape(encodeURIComponent(name));
+        var hash = 0x811c9dc5;
+        for (var i = 0; i < bytes.length; i++) {
+            hash ^= bytes.charCodeAt(i);
+            hash = Math.imul(hash, 0x01000193);
+        }
+        var hex = ("0000000" + (hash >>> 0).toString(16)).substr(-8);
+        return hex.substr(0, 2) + "/" + hex.substr(2, 2) + "/" + name;
+    }
+
+    // The refs of 'ref' in the output directory 'root': a promise of the content of its refs file
+    var get_refs = function (root, ref) {
+        if (window.refs_layout === 3)
+            return refspack_get(root, replace_invalid_filename_chars(ref));
+        return $.get(root + "/refs/" + refs_file_name(ref));
+    }
+
     // remove trailing slash
     root_path = root_path.replace(/\/$/, "");
     if(!root_path) root_path = ".";
@@ -70,8 +93,7 @@ $(function() {
                 window.location = root_path + '/' +  searchTerms[val].file + ".html";
             } else if (type == "ref") {
                 var ref = searchTerms[val].ref;
-                var url = root_path + "/refs/" +  replace_invalid_filename_chars(ref);
-                $.get(url, function(data) {
+                get_refs(root_path, ref).done(function(data) {
                     var res = $("<data>"+data+"</data>");
                     var def =  res.find("def");
                     var result = {  len: -1 };
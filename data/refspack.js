@@ -0,0 +1,185 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+/* Reads the packed refs written by codebrowser_refspack in <output_dir>/refspack/, with HTTP
+ * range requests. See refspack/refspack.h for the format.
+ * The metadata of a shard (header, block table, index, keys and strings) is fetched once, then
+ * each lookup fetches the compressed block of the symbol. */
+
+(function () {
+    "use strict";
+
+    var shardCount = 16; // RefsPackShards
+    var headerSize = 64;
+    var shards = {}; // url -> promise of the metadata of that shard
+
+    // ATTENTION: Keep in sync with refsPackShard in refspack/refspack.cpp
+    var shardOf = function (bytes) {
+        var hash = 0x811c9dc5;
+        for (var i = 0; i < bytes.length; i++) {
+            hash ^= bytes[i];
+            hash = Math.imul(hash, 0x01000193);
+        }
+        return (hash >>> 0) % shardCount;
+    }
+
+    // The bytes [begin, end) of the file, or up to its end if end is undefined
+    var readRange = function (url, begin, end) {
+        var range = "bytes=" + begin + "-" + (end === undefined ? "" : end - 1);
+        return fetch(url, { headers: { Range: range } }).then(function (response) {
+            if (!response.ok)
+                throw new Error(url + ": " + response.status);
+            return response.arrayBuffer().then(function (buffer) {
+                // The servers that do not support the ranges send the whole file
+                return response.status === 200 ? buffer.slice(begin, end) : buffer;
+            });
+        });
+    }
+
+    var readU64 = function (view, pos) {
+        return view.getUint32(pos, true) + view.getUint32(pos + 4, true) * 4294967296;
+    }
+
+    var loadShard = function (url) {
+        if (shards[url])
+            return shards[url];
+        shards[url] = readRange(url, 0, headerSize).then(function (buffer) {
+            var header = new DataView(buffer);
+            if (buffer.byteLength !== headerSize
+                    || new TextDecoder().decode(new Uint8Array(buffer, 0, 8)) !== "CBRPACK1")
+                throw new Error(url + ": not a refs pack");
+            var shard = {
+                keyCount: header.getUint32(8, true),
+                stringCount: header.getUint32(16, true),
+                blockTable: readU64(header, 24),
+            };
+            // The offsets of the sections, relative to the block table
+            shard.index = readU64(header, 32) - shard.blockTable;
+            shard.keys = readU64(header, 40) - shard.blockTable;
+            shard.stringOffsets = readU64(header, 48) - shard.blockTable;
+            shard.strings = readU64(header, 56) - shard.blockTable;
+            return readRange(url, shard.blockTable).then(function (buffer) {
+                shard.view = new DataView(buffer);
+                shard.bytes = new Uint8Array(buffer);
+                shard.decodedStrings = [];
+                return shard;
+            });
+        });
+        return shards[url];
+    }
+
+    // Compares the key number i of the shard with 'key', bytewise
+    var compareKey = function (shard, i, key) {
+        var entry = shard.index + i * 20;
+        var offset = shard.keys + shard.view.getUint32(entry, true);
+        var length = shard.view.getUint32(entry + 4, true);
+        for (var j = 0; j < length && j < key.length; j++) {
+            var c = shard.bytes[offset + j];
+            if (c !== key[j])
+                return c < key[j] ? -1 : 1;
+        }
+        return length - key.length;
+    }
+
+    var findEntry = function (shard, key) {
+        var low = 0, high = shard.keyCount;
+        while (low < high) {
+            var middle = (low + high) >>> 1;
+            if (compareKey(shard, middle, key) < 0)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        if (low === shard.keyCount || compareKey(shard, low, key) !== 0)
+            return null;
+        var entry = shard.index + low * 20;
+        return { block: shard.view.getUint32(entry + 8, true),
+                 offset: shard.view.getUint32(entry + 12, true),
+                 size: shard.view.getUint32(entry + 16, true) };
+    }
+
+    var inflate = function (bytes) {
+        var stream = new Blob([bytes]).stream().pipeThrough(new DecompressionStream("deflate"));
+        return new Response(stream).arrayBuffer();
+    }
+
+    var getString = function (shard, id) {
+        if (shard.decodedStrings[id] === undefined) {
+            var begin = shard.view.getUint32(shard.stringOffsets + id * 4, true);
+            var end = shard.view.getUint32(shard.stringOffsets + id * 4 + 4, true);
+            shard.decodedStrings[id] = new TextDecoder().decode(
+                shard.bytes.subarray(shard.strings + begin, shard.strings + end));
+        }
+        return shard.decodedStrings[id];
+    }
+
+    // The records of a symbol, back in the text format of the refs files
+    var decode = function (shard, bytes) {
+        var pos = 0;
+        var varint = function () {
+            var value = 0, scale = 1, byte;
+            do {
+                byte = bytes[pos++];
+                value += (byte & 0x7f) * scale;
+                scale *= 128;
+            } while (byte & 0x80);
+            return value;
+        }
+        var text = "";
+        var decoder = new TextDecoder();
+        while (pos < bytes.length) {
+            var tag = varint();
+            if (tag) {
+                var file = varint();
+                var line = varint();
+                text += "<" + getString(shard, tag - 1) + " f='" + getString(shard, file)
+                    + "' l='" + line + "'";
+            }
+            var size = varint();
+            text += decoder.decode(bytes.subarray(pos, pos + size));
+            pos += size;
+        }
+        return text;
+    }
+
+    // The refs of the symbol whose refs file is named 'key', in the output directory 'root':
+    // a jQuery promise of the same content as the refs file
+    window.refspack_get = function (root, key) {
+        var deferred = $.Deferred();
+        var keyBytes = new TextEncoder().encode(key);
+        var url = root + "/refspack/" + shardOf(keyBytes) + ".pack";
+        loadShard(url).then(function (shard) {
+            var entry = findEntry(shard, keyBytes);
+            if (!entry)
+                throw new Error(key + ": not found");
+            var blockEntry = entry.block * 16;
+            var blockOffset = readU64(shard.view, blockEntry);
+            var compressedSize = shard.view.getUint32(blockEntry + 8, true);
+            return readRange(url, blockOffset, blockOffset + compressedSize).then(inflate)
+                .then(function (block) {
+                    return decode(shard, new Uint8Array(block, entry.offset, entry.size));
+                });
+        }).then(function (text) {
+            deferred.resolve(text);
+        }, function (error) {
+            deferred.reject(error);
+        });
+        return deferred.promise();
+    }
+})();
@@ -36,6 +36,8 @@
 #include <clang/Sema/Sema.h>
 #include <clang/Tooling/Tooling.h>
 #include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/Process.h>
@@ -47,12 +49,15 @@
 #include <fstream>
 #include <initializer_list>
 #include <iostream>
+#include <mutex>
 #include <optional>
 #include <system_error>
 
 #include "filesystem.h"
 #include "inlayhintannotator.h"
+#include "manifest.h"
 #include "projectmanager.h"
+#include "refslog.h"
 #include "stringbuilder.h"
 
 namespace {
@@ -233,7 +238,7 @@ std::string Annotator::htmlNameForFile(clang::FileID id)
 
     ProjectInfo *project = projectManager.projectForFile(filename);
     if (project) {
-        bool should_process = projectManager.shouldProcess(filename, project);
+        bool should_process = projectManager.claim(filename, project, mainFileName);
         project_cache[id] = project;
         std::string fn = project->name % "/" % filename.substr(project->source_path.size());
         cache[id] = { should_process, fn };
@@ -262,6 +267,10 @@ void Annotator::registerInterestingDefinition(clang::SourceRange sourceRange,
     set.insert(declName);
 }
 
+// The refs, fnSearch and fileIndex files are shared by all the translation units that are
+// processed in parallel in this process
+static std::mutex sharedOutputMutex;
+
 bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
 {
     static const std::string mp_suffix =
@@ -281,6 +290,7 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
     // make sure the main file is in the cache.
     htmlNameForFile(getSourceMgr().getMainFileID());
 
+    std::string fileIndexLines;
     std::set<std::string> done;
     for (auto it : cache) {
         if (!it.second.first)
@@ -328,40 +338,64 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
 
         // Emit the HTML.
         const llvm::StringRef Buf = getSourceMgr().getBufferData(FID);
-        g.generate(projectManager.outputPrefix, projectManager.dataPath, fn, Buf.begin(), Buf.end(),
-                   footer,
+        g.generate(projectManager.outputPrefix, projectManager.dataPath, projectManager.refsLayout,
+                   projectManager.precompressor.get(), fn, Buf.begin(), Buf.end(), footer,
                    WasInDatabase ? ""
                                  : "Warning: That file was not part of the compilation database. "
                                    "It may have many parsing errors.",
                    interestingDefinitionsInFile[FID]);
 
         if (projectinfo.type == ProjectInfo::Normal)
-            fileIndex << fn << '\n';
+            fileIndexLines %= fn % "\n";
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sharedOutputMutex);
+        fileIndex << fileIndexLines;
+        fileIndex.flush();
     }
 
+    // With the refs log, the records are batched and dispatched to their files at the end.
+    // Otherwise, each symbol is appended directly to its file.
+    std::optional<RefsLog> refsLog;
+    if (projectManager.useRefsLog)
+        refsLog.emplace(projectManager.outputPrefix);
+    auto appendShared = [&](const std::string &path, const std::string &data) {
+        if (refsLog) {
+            refsLog->add(path, data);
+            return;
+        }
+        std::string filename = projectManager.outputPrefix % "/" % path;
+        std::lock_guard<std::mutex> lock(sharedOutputMutex);
+        if (auto error_code = append_to_file(filename, data)) {
+            std::cerr << "Error writing " << filename << ": " << error_code.message()
+                      << std::endl;
+        }
+    };
+
     // make sure all the docs are in the references
     // (There might not be when the comment is in the .cpp file (for \class))
     for (auto it : commentHandler.docs)
         references[it.first];
 
-    create_directories(llvm::Twine(projectManager.outputPrefix, "/refs/_M"));
+    // The directories of the hashed layout are created by append_to_file when needed
+    if (!refsLog && projectManager.refsLayout == FlatRefsLayout)
+        create_directories(llvm::Twine(projectManager.outputPrefix, "/refs/_M"));
+    // escaped html name -> the refs files with its records, for the next incremental runs
+    llvm::StringMap<std::vector<std::string>> refsOfFiles;
+    llvm::StringSet<> filesOfRecords;
+    llvm::SmallString<256> escapeBuffer;
+    std::string records;
     for (const auto &it : references) {
         if (llvm::StringRef(it.first).starts_with("__builtin"))
             continue;
         if (it.first == "main")
             continue;
 
-        auto refFilename = it.first;
-        replace_invalid_filename_chars(refFilename);
+        auto refFilename = refs_file_name(it.first, projectManager.refsLayout);
 
-        std::string filename = projectManager.outputPrefix % "/refs/" % refFilename % mp_suffix;
-        std::error_code error_code;
-        llvm::raw_fd_ostream myfile(filename, error_code, llvm::sys::fs::OF_Append);
-        if (error_code) {
-            std::cerr << "Error writing ref file " << filename << ": " << error_code.message()
-                      << std::endl;
-            continue;
-        }
+        records.clear();
+        llvm::raw_string_ostream myfile(records);
 
         for (const auto &it2 : it.second) {
             clang::SourceRange loc = it2.loc;
@@ -371,6 +405,7 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
             std::string fn = htmlNameForFile(sm.getFileID(expBegin));
             if (fn.empty())
                 continue;
+            filesOfRecords.insert(fn);
             clang::PresumedLoc fixedBegin = sm.getPresumedLoc(expBegin);
             clang::PresumedLoc fixedEnd = sm.getPresumedLoc(expEnd);
             const char *tag = "";
@@ -445,6 +480,8 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
             clang::SourceLocation exp = sm.getExpansionLoc(it2->second.loc);
             clang::PresumedLoc fixed = sm.getPresumedLoc(exp);
             std::string fn = htmlNameForFile(sm.getFileID(exp));
+            if (!fn.empty())
+                filesOfRecords.insert(fn);
             myfile << "<doc f='";
             Generator::escapeAttr(myfile, fn);
             myfile << "' l='" << fixed.getLine() << "'>";
@@ -477,10 +514,21 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
                 myfile << "/>\n";
             }
         }
+        myfile.flush();
+        std::string refsPath = "refs/" % refFilename % mp_suffix;
+        if (projectManager.manifest) {
+            for (const auto &fn : filesOfRecords)
+                refsOfFiles[Generator::escapeAttr(fn.first(), escapeBuffer)].push_back(refsPath);
+        }
+        filesOfRecords.clear();
+        appendShared(refsPath, records);
     }
+    for (const auto &it : refsOfFiles)
+        projectManager.manifest->recordRefs(it.first(), it.second);
 
     // now the function names
-    create_directories(llvm::Twine(projectManager.outputPrefix, "/fnSearch"));
+    if (!refsLog)
+        create_directories(llvm::Twine(projectManager.outputPrefix, "/fnSearch"));
     for (auto &fnIt : functionIndex) {
         auto fnName = fnIt.first;
         if (fnName.size() < 4)
@@ -509,19 +557,8 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
                             '\0' };
             llvm::StringRef idxRef(idx, 3); // include the '\0' on purpose
             if (saved.find(idxRef) == std::string::npos) {
-                std::string funcIndexFN =
-                    projectManager.outputPrefix % "/fnSearch/" % idx % mp_suffix;
-
-                std::error_code error_code;
-                llvm::raw_fd_ostream funcIndexFile(funcIndexFN, error_code,
-                                                   llvm::sys::fs::OF_Append);
-
-                if (error_code) {
-                    std::cerr << "Error writing index file " << funcIndexFN << ": "
-                              << error_code.message() << std::endl;
-                    continue;
-                }
-                funcIndexFile << fnIt.second << '|' << fnIt.first << '\n';
+                appendShared("fnSearch/" % std::string(idx) % mp_suffix,
+                             fnIt.second % "|" % fnIt.first % "\n");
                 saved.append(idxRef); // include \0;
             }
         }
@@ -1198,10 +1235,10 @@ void Annotator::syntaxHighlight(Generator &generator, clang::FileID FID, clang::
             case tok::kw_wchar_t:
             case tok::kw_char16_t:
             case tok::kw_char32_t:
-                generator.addTag("em", {}, TokOffs, TokLen);
+                generator.addTag("em", {}, TokOffs, TokLen, {}, Generator::Lexer);
                 break;
             default: // other keywords
-                generator.addTag("b", {}, TokOffs, TokLen);
+                generator.addTag("b", {}, TokOffs, TokLen, {}, Generator::Lexer);
             }
             break;
         }
@@ -1261,7 +1298,7 @@ void Annotator::syntaxHighlight(Generator &generator, clang::FileID FID, clang::
             LLVM_FALLTHROUGH;
         case tok::string_literal:
             // FIXME: Exclude the optional ud-suffix from the highlighted range.
-            generator.addTag("q", {}, TokOffs, TokLen);
+            generator.addTag("q", {}, TokOffs, TokLen, {}, Generator::Lexer);
             break;
 
         case tok::wide_char_constant:
@@ -1271,10 +1308,10 @@ void Annotator::syntaxHighlight(Generator &generator, clang::FileID FID, clang::
             --TokLen;
             LLVM_FALLTHROUGH;
         case tok::char_constant:
-            generator.addTag("kbd", {}, TokOffs, TokLen);
+            generator.addTag("kbd", {}, TokOffs, TokLen, {}, Generator::Lexer);
             break;
         case tok::numeric_constant:
-            generator.addTag("var", {}, TokOffs, TokLen);
+            generator.addTag("var", {}, TokOffs, TokLen, {}, Generator::Lexer);
             break;
         case tok::hash: {
             // If this is a preprocessor directive, all tokens to end of line are too.
@@ -1290,7 +1327,7 @@ void Annotator::syntaxHighlight(Generator &generator, clang::FileID FID, clang::
                 L.LexFromRawLexer(Tok);
             }
 
-            generator.addTag("u", {}, TokOffs, TokEnd - TokOffs);
+            generator.addTag("u", {}, TokOffs, TokEnd - TokOffs, {}, Generator::Lexer);
 
             // Don't skip the next token.
             continue;
@@ -158,6 +158,7 @@ private:
     std::map<clang::FileID, std::set<std::string>> interestingDefinitionsInFile;
 
     std::string args;
+    std::string mainFileName; // canonical
     clang::SourceManager *sourceManager = nullptr;
     const clang::LangOptions *langOption = nullptr;
 
@@ -193,6 +194,10 @@ public:
     {
         args = std::move(a);
     }
+    void setMainFileName(std::string canonical)
+    {
+        mainFileName = std::move(canonical);
+    }
 
     bool generate(clang::Sema &, bool WasInDatabase);
 
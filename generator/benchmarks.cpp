@@ -0,0 +1,353 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+/* Benchmarks of the hot paths of the generator, built with -DBUILD_BENCHMARKS=ON.
+ *
+ *   codebrowser_benchmarks [size_in_MB]
+ *
+ * CharScanner: scans a source buffer for the special characters of Generator::generate with
+ * each implementation the CPU supports, checks that they all find the same characters, and
+ * prints their throughput.
+ *
+ * Emit loop: escapes a source buffer into html rows like Generator::generate, without the tags,
+ * once with the per-byte switch it used before CharScanner and once with each CharScanner
+ * implementation. Checks that the output is the same, and prints the throughput of each.
+ *
+ * ProjectManager::projectForFile: looks up the project of many files among about 300 projects,
+ * some of them nested, and compares the trie with the linear scan it replaced, both for the
+ * results and the time.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "charscanner.h"
+#include "projectmanager.h"
+
+// Runs fn 'repeat' times and returns the best time, in seconds
+template<typename F>
+static double bestTime(int repeat, F &&fn)
+{
+    double best = 1e9;
+    for (int i = 0; i < repeat; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+// A buffer of C++ source of about 'size' bytes
+static std::string sourceBuffer(size_t size)
+{
+    static const char snippet[] =
+        "/* Returns the number of elements of the list which satisfy the predicate */\n"
+        "template<typename T, typename Predicate>\n"
+        "static size_t countIf(const std::vector<T> &list, Predicate &&predicate)\n"
+        "{\n"
+        "    size_t count = 0;\n"
+        "    for (const auto &element : list) {\n"
+        "        if (predicate(element) && element.isValid())\n"
+        "            ++count;\n"
+        "    }\n"
+        "    std::cerr << \"Found \" << count << \" elements in '\" << list.name() << \"'\";\n"
+        "    return count;\n"
+        "}\n\n";
+    std::string buffer;
+    buffer.reserve(size + sizeof(snippet));
+    while (buffer.size() < size)
+        buffer += snippet;
+    return buffer;
+}
+
+static const char *isaName(CharScanner::Isa isa)
+{
+    switch (isa) {
+    case CharScanner::Isa::Best:
+        return "best";
+    case CharScanner::Isa::Scalar:
+        return "scalar";
+    case CharScanner::Isa::SSE2:
+        return "SSE2";
+    case CharScanner::Isa::AVX2:
+        return "AVX2";
+    }
+    return "";
+}
+
+static bool benchmarkCharScanner(size_t size)
+{
+    std::string buffer = sourceBuffer(size);
+    const char *begin = buffer.data();
+    const char *end = begin + buffer.size();
+    bool success = true;
+    // The sets of Generator::generate and Generator::escapeAttr
+    for (const char *chars : { "\n&<>", "<>&\"'" }) {
+        // The number of characters found, and the sum of their offsets
+        std::pair<size_t, size_t> reference;
+        for (auto isa : { CharScanner::Isa::Scalar, CharScanner::Isa::SSE2,
+                          CharScanner::Isa::AVX2 }) {
+            if (!CharScanner::isSupported(isa))
+                continue;
+            CharScanner scanner(chars, isa);
+            std::pair<size_t, size_t> found;
+            double seconds = bestTime(5, [&] {
+                found = {};
+                for (const char *c = scanner.find(begin, end); c != end;
+                     c = scanner.find(c + 1, end)) {
+                    ++found.first;
+                    found.second += c - begin;
+                }
+            });
+            if (isa == CharScanner::Isa::Scalar) {
+                reference = found;
+            } else if (found != reference) {
+                std::cerr << "CharScanner " << isaName(isa) << " differs from scalar" << std::endl;
+                success = false;
+            }
+            std::string set = chars;
+            std::replace(set.begin(), set.end(), '\n', 'n');
+            std::cout << "CharScanner \"" << set << "\" " << isaName(isa) << ": "
+                      << int(buffer.size() / seconds / (1024 * 1024)) << " MB/s" << std::endl;
+        }
+    }
+    return success;
+}
+
+// The emit loop of Generator::generate, without the tags: escapes the buffer and starts a row at
+// each line. With a scanner, the characters which need nothing are skipped with it, as
+// Generator::generate does. Without, each character goes through the switch, as it did before.
+static void emitRows(const char *begin, const char *end, const CharScanner *scanner,
+                     llvm::raw_ostream &out)
+{
+    const char *c = begin;
+    const char *bufferStart = c;
+    unsigned int line = 1;
+    auto flush = [&]() {
+        if (bufferStart != c)
+            out.write(bufferStart, c - bufferStart);
+        bufferStart = c;
+    };
+
+    out << "<tr><th id=\"1\">" << 1 << "</th><td>";
+    while (c < end) {
+        if (scanner) {
+            const char *special = scanner->find(c, end);
+            if (special != c) {
+                c = special;
+                continue;
+            }
+        }
+        switch (*c) {
+        case '\n':
+            flush();
+            ++bufferStart; // skip the new line
+            ++line;
+            out << "</td></tr>\n"
+                   "<tr><th id=\""
+                << line << "\">" << line << "</th><td>";
+            break;
+        case '&':
+            flush();
+            ++bufferStart;
+            out << "&amp;";
+            break;
+        case '<':
+            flush();
+            ++bufferStart;
+            out << "&lt;";
+            break;
+        case '>':
+            flush();
+            ++bufferStart;
+            out << "&gt;";
+            break;
+        default:
+            break;
+        }
+        ++c;
+    }
+    flush();
+    out << "</td></tr>\n";
+}
+
+static bool benchmarkEmitLoop(size_t size)
+{
+    std::string buffer = sourceBuffer(size);
+    const char *begin = buffer.data();
+    const char *end = begin + buffer.size();
+
+    std::string reference;
+    double referenceSeconds = bestTime(5, [&] {
+        reference.clear();
+        llvm::raw_string_ostream out(reference);
+        emitRows(begin, end, nullptr, out);
+    });
+    std::cout << "Emit loop per-byte switch: "
+              << int(buffer.size() / referenceSeconds / (1024 * 1024)) << " MB/s" << std::endl;
+
+    bool success = true;
+    std::string html;
+    for (auto isa : { CharScanner::Isa::Scalar, CharScanner::Isa::SSE2,
+                      CharScanner::Isa::AVX2 }) {
+        if (!CharScanner::isSupported(isa))
+            continue;
+        CharScanner scanner("\n&<>", isa);
+        double seconds = bestTime(5, [&] {
+            html.clear();
+            llvm::raw_string_ostream out(html);
+            emitRows(begin, end, &scanner, out);
+        });
+        if (html != reference) {
+            std::cerr << "Emit loop with CharScanner " << isaName(isa)
+                      << " differs from the per-byte switch" << std::endl;
+            success = false;
+        }
+        char speedup[32];
+        snprintf(speedup, sizeof(speedup), "%.2f", referenceSeconds / seconds);
+        std::cout << "Emit loop CharScanner " << isaName(isa) << ": "
+                  << int(buffer.size() / seconds / (1024 * 1024)) << " MB/s, " << speedup
+                  << "x the per-byte switch" << std::endl;
+    }
+    return success;
+}
+
+// What ProjectManager::projectForFile did before the trie: the longest source_path which is a
+// prefix of the file name
+static ProjectInfo *linearProjectForFile(std::vector<ProjectInfo> &projects,
+                                         llvm::StringRef filename)
+{
+    size_t match_length = 0;
+    ProjectInfo *result = nullptr;
+    for (auto &it : projects) {
+        const std::string &source_path = it.source_path;
+        if (source_path.size() < match_length)
+            continue;
+        if (filename.starts_with(source_path)) {
+            result = &it;
+            match_length = source_path.size();
+        }
+    }
+    return result;
+}
+
+static bool benchmarkProjectForFile()
+{
+    // The source paths are canonicalized, so the directories must exist
+    llvm::SmallString<256> root;
+    if (llvm::sys::fs::createUniqueDirectory("codebrowser-benchmark", root)) {
+        std::cerr << "Cannot create a temporary directory" << std::endl;
+        return false;
+    }
+    llvm::SmallString<256> canonicalRoot;
+    llvm::sys::fs::real_path(root, canonicalRoot);
+
+    // 30 groups of 9 projects, each group with a nested third party project, and the groups
+    ProjectManager projectManager(std::string(root.str()) + "/output", {});
+    for (unsigned group = 0; group < 30; ++group) {
+        std::string groupPath = canonicalRoot.str().str() + "/group" + std::to_string(group);
+        for (unsigned project = 0; project < 9; ++project) {
+            std::string path = groupPath + "/project" + std::to_string(project);
+            if (project == 0)
+                path += "/3rdparty/library";
+            llvm::sys::fs::create_directories(path);
+            projectManager.addProject(
+                ProjectInfo("p" + std::to_string(group) + "-" + std::to_string(project), path));
+        }
+        projectManager.addProject(ProjectInfo("g" + std::to_string(group), groupPath));
+    }
+    std::cout << "projectForFile: " << projectManager.projects.size() << " projects" << std::endl;
+
+    // Files in all the projects, and some outside of them
+    std::vector<std::string> files;
+    uint32_t random = 1;
+    auto next = [&](uint32_t max) {
+        random = random * 1103515245 + 12345;
+        return (random >> 8) % max;
+    };
+    for (unsigned i = 0; i < 200000; ++i) {
+        std::string file = canonicalRoot.str().str();
+        unsigned group = next(32); // 30 and 31 are not projects
+        file += "/group" + std::to_string(group) + "/project" + std::to_string(next(10));
+        if (next(4) == 0)
+            file += "/3rdparty/library";
+        file += "/src/dir" + std::to_string(next(50)) + "/file" + std::to_string(i) + ".cpp";
+        files.push_back(std::move(file));
+    }
+    // The system projects added by the constructor
+    files.push_back("/usr/include/stdio.h");
+    files.push_back("/usr/include/sys/types.h");
+
+    bool success = true;
+    std::vector<ProjectInfo *> linear(files.size());
+    double linearSeconds = bestTime(3, [&] {
+        for (size_t i = 0; i < files.size(); ++i)
+            linear[i] = linearProjectForFile(projectManager.projects, files[i]);
+    });
+    std::vector<ProjectInfo *> trie(files.size());
+    double trieSeconds = bestTime(1, [&] {
+        for (size_t i = 0; i < files.size(); ++i)
+            trie[i] = projectManager.projectForFile(files[i]);
+    });
+    double cachedSeconds = bestTime(3, [&] {
+        for (size_t i = 0; i < files.size(); ++i)
+            trie[i] = projectManager.projectForFile(files[i]);
+    });
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (trie[i] != linear[i]) {
+            std::cerr << "projectForFile differs from the linear scan for " << files[i]
+                      << std::endl;
+            success = false;
+            break;
+        }
+    }
+    auto perLookup = [&](double seconds) { return int(seconds * 1e9 / files.size()); };
+    std::cout << "projectForFile linear: " << perLookup(linearSeconds) << " ns/lookup\n"
+              << "projectForFile trie: " << perLookup(trieSeconds) << " ns/lookup\n"
+              << "projectForFile cached: " << perLookup(cachedSeconds) << " ns/lookup"
+              << std::endl;
+
+    llvm::sys::fs::remove_directories(root);
+    return success;
+}
+
+int main(int argc, char **argv)
+{
+    size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    if (megabytes == 0) {
+        std::cerr << "Usage: " << argv[0] << " [size_in_MB]" << std::endl;
+        return -1;
+    }
+    bool success = benchmarkCharScanner(megabytes * 1024 * 1024);
+    success &= benchmarkEmitLoop(megabytes * 1024 * 1024);
+    success &= benchmarkProjectForFile();
+    return success ? 0 : 1;
+}
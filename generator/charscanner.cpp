@@ -0,0 +1,141 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "charscanner.h"
+
+#include <bit>
+#include <cassert>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define CHARSCANNER_X86 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define CHARSCANNER_AVX2 1
+#endif
+#endif
+
+// N is the number of characters to compare with, so the loops are unrolled
+template<unsigned N>
+struct CharScannerImpl
+{
+    static const char *scalar(const CharScanner &s, const char *begin, const char *end)
+    {
+        while (begin < end && !s.contains(*begin))
+            ++begin;
+        return begin;
+    }
+
+#ifdef CHARSCANNER_X86
+    static const char *sse2(const CharScanner &s, const char *begin, const char *end)
+    {
+        __m128i needles[N];
+        for (unsigned i = 0; i < N; ++i)
+            needles[i] = _mm_set1_epi8(s.chars[i]);
+        while (end - begin >= 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+            __m128i match = _mm_cmpeq_epi8(chunk, needles[0]);
+            for (unsigned i = 1; i < N; ++i)
+                match = _mm_or_si128(match, _mm_cmpeq_epi8(chunk, needles[i]));
+            if (unsigned mask = _mm_movemask_epi8(match))
+                return begin + std::countr_zero(mask);
+            begin += 16;
+        }
+        return scalar(s, begin, end);
+    }
+#endif
+
+#ifdef CHARSCANNER_AVX2
+    __attribute__((target("avx2"))) static const char *avx2(const CharScanner &s,
+                                                            const char *begin, const char *end)
+    {
+        __m256i needles[N];
+        for (unsigned i = 0; i < N; ++i)
+            needles[i] = _mm256_set1_epi8(s.chars[i]);
+        while (end - begin >= 32) {
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+            __m256i match = _mm256_cmpeq_epi8(chunk, needles[0]);
+            for (unsigned i = 1; i < N; ++i)
+                match = _mm256_or_si256(match, _mm256_cmpeq_epi8(chunk, needles[i]));
+            if (unsigned mask = _mm256_movemask_epi8(match))
+                return begin + std::countr_zero(mask);
+            begin += 32;
+        }
+        return sse2(s, begin, end);
+    }
+#endif
+
+    static CharScanner::Impl select(CharScanner::Isa isa)
+    {
+        switch (isa) {
+        case CharScanner::Isa::Scalar:
+            return &scalar;
+#ifdef CHARSCANNER_X86
+        case CharScanner::Isa::SSE2:
+            return &sse2;
+#endif
+#ifdef CHARSCANNER_AVX2
+        case CharScanner::Isa::AVX2:
+            return &avx2;
+#endif
+        default:
+            break;
+        }
+        assert(isa == CharScanner::Isa::Best);
+        if (CharScanner::isSupported(CharScanner::Isa::AVX2))
+            return select(CharScanner::Isa::AVX2);
+        if (CharScanner::isSupported(CharScanner::Isa::SSE2))
+            return select(CharScanner::Isa::SSE2);
+        return &scalar;
+    }
+};
+
+bool CharScanner::isSupported(Isa isa)
+{
+    switch (isa) {
+    case Isa::Best:
+    case Isa::Scalar:
+        return true;
+    case Isa::SSE2:
+#ifdef CHARSCANNER_X86
+        return true;
+#else
+        return false;
+#endif
+    case Isa::AVX2: {
+#ifdef CHARSCANNER_AVX2
+        static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+        return hasAvx2;
+#else
+        return false;
+#endif
+    }
+    }
+    return false;
+}
+
+CharScanner::CharScanner(llvm::StringRef chars, Isa isa)
+{
+    assert(!chars.empty() && chars.size() <= MaxChars);
+    for (unsigned i = 0; i < MaxChars; ++i)
+        this->chars[i] = i < chars.size() ? chars[i] : chars[0];
+    for (char c : chars)
+        table[static_cast<unsigned char>(c)] = true;
+    assert(isSupported(isa));
+    impl = chars.size() <= 4 ? CharScannerImpl<4>::select(isa) : CharScannerImpl<8>::select(isa);
+}
@@ -0,0 +1,60 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+
+/* Finds the next occurrence of any character of a small set in a buffer.
+ *
+ * Uses AVX2 or SSE2 when the CPU supports it (chosen at runtime), and a lookup table otherwise.
+ */
+class CharScanner
+{
+public:
+    static constexpr unsigned MaxChars = 8;
+
+    // The implementations. Best is the fastest one the CPU supports, the others are forced by
+    // the benchmarks
+    enum class Isa { Best, Scalar, SSE2, AVX2 };
+    static bool isSupported(Isa isa);
+
+    // 'chars' must not contain more than MaxChars characters. 'isa' must be supported
+    explicit CharScanner(llvm::StringRef chars, Isa isa = Isa::Best);
+
+    // Returns the first character in [begin, end) that is in the set, or end if there is none
+    const char *find(const char *begin, const char *end) const
+    {
+        return impl(*this, begin, end);
+    }
+
+    bool contains(char c) const
+    {
+        return table[static_cast<unsigned char>(c)];
+    }
+
+private:
+    using Impl = const char *(*)(const CharScanner &, const char *, const char *);
+    Impl impl;
+    char chars[MaxChars]; // padded with copies of the first char
+    bool table[256] = {};
+
+    template<unsigned N>
+    friend struct CharScannerImpl;
+};
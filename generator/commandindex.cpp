@@ -0,0 +1,208 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "commandindex.h"
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/xxhash.h>
+
+#include <iterator>
+
+static void normalize(llvm::SmallVectorImpl<char> &path)
+{
+    llvm::sys::path::native(path);
+    llvm::sys::path::remove_dots(path, true);
+    while (path.size() > 1 && llvm::sys::path::is_separator(path.back()))
+        path.pop_back();
+}
+
+static size_t depthOf(llvm::StringRef dir)
+{
+    return std::distance(llvm::sys::path::begin(dir), llvm::sys::path::end(dir));
+}
+
+CommandIndex::CommandIndex(const clang::tooling::CompilationDatabase &db)
+{
+    // How many files of each cluster, and the first of them
+    struct Count
+    {
+        unsigned count = 0;
+        size_t first = 0;
+    };
+    using Counts = llvm::DenseMap<uint64_t, Count>;
+    llvm::DenseMap<Node *, Counts> nodeCounts;
+    llvm::StringMap<Counts> includeDirCounts;
+    auto add = [](Counts &counts, uint64_t cluster, size_t file) {
+        Count &count = counts[cluster];
+        if (!count.count++)
+            count.first = file;
+    };
+    auto biggest = [](const Counts &counts) {
+        Count best;
+        for (const auto &it : counts) {
+            if (it.second.count > best.count
+                || (it.second.count == best.count && it.second.first < best.first))
+                best = it.second;
+        }
+        return best.first;
+    };
+
+    for (const auto &command : db.getAllCompileCommands()) {
+        llvm::SmallString<256> path;
+        if (llvm::sys::path::is_relative(command.Filename))
+            path = command.Directory;
+        llvm::sys::path::append(path, command.Filename);
+        normalize(path);
+        size_t file = files.size();
+        files.push_back(std::string(path.str()));
+
+        // The cluster, and the include directories
+        std::string arguments;
+        std::vector<std::string> commandIncludeDirs;
+        const auto &commandLine = command.CommandLine;
+        for (size_t i = 0; i < commandLine.size(); ++i) {
+            llvm::StringRef arg = commandLine[i];
+            if (arg == command.Filename)
+                continue;
+            if ((arg == "-o" || arg == "-MF" || arg == "-MT" || arg == "-MQ")
+                && i + 1 < commandLine.size()) {
+                ++i;
+                continue;
+            }
+            if (arg.starts_with("-o"))
+                continue;
+            arguments += arg;
+            arguments += '\0';
+
+            llvm::StringRef dir;
+            for (llvm::StringRef flag : { "-isystem", "-iquote", "-idirafter", "-I" }) {
+                if (arg == flag && i + 1 < commandLine.size()) {
+                    dir = commandLine[++i];
+                    arguments += dir;
+                    arguments += '\0';
+                    break;
+                }
+                if (arg.consume_front(flag)) {
+                    dir = arg;
+                    break;
+                }
+            }
+            if (dir.empty())
+                continue;
+            llvm::SmallString<256> includeDir;
+            if (llvm::sys::path::is_relative(dir))
+                includeDir = command.Directory;
+            llvm::sys::path::append(includeDir, dir);
+            normalize(includeDir);
+            commandIncludeDirs.push_back(std::string(includeDir.str()));
+        }
+        uint64_t cluster = llvm::xxHash64(arguments);
+        for (const auto &includeDir : commandIncludeDirs)
+            add(includeDirCounts[includeDir], cluster, file);
+
+        llvm::StringRef stem = llvm::sys::path::stem(files.back());
+        auto addStem = [&](Node *node) {
+            auto inserted = node->stems.try_emplace(stem, uint32_t(file), NoFile);
+            auto &stemFiles = inserted.first->second;
+            if (!inserted.second && stemFiles.second == NoFile
+                && files[stemFiles.first] != files[file])
+                stemFiles.second = file;
+        };
+        Node *node = &root;
+        add(nodeCounts[node], cluster, file);
+        addStem(node);
+        llvm::StringRef dir = llvm::sys::path::parent_path(files.back());
+        for (auto it = llvm::sys::path::begin(dir), end = llvm::sys::path::end(dir); it != end;
+             ++it) {
+            auto &child = node->children[*it];
+            if (!child)
+                child = std::make_unique<Node>();
+            node = child.get();
+            add(nodeCounts[node], cluster, file);
+            addStem(node);
+        }
+    }
+
+    for (const auto &it : nodeCounts)
+        it.first->representative = files[biggest(it.second)];
+    for (const auto &it : includeDirCounts)
+        includeDirs[it.first()] = files[biggest(it.second)];
+}
+
+std::string CommandIndex::bestMatch(llvm::StringRef file) const
+{
+    if (root.representative.empty())
+        return {};
+    llvm::SmallString<256> path(file);
+    normalize(path);
+    llvm::StringRef dir = llvm::sys::path::parent_path(path);
+
+    // The deepest directory of the database containing the file, and the deepest one which has
+    // a source file with the same name
+    std::string best = root.representative;
+    size_t bestDepth = 0;
+    llvm::StringRef stem = llvm::sys::path::stem(path);
+    const std::string *sameStem = nullptr;
+    size_t sameStemDepth = 0;
+    const Node *node = &root;
+    size_t depth = 0;
+    for (auto it = llvm::sys::path::begin(dir), end = llvm::sys::path::end(dir);; ++it) {
+        auto stemFiles = node->stems.find(stem);
+        if (stemFiles != node->stems.end()) {
+            uint32_t candidate = stemFiles->second.first;
+            if (files[candidate] == path)
+                candidate = stemFiles->second.second;
+            if (candidate != NoFile) {
+                sameStem = &files[candidate];
+                sameStemDepth = depth;
+            }
+        }
+        if (it == end)
+            break;
+        auto child = node->children.find(*it);
+        if (child == node->children.end())
+            break;
+        node = child->second.get();
+        best = node->representative;
+        bestDepth = ++depth;
+    }
+
+    // An include directory may be deeper, for example for the 'include' directory of a library
+    // whose sources are in 'src'
+    for (llvm::StringRef ancestor = dir; !ancestor.empty();
+         ancestor = llvm::sys::path::parent_path(ancestor)) {
+        auto includeDir = includeDirs.find(ancestor);
+        if (includeDir == includeDirs.end())
+            continue;
+        size_t depth = depthOf(ancestor);
+        if (depth >= bestDepth) {
+            best = includeDir->second;
+            bestDepth = depth;
+        }
+        break;
+    }
+
+    // The source file with the same name, as close as possible
+    if (sameStem && sameStemDepth >= bestDepth)
+        best = *sameStem;
+    return best;
+}
@@ -0,0 +1,71 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clang {
+namespace tooling {
+class CompilationDatabase;
+}
+}
+
+/* Finds which file of the compilation database has the most plausible command for a file which
+ * is not in it, usually a header.
+ *
+ * The commands are grouped in clusters of identical arguments (except the file and the output).
+ * Each directory of the database knows the biggest cluster of the files below it, and so does
+ * each include directory of the commands. The candidates are the file of the database with the
+ * same name but the extension, the deepest include directory containing the file, and the
+ * deepest directory of the database containing the file. The one sharing the deepest directory
+ * with the file wins.
+ */
+class CommandIndex
+{
+public:
+    explicit CommandIndex(const clang::tooling::CompilationDatabase &db);
+
+    // The file of the database whose command should be used for 'file' (absolute), or an empty
+    // string if the database has no files
+    std::string bestMatch(llvm::StringRef file) const;
+
+private:
+    static constexpr uint32_t NoFile = UINT32_MAX;
+
+    struct Node
+    {
+        llvm::StringMap<std::unique_ptr<Node>> children;
+        std::string representative; // a file of the biggest cluster below this directory
+        // stem -> the first two different files with that name below this directory, indexes in
+        // 'files'. Two, so that there is another one when the file itself is in the database.
+        llvm::StringMap<std::pair<uint32_t, uint32_t>> stems;
+    };
+
+    Node root;
+    llvm::StringMap<std::string> includeDirs; // -> a file of their biggest cluster
+    std::vector<std::string> files;
+};
@@ -268,7 +268,7 @@ private:
                 attr = "class=\"" % className % "\" data-ref=\"" % ref % "\"";
             }
             auto offset = annotator.getSourceMgr().getFileOffset(range.getBegin());
-            generator.addTag("span", attr, offset, len);
+            generator.addTag("span", attr, offset, len, {}, Generator::Comments);
         }
     }
 
@@ -355,7 +355,7 @@ static void handleUrlsInComment(Generator &generator, llvm::StringRef rawString,
 
         auto len = pos - begin;
         generator.addTag("a", "href=\"" % rawString.substr(begin, len) % "\"", commentStart + begin,
-                         len);
+                         len, {}, Generator::Comments);
     }
 }
 
@@ -395,7 +395,7 @@ void CommentHandler::handleComment(Annotator &A, Generator &generator, clang::Se
             for (auto &p : visitor.SubDocs)
                 docs.insert(std::move(p));
             docs.insert({ std::move(visitor.DeclRef), { rawString.str(), commentLoc } });
-            generator.addTag("i", attributes, commentStart, len);
+            generator.addTag("i", attributes, commentStart, len, {}, Generator::Lexer);
             return;
         }
     }
@@ -414,5 +414,5 @@ void CommentHandler::handleComment(Annotator &A, Generator &generator, clang::Se
         }
     }
 
-    generator.addTag("i", attributes, commentStart, len);
+    generator.addTag("i", attributes, commentStart, len, {}, Generator::Lexer);
 }
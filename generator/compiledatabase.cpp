@@ -0,0 +1,615 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "compiledatabase.h"
+
+#include <llvm/ADT/StringSwitch.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ConvertUTF.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/StringSaver.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstring>
+
+#include "filesystem.h"
+#include "stringbuilder.h"
+
+namespace {
+// Just enough of JSON for a compilation database
+class JSONReader
+{
+    const char *begin;
+    const char *p;
+    const char *end;
+    std::string scratch; // the strings with escapes are unescaped there
+
+public:
+    explicit JSONReader(llvm::StringRef json)
+        : begin(json.begin())
+        , p(json.begin())
+        , end(json.end())
+    {
+    }
+
+    size_t offset() const
+    {
+        return p - begin;
+    }
+
+    void skipSpaces()
+    {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+            ++p;
+    }
+
+    bool consume(char c)
+    {
+        skipSpaces();
+        if (p < end && *p == c) {
+            ++p;
+            return true;
+        }
+        return false;
+    }
+
+    // The result is only valid until the next call
+    bool readString(llvm::StringRef &result);
+    bool skipValue();
+
+private:
+    bool readHex4(unsigned &value);
+};
+}
+
+bool JSONReader::readHex4(unsigned &value)
+{
+    if (end - p < 4 || llvm::StringRef(p, 4).getAsInteger(16, value))
+        return false;
+    p += 4;
+    return true;
+}
+
+bool JSONReader::readString(llvm::StringRef &result)
+{
+    if (!consume('"'))
+        return false;
+    // Most strings have no escapes, and are used in place
+    const char *start = p;
+    while (p < end && *p != '"' && *p != '\\')
+        ++p;
+    if (p == end)
+        return false;
+    if (*p == '"') {
+        result = llvm::StringRef(start, p - start);
+        ++p;
+        return true;
+    }
+
+    scratch.assign(start, p);
+    while (p < end) {
+        char c = *p++;
+        if (c == '"') {
+            result = scratch;
+            return true;
+        }
+        if (c != '\\') {
+            scratch += c;
+            continue;
+        }
+        if (p == end)
+            return false;
+        switch (char e = *p++) {
+        case '"':
+        case '\\':
+        case '/':
+            scratch += e;
+            break;
+        case 'b':
+            scratch += '\b';
+            break;
+        case 'f':
+            scratch += '\f';
+            break;
+        case 'n':
+            scratch += '\n';
+            break;
+        case 'r':
+            scratch += '\r';
+            break;
+        case 't':
+            scratch += '\t';
+            break;
+        case 'u': {
+            unsigned codePoint;
+            if (!readHex4(codePoint))
+                return false;
+            if (codePoint >= 0xD800 && codePoint < 0xDC00) {
+                // A surrogate pair
+                unsigned low;
+                if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                    return false;
+                p += 2;
+                if (!readHex4(low) || low < 0xDC00 || low >= 0xE000)
+                    return false;
+                codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+            }
+            char buffer[UNI_MAX_UTF8_BYTES_PER_CODE_POINT];
+            char *out = buffer;
+            if (!llvm::ConvertCodePointToUTF8(codePoint, out))
+                return false;
+            scratch.append(buffer, out);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+bool JSONReader::skipValue()
+{
+    skipSpaces();
+    if (p == end)
+        return false;
+    if (*p == '"') {
+        llvm::StringRef ignored;
+        return readString(ignored);
+    }
+    if (*p == '{' || *p == '[') {
+        char close = *p == '{' ? '}' : ']';
+        ++p;
+        if (consume(close))
+            return true;
+        do {
+            llvm::StringRef key;
+            if (close == '}' && (!readString(key) || !consume(':')))
+                return false;
+            if (!skipValue())
+                return false;
+        } while (consume(','));
+        return consume(close);
+    }
+    // A number, true, false or null
+    const char *start = p;
+    while (p < end && !std::strchr(",}] \n\r\t", *p))
+        ++p;
+    return p != start;
+}
+
+// The "command" with the GNU syntax, split like the JSONCompilationDatabase does: only spaces
+// separate the arguments, and a backslash escapes any character except between single quotes
+static void unescapeGnuCommandLine(llvm::StringRef command, std::vector<std::string> &arguments)
+{
+    const char *p = command.begin();
+    const char *end = command.end();
+    while (true) {
+        while (p != end && *p == ' ')
+            ++p;
+        if (p == end)
+            return;
+        std::string argument;
+        while (p != end && *p != ' ') {
+            if (*p == '\'' || *p == '"') {
+                char quote = *p++;
+                while (p != end && *p != quote) {
+                    if (quote == '"' && *p == '\\' && ++p == end)
+                        break;
+                    argument += *p++;
+                }
+                if (p != end)
+                    ++p;
+            } else {
+                if (*p == '\\' && ++p == end)
+                    break;
+                argument += *p++;
+            }
+        }
+        arguments.push_back(std::move(argument));
+    }
+}
+
+static llvm::StringRef stripExecutableExtension(llvm::StringRef name)
+{
+#ifdef _WIN32
+    name.consume_back(".exe");
+#endif
+    return name;
+}
+
+// Remove a compiler launcher (distcc, ccache, sccache) which is followed by the compiler.
+// Like in the JSONCompilationDatabase.
+static bool unwrapCommand(llvm::SmallVectorImpl<llvm::StringRef> &arguments)
+{
+    if (arguments.size() < 2)
+        return false;
+    llvm::StringRef wrapper = stripExecutableExtension(llvm::sys::path::filename(arguments[0]));
+    if (wrapper != "distcc" && wrapper != "ccache" && wrapper != "sccache")
+        return false;
+    // Otherwise the wrapper is used like the compiler, which is fine
+    bool hasCompiler = !arguments[1].starts_with("-")
+        && !llvm::sys::path::has_extension(stripExecutableExtension(arguments[1]));
+    if (hasCompiler)
+        arguments.erase(arguments.begin());
+    return hasCompiler;
+}
+
+uint32_t MappedCompilationDatabase::intern(llvm::StringRef s)
+{
+    auto it = stringIds.find(s);
+    if (it != stringIds.end())
+        return it->second;
+    llvm::StringRef saved = llvm::StringSaver(allocator).save(s);
+    strings.push_back(saved);
+    stringIds[saved] = strings.size() - 1;
+    return strings.size() - 1;
+}
+
+bool MappedCompilationDatabase::parse(llvm::StringRef json, std::string &ErrorMessage)
+{
+    JSONReader reader(json);
+    auto fail = [&](llvm::StringRef message) {
+        ErrorMessage = "Error while parsing the compilation database at offset "
+            % std::to_string(reader.offset()) % ": " % message;
+        return false;
+    };
+
+    enum Key { Directory, File, Output, Arguments, Command, Other };
+    std::string commandString;
+    std::vector<std::string> tokens;
+    llvm::SmallVector<llvm::StringRef, 128> commandLine;
+
+    if (!reader.consume('['))
+        return fail("expected an array");
+    if (!reader.consume(']')) {
+        do {
+            if (!reader.consume('{'))
+                return fail("expected an object");
+            Entry entry { NoString, NoString, NoString, NoString, 0, 0 };
+            bool hasArguments = false;
+            bool hasCommand = false;
+            if (!reader.consume('}')) {
+                do {
+                    llvm::StringRef name;
+                    if (!reader.readString(name) || !reader.consume(':'))
+                        return fail("expected a key");
+                    Key key = llvm::StringSwitch<Key>(name)
+                                  .Case("directory", Directory)
+                                  .Case("file", File)
+                                  .Case("output", Output)
+                                  .Case("arguments", Arguments)
+                                  .Case("command", Command)
+                                  .Default(Other);
+
+                    llvm::StringRef value;
+                    switch (key) {
+                    case Directory:
+                    case File:
+                    case Output: {
+                        if (!reader.readString(value))
+                            return fail("expected a string");
+                        uint32_t &field = key == Directory ? entry.directory
+                            : key == File                  ? entry.file
+                                                           : entry.output;
+                        field = intern(value);
+                        break;
+                    }
+                    case Arguments:
+                        // Wins over "command"
+                        if (!reader.consume('['))
+                            return fail("expected an array of arguments");
+                        hasArguments = true;
+                        commandLine.clear();
+                        if (!reader.consume(']')) {
+                            do {
+                                if (!reader.readString(value))
+                                    return fail("expected a string");
+                                commandLine.push_back(strings[intern(value)]);
+                            } while (reader.consume(','));
+                            if (!reader.consume(']'))
+                                return fail("expected ']'");
+                        }
+                        break;
+                    case Command:
+                        if (!reader.readString(value))
+                            return fail("expected a string");
+                        hasCommand = true;
+                        commandString.assign(value.begin(), value.end());
+                        break;
+                    case Other:
+                        if (!reader.skipValue())
+                            return fail("invalid value");
+                        break;
+                    }
+                } while (reader.consume(','));
+                if (!reader.consume('}'))
+                    return fail("expected '}'");
+            }
+
+            if (entry.directory == NoString)
+                return fail("missing key \"directory\"");
+            if (entry.file == NoString)
+                return fail("missing key \"file\"");
+            if (!hasArguments && !hasCommand)
+                return fail("missing key \"command\" or \"arguments\"");
+
+            if (!hasArguments) {
+                tokens.clear();
+#ifdef _WIN32
+                llvm::BumpPtrAllocator tokensAllocator;
+                llvm::StringSaver saver(tokensAllocator);
+                llvm::SmallVector<const char *, 128> windowsTokens;
+                llvm::cl::TokenizeWindowsCommandLine(commandString, saver, windowsTokens);
+                tokens.assign(windowsTokens.begin(), windowsTokens.end());
+#else
+                unescapeGnuCommandLine(commandString, tokens);
+#endif
+                commandLine.clear();
+                for (const auto &token : tokens)
+                    commandLine.push_back(strings[intern(token)]);
+            }
+            // There may be several wrappers, as using distcc and ccache together is common
+            while (unwrapCommand(commandLine)) {
+            }
+            entry.firstArgument = argumentStorage.size();
+            for (llvm::StringRef argument : commandLine)
+                argumentStorage.push_back(intern(argument));
+            entry.argumentCount = commandLine.size();
+
+            // Looked up like the JSONCompilationDatabase does
+            llvm::SmallString<256> path;
+            llvm::StringRef file = strings[entry.file];
+            if (llvm::sys::path::is_relative(file)) {
+                path = strings[entry.directory];
+                llvm::sys::path::append(path, file);
+            } else {
+                path = file;
+            }
+            llvm::sys::path::native(path);
+            llvm::sys::path::remove_dots(path, true);
+            entry.path = intern(path);
+
+            entryStorage.push_back(entry);
+        } while (reader.consume(','));
+        if (!reader.consume(']'))
+            return fail("expected ']'");
+    }
+
+    entries = entryStorage;
+    arguments = argumentStorage;
+    stringIds.shrink_and_clear();
+    return true;
+}
+
+namespace {
+struct CacheHeader
+{
+    char magic[8];
+    uint64_t jsonSize;
+    uint64_t jsonTime;
+    uint32_t stringCount;
+    uint32_t entryCount;
+    uint64_t argumentCount;
+};
+// Followed by:
+//   uint64_t stringEnds[stringCount]; // in the blob
+//   Entry entries[entryCount];
+//   uint32_t arguments[argumentCount];
+//   char blob[];
+const char CacheMagic[8] = { 'C', 'B', 'C', 'D', 'B', '0', '0', '1' };
+}
+
+bool MappedCompilationDatabase::loadCache(std::unique_ptr<llvm::MemoryBuffer> cache,
+                                          uint64_t jsonSize, uint64_t jsonTime)
+{
+    llvm::StringRef data = cache->getBuffer();
+    CacheHeader header;
+    if (data.size() < sizeof(header))
+        return false;
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) != 0
+        || header.jsonSize != jsonSize || header.jsonTime != jsonTime)
+        return false;
+
+    uint64_t blobStart = sizeof(header) + uint64_t(header.stringCount) * sizeof(uint64_t)
+        + uint64_t(header.entryCount) * sizeof(Entry) + header.argumentCount * sizeof(uint32_t);
+    if (blobStart > data.size())
+        return false;
+    const char *base = data.data();
+    auto stringEnds = reinterpret_cast<const uint64_t *>(base + sizeof(header));
+    auto cachedEntries = reinterpret_cast<const Entry *>(stringEnds + header.stringCount);
+    auto cachedArguments = reinterpret_cast<const uint32_t *>(cachedEntries + header.entryCount);
+    llvm::StringRef blob = data.substr(blobStart);
+
+    strings.reserve(header.stringCount);
+    uint64_t start = 0;
+    for (uint32_t i = 0; i < header.stringCount; ++i) {
+        if (stringEnds[i] < start || stringEnds[i] > blob.size())
+            return false;
+        strings.push_back(blob.slice(start, stringEnds[i]));
+        start = stringEnds[i];
+    }
+    entries = llvm::ArrayRef<Entry>(cachedEntries, header.entryCount);
+    arguments = llvm::ArrayRef<uint32_t>(cachedArguments, header.argumentCount);
+    for (const Entry &entry : entries) {
+        if (entry.directory >= strings.size() || entry.file >= strings.size()
+            || entry.path >= strings.size()
+            || (entry.output != NoString && entry.output >= strings.size())
+            || uint64_t(entry.firstArgument) + entry.argumentCount > arguments.size())
+            return false;
+    }
+    for (uint32_t argument : arguments) {
+        if (argument >= strings.size())
+            return false;
+    }
+    cacheBuffer = std::move(cache);
+    return true;
+}
+
+void MappedCompilationDatabase::saveCache(llvm::StringRef cacheFile, uint64_t jsonSize,
+                                          uint64_t jsonTime) const
+{
+    CacheHeader header;
+    std::memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.jsonSize = jsonSize;
+    header.jsonTime = jsonTime;
+    header.stringCount = strings.size();
+    header.entryCount = entries.size();
+    header.argumentCount = arguments.size();
+
+    create_directories(llvm::sys::path::parent_path(cacheFile));
+    // Several generators may write it at the same time: each one writes its own temporary file
+    std::string tmpFile =
+        cacheFile % ".tmp" % std::to_string(llvm::sys::Process::getProcessId());
+    {
+        std::error_code error_code;
+        llvm::raw_fd_ostream out(tmpFile, error_code, llvm::sys::fs::OF_None);
+        if (error_code)
+            return;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        uint64_t stringEnd = 0;
+        for (llvm::StringRef s : strings) {
+            stringEnd += s.size();
+            out.write(reinterpret_cast<const char *>(&stringEnd), sizeof(stringEnd));
+        }
+        out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(Entry));
+        out.write(reinterpret_cast<const char *>(arguments.data()),
+                  arguments.size() * sizeof(uint32_t));
+        for (llvm::StringRef s : strings)
+            out << s;
+        if (out.has_error()) {
+            out.clear_error();
+            llvm::sys::fs::remove(tmpFile);
+            return;
+        }
+    }
+    // The rename is atomic: the last writer wins
+    if (llvm::sys::fs::rename(tmpFile, cacheFile))
+        llvm::sys::fs::remove(tmpFile);
+}
+
+void MappedCompilationDatabase::buildIndex()
+{
+    for (uint32_t i = 0; i < entries.size(); ++i) {
+        llvm::StringRef path = strings[entries[i].path];
+        auto inserted = entriesOfPath.try_emplace(path);
+        if (inserted.second)
+            pathsOfFilename[llvm::sys::path::filename(path)].push_back(entries[i].path);
+        inserted.first->second.push_back(i);
+    }
+}
+
+std::unique_ptr<MappedCompilationDatabase>
+MappedCompilationDatabase::loadFromFile(llvm::StringRef jsonFile, llvm::StringRef cacheFile,
+                                        std::string &ErrorMessage)
+{
+    llvm::sys::fs::file_status status;
+    if (std::error_code error_code = llvm::sys::fs::status(jsonFile, status)) {
+        ErrorMessage = "Error while opening JSON database: " + error_code.message();
+        return nullptr;
+    }
+    uint64_t jsonSize = status.getSize();
+    uint64_t jsonTime = status.getLastModificationTime().time_since_epoch().count();
+
+    std::unique_ptr<MappedCompilationDatabase> db(new MappedCompilationDatabase);
+    if (!cacheFile.empty()) {
+        auto cache = llvm::MemoryBuffer::getFile(cacheFile, /*IsText=*/false,
+                                                 /*RequiresNullTerminator=*/false);
+        if (cache && db->loadCache(std::move(cache.get()), jsonSize, jsonTime)) {
+            db->buildIndex();
+            return db;
+        }
+        db.reset(new MappedCompilationDatabase);
+    }
+
+    auto json = llvm::MemoryBuffer::getFile(jsonFile, /*IsText=*/false,
+                                            /*RequiresNullTerminator=*/false);
+    if (!json) {
+        ErrorMessage = "Error while opening JSON database: " + json.getError().message();
+        return nullptr;
+    }
+    if (!db->parse(json.get()->getBuffer(), ErrorMessage))
+        return nullptr;
+    if (!cacheFile.empty())
+        db->saveCache(cacheFile, jsonSize, jsonTime);
+    db->buildIndex();
+    return db;
+}
+
+clang::tooling::CompileCommand MappedCompilationDatabase::command(const Entry &entry) const
+{
+    std::vector<std::string> commandLine;
+    commandLine.reserve(entry.argumentCount);
+    for (uint32_t id : arguments.slice(entry.firstArgument, entry.argumentCount))
+        commandLine.push_back(strings[id].str());
+    return clang::tooling::CompileCommand(
+        strings[entry.directory], strings[entry.file], std::move(commandLine),
+        entry.output == NoString ? llvm::StringRef() : strings[entry.output]);
+}
+
+std::vector<clang::tooling::CompileCommand>
+MappedCompilationDatabase::getCompileCommands(llvm::StringRef FilePath) const
+{
+    llvm::SmallString<256> path(FilePath);
+    llvm::sys::path::native(path);
+    auto it = entriesOfPath.find(path);
+    if (it == entriesOfPath.end()) {
+        // The file may be reached with another path, through a symlink
+        auto candidates = pathsOfFilename.find(llvm::sys::path::filename(path));
+        if (candidates == pathsOfFilename.end())
+            return {};
+        for (uint32_t candidate : candidates->second) {
+            if (llvm::sys::fs::equivalent(strings[candidate], path)) {
+                it = entriesOfPath.find(strings[candidate]);
+                break;
+            }
+        }
+        if (it == entriesOfPath.end())
+            return {};
+    }
+
+    std::vector<clang::tooling::CompileCommand> commands;
+    for (uint32_t i : it->second)
+        commands.push_back(command(entries[i]));
+    return commands;
+}
+
+std::vector<std::string> MappedCompilationDatabase::getAllFiles() const
+{
+    std::vector<std::string> files;
+    files.reserve(entriesOfPath.size());
+    for (uint32_t i = 0; i < entries.size(); ++i) {
+        llvm::StringRef path = strings[entries[i].path];
+        if (entriesOfPath.find(path)->second.front() == i)
+            files.push_back(path.str());
+    }
+    return files;
+}
+
+std::vector<clang::tooling::CompileCommand> MappedCompilationDatabase::getAllCompileCommands() const
+{
+    std::vector<clang::tooling::CompileCommand> commands;
+    commands.reserve(entries.size());
+    for (const Entry &entry : entries)
+        commands.push_back(command(entry));
+    return commands;
+}
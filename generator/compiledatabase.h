@@ -0,0 +1,94 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* A compile_commands.json read in one pass over the mapped file, without building a document.
+ *
+ * All the strings (directories, files, arguments) are interned, and each command is a list of
+ * string ids, so the many arguments that the commands share are only stored once. The commands
+ * of a file are found with a hash of its path.
+ *
+ * The database can be saved in a binary cache, which the next runs load without parsing.
+ */
+class MappedCompilationDatabase : public clang::tooling::CompilationDatabase
+{
+public:
+    // 'cacheFile', if not empty, is used instead of the json file when it is up to date, and
+    // written otherwise
+    static std::unique_ptr<MappedCompilationDatabase>
+    loadFromFile(llvm::StringRef jsonFile, llvm::StringRef cacheFile, std::string &ErrorMessage);
+
+    std::vector<clang::tooling::CompileCommand>
+    getCompileCommands(llvm::StringRef FilePath) const override;
+    std::vector<std::string> getAllFiles() const override;
+    std::vector<clang::tooling::CompileCommand> getAllCompileCommands() const override;
+
+    // The layout of the cache: the entries and the arguments are read in place
+    struct Entry
+    {
+        uint32_t directory;
+        uint32_t file; // as written in the database
+        uint32_t path; // the absolute native path of the file, to look it up
+        uint32_t output; // NoString if there is none
+        uint32_t firstArgument;
+        uint32_t argumentCount;
+    };
+    static constexpr uint32_t NoString = ~0u;
+
+private:
+    MappedCompilationDatabase() = default;
+
+    bool parse(llvm::StringRef json, std::string &ErrorMessage);
+    bool loadCache(std::unique_ptr<llvm::MemoryBuffer> cache, uint64_t jsonSize,
+                   uint64_t jsonTime);
+    void saveCache(llvm::StringRef cacheFile, uint64_t jsonSize, uint64_t jsonTime) const;
+    uint32_t intern(llvm::StringRef s);
+    void buildIndex();
+    clang::tooling::CompileCommand command(const Entry &entry) const;
+
+    std::vector<llvm::StringRef> strings;
+    llvm::ArrayRef<Entry> entries;
+    llvm::ArrayRef<uint32_t> arguments;
+
+    // The storage when parsed from json
+    llvm::BumpPtrAllocator allocator;
+    llvm::DenseMap<llvm::StringRef, uint32_t> stringIds;
+    std::vector<Entry> entryStorage;
+    std::vector<uint32_t> argumentStorage;
+    // The storage when loaded from the cache
+    std::unique_ptr<llvm::MemoryBuffer> cacheBuffer;
+
+    llvm::StringMap<llvm::SmallVector<uint32_t, 1>> entriesOfPath;
+    llvm::StringMap<llvm::SmallVector<uint32_t, 1>> pathsOfFilename; // for the fallback lookup
+};
@@ -0,0 +1,250 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "embeddedfilesystem.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+
+#include <mutex>
+#include <vector>
+
+#include "embedded_includes.h"
+
+#if EMBEDDED_FILES_COMPRESSED
+#include <zlib.h>
+#endif
+
+namespace {
+
+struct Builtin
+{
+    const EmbeddedFile *file = nullptr;
+    llvm::sys::fs::UniqueID uniqueID;
+    size_t size = 0; // of the content, once decompressed
+    std::once_flag decompressed;
+    std::string content; // only used when the embedded data is compressed
+};
+
+/* The embedded files by name, shared by all the instances */
+struct BuiltinIndex
+{
+    llvm::StringMap<Builtin> files;
+    llvm::StringMap<llvm::sys::fs::UniqueID> directories;
+
+    BuiltinIndex()
+    {
+        for (const EmbeddedFile *f = EmbeddedFiles; f->filename; ++f) {
+            Builtin &builtin = files[f->filename];
+            builtin.file = f;
+            builtin.uniqueID = llvm::vfs::getNextVirtualUniqueID();
+#if EMBEDDED_FILES_COMPRESSED
+            // gzip ends with the size of the content modulo 2^32, in little endian
+            const auto *end = reinterpret_cast<const unsigned char *>(f->content + f->size);
+            builtin.size = f->size < 4
+                ? 0
+                : size_t(end[-4]) | size_t(end[-3]) << 8 | size_t(end[-2]) << 16
+                    | size_t(end[-1]) << 24;
+#else
+            builtin.size = f->size;
+#endif
+            for (llvm::StringRef dir = llvm::sys::path::parent_path(f->filename,
+                                                                    llvm::sys::path::Style::posix);
+                 dir.size() > 1;
+                 dir = llvm::sys::path::parent_path(dir, llvm::sys::path::Style::posix)) {
+                if (!directories.try_emplace(dir, llvm::vfs::getNextVirtualUniqueID()).second)
+                    break;
+            }
+        }
+    }
+
+    static BuiltinIndex &instance()
+    {
+        static BuiltinIndex index;
+        return index;
+    }
+};
+
+#if EMBEDDED_FILES_COMPRESSED
+static std::string decompress(const EmbeddedFile &file, size_t size)
+{
+    std::string content(size, '\0');
+    z_stream stream = {};
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(file.content));
+    stream.avail_in = file.size;
+    stream.next_out = reinterpret_cast<Bytef *>(&content[0]);
+    stream.avail_out = size;
+    // 16 + MAX_WBITS: gzip format
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+        return {};
+    int result = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    if (result != Z_STREAM_END)
+        return {};
+    return content;
+}
+#endif
+
+static llvm::StringRef contentOf(Builtin &builtin)
+{
+#if EMBEDDED_FILES_COMPRESSED
+    std::call_once(builtin.decompressed,
+                   [&] { builtin.content = decompress(*builtin.file, builtin.size); });
+    return builtin.content;
+#else
+    return llvm::StringRef(builtin.file->content, builtin.file->size);
+#endif
+}
+
+static llvm::vfs::Status statusOf(llvm::StringRef path, const Builtin &builtin)
+{
+    return llvm::vfs::Status(path, builtin.uniqueID, llvm::sys::TimePoint<>(), 0, 0, builtin.size,
+                             llvm::sys::fs::file_type::regular_file, llvm::sys::fs::all_read);
+}
+
+class BuiltinFile : public llvm::vfs::File
+{
+    llvm::vfs::Status stat;
+    Builtin &builtin;
+
+public:
+    BuiltinFile(llvm::vfs::Status stat, Builtin &builtin)
+        : stat(std::move(stat))
+        , builtin(builtin)
+    {
+    }
+
+    llvm::ErrorOr<llvm::vfs::Status> status() override { return stat; }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+    getBuffer(const llvm::Twine &Name, int64_t, bool RequiresNullTerminator, bool) override
+    {
+        // Both the embedded string literals and the decompressed strings are null terminated
+        return llvm::MemoryBuffer::getMemBuffer(contentOf(builtin), Name.str(),
+                                                RequiresNullTerminator);
+    }
+
+    std::error_code close() override { return {}; }
+};
+
+class BuiltinDirIterator : public llvm::vfs::detail::DirIterImpl
+{
+    std::vector<llvm::vfs::directory_entry> entries;
+    size_t next = 0;
+
+public:
+    explicit BuiltinDirIterator(std::vector<llvm::vfs::directory_entry> entries)
+        : entries(std::move(entries))
+    {
+        increment();
+    }
+
+    std::error_code increment() override
+    {
+        CurrentEntry = next < entries.size() ? entries[next++] : llvm::vfs::directory_entry();
+        return {};
+    }
+};
+
+}
+
+// The builtins are only looked up with absolute paths, in the posix style
+static llvm::SmallString<256> normalize(const llvm::Twine &Path, llvm::StringRef workingDirectory)
+{
+    llvm::SmallString<256> path;
+    Path.toVector(path);
+    if (!llvm::sys::path::is_absolute(path, llvm::sys::path::Style::posix)) {
+        llvm::SmallString<256> absolute(workingDirectory);
+        llvm::sys::path::append(absolute, llvm::sys::path::Style::posix, path);
+        path = absolute;
+    }
+    llvm::sys::path::remove_dots(path, true, llvm::sys::path::Style::posix);
+    return path;
+}
+
+llvm::ErrorOr<llvm::vfs::Status> EmbeddedFileSystem::status(const llvm::Twine &Path)
+{
+    auto &index = BuiltinIndex::instance();
+    auto path = normalize(Path, workingDirectory);
+    auto file = index.files.find(path);
+    if (file != index.files.end())
+        return statusOf(path, file->second);
+    auto dir = index.directories.find(path);
+    if (dir != index.directories.end()) {
+        return llvm::vfs::Status(path, dir->second, llvm::sys::TimePoint<>(), 0, 0, 0,
+                                 llvm::sys::fs::file_type::directory_file,
+                                 llvm::sys::fs::all_read | llvm::sys::fs::all_exe);
+    }
+    return std::make_error_code(std::errc::no_such_file_or_directory);
+}
+
+llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+EmbeddedFileSystem::openFileForRead(const llvm::Twine &Path)
+{
+    auto &index = BuiltinIndex::instance();
+    auto path = normalize(Path, workingDirectory);
+    auto file = index.files.find(path);
+    if (file == index.files.end()) {
+        return std::make_error_code(index.directories.count(path)
+                                        ? std::errc::is_a_directory
+                                        : std::errc::no_such_file_or_directory);
+    }
+    return std::unique_ptr<llvm::vfs::File>(
+        new BuiltinFile(statusOf(path, file->second), file->second));
+}
+
+llvm::vfs::directory_iterator EmbeddedFileSystem::dir_begin(const llvm::Twine &Dir,
+                                                            std::error_code &EC)
+{
+    auto &index = BuiltinIndex::instance();
+    auto path = normalize(Dir, workingDirectory);
+    if (!index.directories.count(path)) {
+        EC = std::make_error_code(std::errc::no_such_file_or_directory);
+        return {};
+    }
+    EC = {};
+    std::vector<llvm::vfs::directory_entry> entries;
+    auto isChild = [&](llvm::StringRef name) {
+        return llvm::sys::path::parent_path(name, llvm::sys::path::Style::posix) == path;
+    };
+    for (const auto &it : index.files) {
+        if (isChild(it.getKey()))
+            entries.emplace_back(it.getKey().str(), llvm::sys::fs::file_type::regular_file);
+    }
+    for (const auto &it : index.directories) {
+        if (isChild(it.getKey()))
+            entries.emplace_back(it.getKey().str(), llvm::sys::fs::file_type::directory_file);
+    }
+    return llvm::vfs::directory_iterator(std::make_shared<BuiltinDirIterator>(std::move(entries)));
+}
+
+llvm::ErrorOr<std::string> EmbeddedFileSystem::getCurrentWorkingDirectory() const
+{
+    return workingDirectory;
+}
+
+std::error_code EmbeddedFileSystem::setCurrentWorkingDirectory(const llvm::Twine &Path)
+{
+    // Like the InMemoryFileSystem, accept any directory: the overlay sets it on all its layers
+    workingDirectory = Path.str();
+    return {};
+}
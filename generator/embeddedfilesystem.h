@@ -0,0 +1,45 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/Support/VirtualFileSystem.h>
+
+#include <string>
+
+/* A read-only file system with the clang builtin headers that are embedded in the executable,
+ * in /builtins. Everything else is reported as not found, so it goes on top of an overlay.
+ *
+ * The files are served straight from the embedded data, without copying it. If the data was
+ * compressed at build time (COMPRESS_BUILTINS), a file is decompressed the first time it is
+ * opened, once for the whole process.
+ */
+class EmbeddedFileSystem : public llvm::vfs::FileSystem
+{
+public:
+    llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &Path) override;
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+    openFileForRead(const llvm::Twine &Path) override;
+    llvm::vfs::directory_iterator dir_begin(const llvm::Twine &Dir, std::error_code &EC) override;
+    llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override;
+    std::error_code setCurrentWorkingDirectory(const llvm::Twine &Path) override;
+
+private:
+    std::string workingDirectory = "/";
+};
@@ -22,13 +22,19 @@
 #include "filesystem.h"
 
 #include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/ADT/Twine.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <mutex>
+#include <shared_mutex>
 
 void make_forward_slashes(char *str)
 {
@@ -50,19 +56,75 @@ void replace_invalid_filename_chars(std::string &str)
     std::replace(str.begin(), str.end(), ':', '.');
 }
 
+// ATTENTION: Keep in sync with the ECMAScript function of the same name in .js files
+std::string refs_file_name(llvm::StringRef ref, RefsLayout layout)
+{
+    std::string name = ref.str();
+    replace_invalid_filename_chars(name);
+    if (layout == FlatRefsLayout)
+        return name;
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    char prefix[7];
+    snprintf(prefix, sizeof(prefix), "%02x/%02x/", hash >> 24, (hash >> 16) & 0xff);
+    return prefix + name;
+}
+
+namespace {
+struct CanonicalPaths
+{
+    std::shared_mutex mutex;
+    llvm::StringMap<std::string> paths;
+
+    static CanonicalPaths &instance()
+    {
+        static CanonicalPaths cache;
+        return cache;
+    }
+};
+}
+
 std::error_code canonicalize(const llvm::Twine &path, llvm::SmallVectorImpl<char> &result)
 {
-    std::string p = path.str();
-    llvm::sys::fs::real_path(path, result);
+    llvm::SmallString<256> storage;
+    llvm::StringRef p = path.toStringRef(storage);
+    // The relative paths depend on the working directory
+    bool cacheable = llvm::sys::path::is_absolute(p);
+    auto &cache = CanonicalPaths::instance();
+    if (cacheable) {
+        std::shared_lock<std::shared_mutex> lock(cache.mutex);
+        auto it = cache.paths.find(p);
+        if (it != cache.paths.end()) {
+            result.assign(it->second.begin(), it->second.end());
+            return {};
+        }
+    }
+
+    std::error_code error = llvm::sys::fs::real_path(p, result);
 
 #ifdef _WIN32
     // Make sure we use forward slashes to make sure folder detection works as expected everywhere
     make_forward_slashes(result.data());
 #endif
 
+    // The files that do not exist yet might be created later
+    if (cacheable && !error) {
+        std::unique_lock<std::shared_mutex> lock(cache.mutex);
+        cache.paths.try_emplace(p, std::string(result.begin(), result.end()));
+    }
     return {};
 }
 
+void forgetCanonicalPaths()
+{
+    auto &cache = CanonicalPaths::instance();
+    std::unique_lock<std::shared_mutex> lock(cache.mutex);
+    cache.paths.clear();
+}
+
 std::error_code create_directories(const llvm::Twine &path)
 {
     using namespace llvm::sys::fs;
@@ -71,6 +133,27 @@ std::error_code create_directories(const llvm::Twine &path)
     return llvm::sys::fs::create_directories(path, true, defaultPerms);
 }
 
+std::error_code append_to_file(const std::string &path, llvm::StringRef data)
+{
+    using namespace llvm::sys::fs;
+    int fd;
+    std::error_code error_code = openFileForWrite(path, fd, CD_OpenAlways, OF_Append);
+    if (error_code == std::errc::no_such_file_or_directory) {
+        ::create_directories(llvm::sys::path::parent_path(path));
+        error_code = openFileForWrite(path, fd, CD_OpenAlways, OF_Append);
+    }
+    if (error_code)
+        return error_code;
+    llvm::raw_fd_ostream out(fd, /*shouldClose=*/true, /*unbuffered=*/true);
+    out << data;
+    out.close();
+    if (out.has_error()) {
+        error_code = out.error();
+        out.clear_error();
+    }
+    return error_code;
+}
+
 /**
  * https://svn.boost.org/trac/boost/ticket/1976#comment:2
  *
@@ -31,14 +31,33 @@ namespace llvm {
 class Twine;
 }
 
-/* Is declared in llvm::sys::fs,  but not implemented */
+/* Is declared in llvm::sys::fs,  but not implemented.
+ * The results for absolute paths are kept for the whole process, and shared by all the threads:
+ * the same headers are resolved again by each translation unit */
 std::error_code canonicalize(const llvm::Twine &path, llvm::SmallVectorImpl<char> &result);
 
+/* Forget the canonical paths resolved so far, in case the symbolic links changed */
+void forgetCanonicalPaths();
+
 /* The one in llvm::sys::fs do not create the directory with the right peromissions */
 std::error_code create_directories(const llvm::Twine &path);
 
+/* Append data to the file with a single write, creating the file and its directory if needed */
+std::error_code append_to_file(const std::string &path, llvm::StringRef data);
+
 std::string naive_uncomplete(llvm::StringRef base, llvm::StringRef path);
 
 void make_forward_slashes(char *str);
 void make_forward_slashes(std::string &str);
 void replace_invalid_filename_chars(std::string &str);
+
+/* The layouts of the refs directory. The output directory records the layout it uses in
+ * refs/.layout, which does not exist for the flat layout.
+ * With the packed layout, the refs files are written in the hashed layout, and then moved to the
+ * packed refs by codebrowser_refspack, see refspack/refspack.h. */
+enum RefsLayout { FlatRefsLayout = 1, HashedRefsLayout = 2, PackedRefsLayout = 3 };
+
+/* The path, relative to refs/, of the file of the references of 'ref'.
+ * With the hashed and packed layouts, the files are spread over 65536 directories named after the
+ * FNV-1a hash of the file name: "ab/cd/<name>", so that no directory holds millions of entries. */
+std::string refs_file_name(llvm::StringRef ref, RefsLayout layout);
@@ -0,0 +1,164 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "forkpool.h"
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+
+ForkPool::ForkPool(unsigned jobs)
+    : jobs(std::max(1u, jobs))
+{
+}
+
+ForkPool::~ForkPool()
+{
+    wait();
+}
+
+void ForkPool::run(llvm::function_ref<bool(size_t *)> fn,
+                   std::function<void(const Status &)> done)
+{
+    while (running.size() >= jobs && reap()) { }
+
+    // Otherwise, the buffered output would be written by the child too
+    std::cout.flush();
+    llvm::outs().flush();
+
+    int memoryPipe[2];
+    if (pipe(memoryPipe) != 0)
+        memoryPipe[0] = memoryPipe[1] = -1;
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The read ends are only for the parent: the ones of the other children would otherwise
+        // stay open in this child until it exits
+        if (memoryPipe[0] >= 0)
+            close(memoryPipe[0]);
+        for (const auto &it : running) {
+            if (it.second.memoryPipe >= 0)
+                close(it.second.memoryPipe);
+        }
+        size_t memory = 0;
+        bool success = fn(&memory);
+        // A few bytes, which fit in the pipe without waiting for the parent
+        if (memoryPipe[1] >= 0 && write(memoryPipe[1], &memory, sizeof(memory)) < 0)
+            success = false;
+        std::cout.flush();
+        std::cerr.flush();
+        llvm::outs().flush();
+        // Skip the destructors and the atexit handlers, they belong to the parent
+        _exit(success ? 0 : 1);
+    }
+    if (memoryPipe[1] >= 0)
+        close(memoryPipe[1]);
+    if (pid < 0) {
+        std::cerr << "Error: fork failed, processing in the main process" << std::endl;
+        if (memoryPipe[0] >= 0)
+            close(memoryPipe[0]);
+        Status status;
+        status.success = fn(&status.memory);
+        status.seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        done(status);
+        return;
+    }
+    running[pid] = { start, std::move(done), memoryPipe[0] };
+    pids.push_back(pid);
+}
+
+void ForkPool::wait()
+{
+    while (reap()) { }
+}
+
+bool ForkPool::reap()
+{
+    if (running.empty())
+        return false;
+
+    int result;
+    pid_t pid;
+    do {
+        pid = waitpid(-1, &result, 0);
+    } while (pid < 0 && errno == EINTR);
+    if (pid < 0) {
+        // No child left, should not happen
+        std::cerr << "Error: lost the generator processes" << std::endl;
+        running.clear();
+        return false;
+    }
+    auto it = running.find(pid);
+    if (it == running.end())
+        return true; // not one of ours
+    Child child = std::move(it->second);
+    running.erase(it);
+
+    Status status;
+    status.success = WIFEXITED(result) && WEXITSTATUS(result) == 0;
+    status.signal = WIFSIGNALED(result) ? WTERMSIG(result) : 0;
+    status.seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - child.start).count();
+    if (child.memoryPipe >= 0) {
+        // Nothing to read if the child crashed
+        size_t memory;
+        if (read(child.memoryPipe, &memory, sizeof(memory)) == sizeof(memory))
+            status.memory = memory;
+        close(child.memoryPipe);
+    }
+    child.done(status);
+    return true;
+}
+
+#else
+
+ForkPool::ForkPool(unsigned jobs)
+    : jobs(jobs)
+{
+}
+
+ForkPool::~ForkPool() = default;
+
+void ForkPool::run(llvm::function_ref<bool(size_t *)> fn,
+                   std::function<void(const Status &)> done)
+{
+    auto start = std::chrono::steady_clock::now();
+    Status status;
+    status.success = fn(&status.memory);
+    status.seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    done(status);
+}
+
+void ForkPool::wait() { }
+
+bool ForkPool::reap()
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,77 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/STLExtras.h>
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <vector>
+
+/* Runs functions in child processes forked from this one, at most 'jobs' at the same time.
+ *
+ * The children start with a copy-on-write copy of everything this process already loaded (the
+ * compilation database, the projects, the builtin includes), so they start for free, and a crash
+ * only kills one of them. This process must not have other threads running while forking.
+ * Not available on Windows.
+ */
+class ForkPool
+{
+public:
+    struct Status
+    {
+        bool success = false; // the function returned true
+        int signal = 0; // the signal that killed the child, if any
+        double seconds = 0; // wall time
+        size_t memory = 0; // as reported by the function
+    };
+
+    explicit ForkPool(unsigned jobs);
+    ~ForkPool();
+
+    // Waits until fewer than 'jobs' children are running, and runs 'fn' in a new child. 'fn' may
+    // report the memory it used in its argument.
+    // 'done' is called in this process once the child exited, from a later call to run() or
+    // wait(). If the fork fails, 'fn' runs in this process.
+    void run(llvm::function_ref<bool(size_t *)> fn, std::function<void(const Status &)> done);
+
+    // Waits until all the children exited
+    void wait();
+
+    // All the children started so far
+    const std::vector<int> &children() const { return pids; }
+
+private:
+    struct Child
+    {
+        std::chrono::steady_clock::time_point start;
+        std::function<void(const Status &)> done;
+        int memoryPipe; // where the child writes the memory it used, or -1
+    };
+
+    // Waits for one child to exit and calls its 'done'. Returns false if there is none left
+    bool reap();
+
+    unsigned jobs;
+    std::map<int, Child> running;
+    std::vector<int> pids;
+};
@@ -20,77 +20,81 @@
  ****************************************************************************/
 
 #include "generator.h"
+#include "charscanner.h"
 #include "stringbuilder.h"
 #include "filesystem.h"
+#include "precompress.h"
+#include "projectmanager.h"
 
 #include "../global.h"
 
+#include <algorithm>
 #include <deque>
 #include <iostream>
 
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Process.h>
 #include <llvm/ADT/StringExtras.h>
 #include <clang/Basic/Version.h>
 
-template<int N>
-static void bufferAppend(llvm::SmallVectorImpl<char> &buffer, const char (&val)[N]) {
-    buffer.append(val, val + N - 1);
+namespace {
+// The HTML entities of the characters that need to be escaped in attributes
+struct AttrEntities
+{
+    llvm::StringRef entity[256];
+    AttrEntities()
+    {
+        entity['<'] = "&lt;";
+        entity['>'] = "&gt;";
+        entity['&'] = "&amp;";
+        entity['\"'] = "&quot;";
+        entity['\''] = "&apos;";
+    }
+};
+}
+
+// Call append with the clean runs of s, and the entities in between
+template<typename Append>
+static void escapeAttrImpl(llvm::StringRef s, Append append)
+{
+    static const CharScanner specialChars("<>&\"'");
+    static const AttrEntities entities;
+    const char *c = s.begin();
+    const char *end = s.end();
+    while (true) {
+        const char *special = specialChars.find(c, end);
+        if (special != c)
+            append(llvm::StringRef(c, special - c));
+        if (special == end)
+            return;
+        append(entities.entity[static_cast<unsigned char>(*special)]);
+        c = special + 1;
+    }
 }
 
 llvm::StringRef Generator::escapeAttr(llvm::StringRef s, llvm::SmallVectorImpl< char >& buffer)
 {
     buffer.clear();
-    unsigned len = s.size();
-    for (unsigned i = 0 ; i < len; ++i) {
-        char c = s[i];
-        switch (c) {
-            default: buffer.push_back(c); break;
-            case '<': bufferAppend(buffer, "&lt;"); break;
-            case '>': bufferAppend(buffer, "&gt;"); break;
-            case '&': bufferAppend(buffer, "&amp;"); break;
-            case '\"': bufferAppend(buffer, "&quot;"); break;
-            case '\'': bufferAppend(buffer, "&apos;"); break;
-        }
-    }
+    buffer.reserve(s.size());
+    escapeAttrImpl(s, [&](llvm::StringRef part) { buffer.append(part.begin(), part.end()); });
     return llvm::StringRef(buffer.begin(), buffer.size());
 }
 
 void Generator::escapeAttr(llvm::raw_ostream &os, llvm::StringRef s)
 {
-    unsigned len = s.size();
-    for (unsigned i = 0 ; i < len; ++i) {
-        char c = s[i];
-        switch (c) {
-            default:
-                os << c; break;
-
-            case '<': os << "&lt;"; break;
-            case '>': os << "&gt;"; break;
-            case '&': os << "&amp;"; break;
-            case '\"': os << "&quot;"; break;
-            case '\'': os << "&apos;"; break;
-        }
-    }
-
+    escapeAttrImpl(s, [&](llvm::StringRef part) { os << part; });
 }
 
 // ATTENTION: Keep in sync with `replace_invalid_filename_chars` functions in filesystem.cpp and in .js files
 llvm::StringRef Generator::escapeAttrForFilename(llvm::StringRef s, llvm::SmallVectorImpl< char >& buffer)
 {
-    buffer.clear();
-    unsigned len = s.size();
-    for (unsigned i = 0 ; i < len; ++i) {
-        char c = s[i];
-        switch (c) {
-            default: buffer.push_back(c); break;
-            case ':': bufferAppend(buffer, "."); break;
-        }
-    }
+    buffer.assign(s.begin(), s.end());
+    std::replace(buffer.begin(), buffer.end(), ':', '.');
     return llvm::StringRef(buffer.begin(), buffer.size());
 }
 
-void Generator::Tag::open(llvm::raw_ostream &myfile) const
+void Generator::Tag::open(llvm::raw_ostream &myfile, llvm::StringRef name) const
 {
     myfile << "<" << name;
     if (!attributes.empty())
@@ -110,12 +114,63 @@ void Generator::Tag::open(llvm::raw_ostream &myfile) const
     }
 }
 
-void Generator::Tag::close(llvm::raw_ostream &myfile) const
+void Generator::Tag::close(llvm::raw_ostream &myfile, llvm::StringRef name) const
 {
     myfile << "</" << name << ">";
 }
 
-void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, const std::string &filename,
+std::vector<Generator::Tag> Generator::mergeTags()
+{
+    // The stable sort keeps the tags at the same position and with the same length in the order
+    // they were added, which is also the order of their sequence numbers.
+    for (auto &stream : streams) {
+        if (!stream.sorted)
+            std::stable_sort(stream.tags.begin(), stream.tags.end());
+    }
+
+    // k-way merge of the streams, where k is small. Tags with the same position and length are
+    // kept in the order they were added, whatever their producer.
+    std::vector<Tag> tags;
+    tags.reserve(tagCount);
+    std::vector<Tag>::const_iterator heads[NumProducers];
+    for (int i = 0; i < NumProducers; ++i)
+        heads[i] = streams[i].tags.cbegin();
+    while (true) {
+        int best = -1;
+        for (int i = 0; i < NumProducers; ++i) {
+            if (heads[i] == streams[i].tags.cend())
+                continue;
+            if (best < 0 || *heads[i] < *heads[best]
+                || (!(*heads[best] < *heads[i]) && heads[i]->seq < heads[best]->seq))
+                best = i;
+        }
+        if (best < 0)
+            break;
+        const Tag &t = *heads[best]++;
+
+        // Remove the duplicates (happens in macros for example). They can only be among the
+        // tags with the same position and length, which are few.
+        bool duplicate = false;
+        for (auto it = tags.rbegin(); it != tags.rend() && it->pos == t.pos && it->len == t.len;
+             ++it) {
+            if (it->name == t.name && it->attributes == t.attributes) {
+                duplicate = true;
+                break;
+            }
+        }
+        if (!duplicate)
+            tags.push_back(t);
+    }
+
+    for (auto &stream : streams) {
+        stream.tags.clear();
+        stream.tags.shrink_to_fit();
+    }
+    return tags;
+}
+
+void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, RefsLayout refsLayout,
+                         Precompressor *precompressor, const std::string &filename,
                          const char* begin, const char* end, llvm::StringRef footer, llvm::StringRef warningMessage,
                          const std::set<std::string> &interestingDefinitions)
 {
@@ -123,11 +178,18 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
     // Make sure the parent directory exist:
     create_directories(llvm::StringRef(real_filename).rsplit('/').first);
 
+    // The page is written next to the claim marker and only renamed once complete, so an
+    // interrupted generation does not leave a truncated page which would never be generated again.
+    // The marker stays once the page is complete, see ProjectManager::claim
+    std::string claim_marker = ProjectManager::claimMarker(real_filename);
     std::error_code error_code;
-    llvm::raw_fd_ostream myfile(real_filename, error_code, llvm::sys::fs::OF_None);
+    std::string tmp_filename =
+        real_filename % ".tmp" % std::to_string(llvm::sys::Process::getProcessId());
+    PrecompressedOStream myfile(real_filename, error_code, precompressor, tmp_filename);
     if (error_code) {
         std::cerr << "Error generating " << real_filename << " ";
         std::cerr << error_code.message() << std::endl;
+        llvm::sys::fs::remove(claim_marker);
         return;
     }
 
@@ -153,6 +215,8 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
     myfile << "<script type=\"text/javascript\" src=\"" << dataPath << "/jquery/jquery.min.js\"></script>\n";
     myfile << "<script type=\"text/javascript\" src=\"" << dataPath << "/jquery/jquery-ui.min.js\"></script>\n";
     myfile << "<script>var file = '"<< filename  <<"'; var root_path = '"<< root_path <<"'; var data_path = '"<< dataPath <<"'; var ecma_script_api_version = 2;";
+    if (refsLayout != FlatRefsLayout)
+        myfile << "var refs_layout = " << int(refsLayout) << ";";
     if (!projects.empty()) {
         myfile << "var projects = {";
         bool first = true;
@@ -164,6 +228,8 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
         myfile << "};";
     }
     myfile << "</script>\n";
+    if (refsLayout == PackedRefsLayout)
+        myfile << "<script src='" << dataPath << "/refspack.js'></script>\n";
     myfile << "<script src='" << dataPath << "/codebrowser.js'></script>\n";
 
     myfile << "</head>\n<body><div id='header'><h1 id='breadcrumb'><span>Browse the source code of </span>";
@@ -199,6 +265,8 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
     myfile << "<table class=\"code\">\n";
 
 
+    const std::vector<Tag> tags = mergeTags();
+
     const char *c = begin;
     unsigned int line = 1;
     const char *bufferStart = c;
@@ -226,7 +294,7 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
             while (!stack.empty() && c >= next_end) {
                 const Tag *top = stack.back();
                 stack.pop_back();
-                top->close(myfile);
+                top->close(myfile, tagNames[top->name]);
                 next_end = end;
                 if (!stack.empty()) {
                     top = stack.back();
@@ -238,7 +306,7 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
             assert(c < end);
             while (c == next_start && tags_it != tags.cend()) {
                 assert(c == begin + tags_it->pos);
-                tags_it->open(myfile);
+                tags_it->open(myfile, tagNames[tags_it->name]);
                 if (tags_it->len) {
                     stack.push_back(&(*tags_it));
                     next_end =  c + tags_it->len;
@@ -252,17 +320,27 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
             //next = std::min(end, next);
         }
 
+        // Skip to the next character that needs escaping, or to the next tag boundary
+        if (c < next) {
+            static const CharScanner specialChars("\n&<>");
+            const char *special = specialChars.find(c, next);
+            if (special != c) {
+                c = special;
+                continue;
+            }
+        }
+
         switch (*c) {
             case '\n':
                 flush();
                 ++bufferStart; //skip the new line
                 ++line;
                 for (auto it = stack.crbegin(); it != stack.crend(); ++it)
-                    (*it)->close(myfile);
+                    (*it)->close(myfile, tagNames[(*it)->name]);
                 myfile << "</td></tr>\n"
                           "<tr><th id=\"" << line << "\">"<< line << "</th><td>";
                 for (auto it = stack.cbegin(); it != stack.cend(); ++it)
-                     (*it)->open(myfile);
+                     (*it)->open(myfile, tagNames[(*it)->name]);
                 break;
             case '&': flush(); ++bufferStart; myfile << "&amp;"; break;
             case '<': flush(); ++bufferStart; myfile << "&lt;"; break;
@@ -289,4 +367,5 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
 
     myfile << "<br />Powered by <a href='https://woboq.com'><img alt='Woboq' src='https://code.woboq.org/woboq-16.png' width='41' height='16' /></a> <a href='https://code.woboq.org'>Code Browser</a> "
               CODEBROWSER_VERSION "\n<br/>Generator usage only permitted with license.</p>\n</div></body></html>\n";
+    myfile.close();
 }
@@ -22,68 +22,108 @@
 #pragma once
 
 #include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/StringSaver.h>
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
+
+#include "filesystem.h"
 
 namespace llvm {
 class raw_ostream;
 }
+class Precompressor;
 
 
 /* This class generate the HTML out of a file with the said tags.
  */
 class Generator
 {
+public:
+    // The code that adds the tags. Each one adds them (almost) in order of position.
+    enum Producer {
+        AST, // Annotator, from the AST visitor
+        Preprocessor,
+        Lexer, // Annotator::syntaxHighlight, and the comment blocks
+        Comments, // inside the comments
+        NumProducers
+    };
 
+private:
     struct Tag
     {
-        std::string name;
-        std::string attributes;
         int pos;
         int len;
-        std::string innerHtml;
+        unsigned name; // index in tagNames
+        unsigned seq; // order in which the tags were added
+        llvm::StringRef attributes; // saved in the arena
+        llvm::StringRef innerHtml; // saved in the arena
+        // This is the order of the opening tag. Order first by position, then by length
+        //  (in the reverse order) with the exception of length of 0 which always goes first.
         bool operator<(const Tag &other) const
         {
-            // This is the order of the opening tag. Order first by position, then by length
-            //  (in the reverse order) with the exception of length of 0 which always goes first.
-            //  Ordered first by position, and then by lenth (reverse order)
-            return (pos != other.pos) ? pos < other.pos
-                                      : len == 0 || (other.len != 0 && len > other.len);
+            if (pos != other.pos)
+                return pos < other.pos;
+            if ((len == 0) != (other.len == 0))
+                return len == 0;
+            return len > other.len;
         }
-        bool operator==(const Tag &other) const
-        {
-            return std::tie(pos, len, name, attributes)
-                == std::tie(other.pos, other.len, other.name, other.attributes);
-        }
-        void open(llvm::raw_ostream &myfile) const;
-        void close(llvm::raw_ostream &myfile) const;
+        void open(llvm::raw_ostream &myfile, llvm::StringRef name) const;
+        void close(llvm::raw_ostream &myfile, llvm::StringRef name) const;
     };
 
-    std::multiset<Tag> tags;
+    // The tags of each producer, in the order they were added. Those that are not sorted get
+    // sorted in generate(), and then all the streams are merged.
+    struct TagStream
+    {
+        std::vector<Tag> tags;
+        bool sorted = true;
+    };
+    TagStream streams[NumProducers];
+    unsigned tagCount = 0;
+    std::vector<llvm::StringRef> tagNames;
+    llvm::BumpPtrAllocator arena;
+    llvm::UniqueStringSaver strings { arena }; // tag names and attributes, which repeat a lot
+    llvm::StringSaver innerHtmlStrings { arena };
 
     std::map<std::string, std::string> projects;
 
+    unsigned internTagName(llvm::StringRef name)
+    {
+        for (unsigned i = 0; i < tagNames.size(); ++i) {
+            if (tagNames[i] == name)
+                return i;
+        }
+        tagNames.push_back(strings.save(name));
+        return tagNames.size() - 1;
+    }
+
+    std::vector<Tag> mergeTags();
+
 public:
-    void addTag(std::string name, std::string attributes, int pos, int len,
-                std::string innerHtml = {})
+    void addTag(llvm::StringRef name, const std::string &attributes, int pos, int len,
+                const std::string &innerHtml = {}, Producer producer = AST)
     {
         if (len < 0) {
             return;
         }
-        Tag t = { std::move(name), std::move(attributes), pos, len, std::move(innerHtml) };
-        auto it = tags.find(t);
-        if (it != tags.end() && *it == t)
-            return; // Hapens in macro for example
-        tags.insert(std::move(t));
+        Tag t = { pos, len, internTagName(name), tagCount++, strings.save(attributes),
+                  innerHtml.empty() ? llvm::StringRef() : innerHtmlStrings.save(innerHtml) };
+        TagStream &stream = streams[producer];
+        if (stream.sorted && !stream.tags.empty() && t < stream.tags.back())
+            stream.sorted = false;
+        stream.tags.push_back(t);
     }
     void addProject(std::string a, std::string b)
     {
         projects.insert({ std::move(a), std::move(b) });
     }
 
-    void generate(llvm::StringRef outputPrefix, std::string dataPath, const std::string &filename,
-                  const char *begin, const char *end, llvm::StringRef footer,
+    // 'precompressor' may be null
+    void generate(llvm::StringRef outputPrefix, std::string dataPath, RefsLayout refsLayout,
+                  Precompressor *precompressor, const std::string &filename, const char *begin, const char *end, llvm::StringRef footer,
                   llvm::StringRef warningMessage,
                   const std::set<std::string> &interestingDefitions);
 
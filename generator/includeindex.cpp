@@ -0,0 +1,324 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "includeindex.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "filesystem.h"
+#include "stringbuilder.h"
+
+namespace {
+
+const char IndexMagic[8] = { 'C', 'B', 'I', 'N', 'C', '0', '0', '1' };
+
+/* What a worker found in one directory: either the listing of the previous index, if the
+ * directory did not change, or a new listing */
+struct Listing
+{
+    std::string path;
+    int64_t mtime = 0;
+    int previous = -1; // index in the previous directories
+    std::vector<std::string> files;
+    std::vector<std::string> subdirectories;
+};
+
+/* The directories left to list, shared by the workers */
+class DirectoryQueue
+{
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::string> queue;
+    size_t pending = 0; // queued, or being listed
+    std::set<llvm::sys::fs::UniqueID> visited; // the symbolic links may form loops
+
+public:
+    void push(std::string path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(path));
+        ++pending;
+        condition.notify_one();
+    }
+
+    // Returns false once all the directories were listed
+    bool pop(std::string &path)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&] { return !queue.empty() || pending == 0; });
+        if (queue.empty())
+            return false;
+        path = std::move(queue.front());
+        queue.pop_front();
+        return true;
+    }
+
+    void done()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+            condition.notify_all();
+    }
+
+    // false if the directory was already seen through another path
+    bool visit(llvm::sys::fs::UniqueID id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return visited.insert(id).second;
+    }
+};
+
+int64_t nanoseconds(llvm::sys::TimePoint<> time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+}
+
+void IncludeIndex::build(llvm::ArrayRef<std::string> roots, unsigned jobs,
+                         llvm::StringRef cacheFile)
+{
+    std::vector<Directory> previous;
+    llvm::StringMap<int> previousIndex;
+    if (load(cacheFile)) {
+        previous = std::move(directories);
+        for (size_t i = 0; i < previous.size(); ++i)
+            previousIndex[previous[i].path] = i;
+    }
+    directories.clear();
+    directoriesOfFile.clear();
+
+    DirectoryQueue queue;
+    for (const auto &root : roots) {
+        llvm::StringRef path(root);
+        // The source paths of the projects end with a '/'
+        if (path.size() > 1 && path.ends_with("/"))
+            path = path.drop_back();
+        queue.push(path.str());
+    }
+
+    auto work = [&](std::vector<Listing> &listings) {
+        std::string path;
+        while (queue.pop(path)) {
+            llvm::sys::fs::file_status status;
+            if (llvm::sys::fs::status(path, status) || !llvm::sys::fs::is_directory(status)
+                || !queue.visit(status.getUniqueID())) {
+                queue.done();
+                continue;
+            }
+            Listing listing;
+            listing.path = path;
+            listing.mtime = nanoseconds(status.getLastModificationTime());
+            auto it = previousIndex.find(path);
+            if (it != previousIndex.end() && previous[it->second].mtime == listing.mtime) {
+                listing.previous = it->second;
+                for (llvm::StringRef subdirectory : previous[it->second].subdirectories)
+                    queue.push(path % "/" % subdirectory);
+            } else {
+                std::error_code EC;
+                for (llvm::sys::fs::directory_iterator entry(path, EC), end; entry != end && !EC;
+                     entry.increment(EC)) {
+                    std::string name = llvm::sys::path::filename(entry->path()).str();
+                    if (llvm::StringRef(name).starts_with("."))
+                        continue;
+                    auto type = entry->type();
+                    if (type == llvm::sys::fs::file_type::symlink_file
+                        || type == llvm::sys::fs::file_type::type_unknown) {
+                        // Follow the link
+                        llvm::sys::fs::file_status target;
+                        if (llvm::sys::fs::status(entry->path(), target))
+                            continue;
+                        type = target.type();
+                    }
+                    if (type == llvm::sys::fs::file_type::directory_file) {
+                        queue.push(entry->path());
+                        listing.subdirectories.push_back(std::move(name));
+                    } else {
+                        listing.files.push_back(std::move(name));
+                    }
+                }
+            }
+            listings.push_back(std::move(listing));
+            queue.done();
+        }
+    };
+
+    jobs = std::max(1u, jobs);
+    std::vector<std::vector<Listing>> listingsPerWorker(jobs);
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < jobs; ++i)
+        threads.emplace_back(work, std::ref(listingsPerWorker[i]));
+    work(listingsPerWorker[0]);
+    for (auto &t : threads)
+        t.join();
+
+    bool changed = false;
+    for (auto &listings : listingsPerWorker) {
+        for (auto &listing : listings) {
+            if (listing.previous >= 0) {
+                // The strings of the previous index are interned in the same allocator
+                directories.push_back(std::move(previous[listing.previous]));
+                continue;
+            }
+            changed = true;
+            Directory directory;
+            directory.path = strings.save(listing.path);
+            directory.mtime = listing.mtime;
+            for (const auto &name : listing.files)
+                directory.files.push_back(strings.save(name));
+            for (const auto &name : listing.subdirectories)
+                directory.subdirectories.push_back(strings.save(name));
+            directories.push_back(std::move(directory));
+        }
+    }
+    // Some directories were removed
+    if (directories.size() != previous.size())
+        changed = true;
+
+    for (size_t i = 0; i < directories.size(); ++i) {
+        for (llvm::StringRef name : directories[i].files)
+            directoriesOfFile[name].push_back(i);
+    }
+
+    if (changed && !cacheFile.empty())
+        save(cacheFile);
+}
+
+std::vector<std::string> IncludeIndex::filesNamed(llvm::StringRef name) const
+{
+    std::vector<std::string> result;
+    auto it = directoriesOfFile.find(name);
+    if (it == directoriesOfFile.end())
+        return result;
+    for (uint32_t directory : it->second)
+        result.push_back(directories[directory].path % "/" % name);
+    return result;
+}
+
+/* The index file is a list of directories:
+ *   uint32_t pathSize; char path[pathSize]; int64_t mtime;
+ *   uint32_t fileCount; { uint32_t size; char name[size]; } files[fileCount];
+ *   uint32_t subdirectoryCount; { uint32_t size; char name[size]; } subdirectories[...];
+ * after the magic and the uint32_t number of directories. */
+bool IncludeIndex::load(llvm::StringRef cacheFile)
+{
+    if (cacheFile.empty())
+        return false;
+    auto buffer = llvm::MemoryBuffer::getFile(cacheFile, /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if (!buffer)
+        return false;
+    llvm::StringRef data = buffer.get()->getBuffer();
+
+    bool ok = true;
+    auto readInteger = [&](auto &value) {
+        if (data.size() < sizeof(value)) {
+            ok = false;
+            return;
+        }
+        std::memcpy(&value, data.data(), sizeof(value));
+        data = data.drop_front(sizeof(value));
+    };
+    auto readString = [&]() -> llvm::StringRef {
+        uint32_t size = 0;
+        readInteger(size);
+        if (!ok || data.size() < size) {
+            ok = false;
+            return {};
+        }
+        llvm::StringRef s = data.take_front(size);
+        data = data.drop_front(size);
+        return strings.save(s);
+    };
+
+    if (!data.starts_with(llvm::StringRef(IndexMagic, sizeof(IndexMagic))))
+        return false;
+    data = data.drop_front(sizeof(IndexMagic));
+    uint32_t directoryCount = 0;
+    readInteger(directoryCount);
+    for (uint32_t i = 0; ok && i < directoryCount; ++i) {
+        Directory directory;
+        directory.path = readString();
+        readInteger(directory.mtime);
+        uint32_t count = 0;
+        readInteger(count);
+        for (uint32_t j = 0; ok && j < count; ++j)
+            directory.files.push_back(readString());
+        count = 0;
+        readInteger(count);
+        for (uint32_t j = 0; ok && j < count; ++j)
+            directory.subdirectories.push_back(readString());
+        directories.push_back(std::move(directory));
+    }
+    if (!ok)
+        directories.clear();
+    return ok;
+}
+
+void IncludeIndex::save(llvm::StringRef cacheFile) const
+{
+    create_directories(llvm::sys::path::parent_path(cacheFile));
+    // Several generators may write it at the same time: each one writes its own temporary file
+    std::string tmpFile =
+        cacheFile % ".tmp" % std::to_string(llvm::sys::Process::getProcessId());
+    {
+        std::error_code error_code;
+        llvm::raw_fd_ostream out(tmpFile, error_code, llvm::sys::fs::OF_None);
+        if (error_code)
+            return;
+        auto writeInteger = [&](auto value) {
+            out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+        };
+        auto writeString = [&](llvm::StringRef s) {
+            writeInteger(uint32_t(s.size()));
+            out << s;
+        };
+        out.write(IndexMagic, sizeof(IndexMagic));
+        writeInteger(uint32_t(directories.size()));
+        for (const Directory &directory : directories) {
+            writeString(directory.path);
+            writeInteger(directory.mtime);
+            writeInteger(uint32_t(directory.files.size()));
+            for (llvm::StringRef name : directory.files)
+                writeString(name);
+            writeInteger(uint32_t(directory.subdirectories.size()));
+            for (llvm::StringRef name : directory.subdirectories)
+                writeString(name);
+        }
+        if (out.has_error()) {
+            out.clear_error();
+            llvm::sys::fs::remove(tmpFile);
+            return;
+        }
+    }
+    // The rename is atomic: the last writer wins
+    if (llvm::sys::fs::rename(tmpFile, cacheFile))
+        llvm::sys::fs::remove(tmpFile);
+}
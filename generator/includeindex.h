@@ -0,0 +1,64 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/StringSaver.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* The files of the projects by their name, for ProjectManager::includeRecovery.
+ *
+ * The directories are listed in parallel. The index is saved in a file, so that the next
+ * processes and runs only list again the directories whose modification time changed: adding,
+ * removing or renaming an entry changes the modification time of its directory.
+ * The names and paths are interned, a file costs little more than its name.
+ */
+class IncludeIndex
+{
+public:
+    // Index the files under 'roots' on 'jobs' threads, reusing and updating 'cacheFile'
+    void build(llvm::ArrayRef<std::string> roots, unsigned jobs, llvm::StringRef cacheFile);
+
+    // The paths of all the files with this name
+    std::vector<std::string> filesNamed(llvm::StringRef name) const;
+
+private:
+    struct Directory
+    {
+        llvm::StringRef path;
+        int64_t mtime = 0; // nanoseconds since the epoch
+        std::vector<llvm::StringRef> files;
+        std::vector<llvm::StringRef> subdirectories;
+    };
+
+    bool load(llvm::StringRef cacheFile);
+    void save(llvm::StringRef cacheFile) const;
+
+    llvm::BumpPtrAllocator allocator;
+    llvm::UniqueStringSaver strings { allocator };
+    std::vector<Directory> directories;
+    llvm::StringMap<std::vector<uint32_t>> directoriesOfFile; // name -> indexes in directories
+};
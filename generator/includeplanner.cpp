@@ -0,0 +1,194 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "includeplanner.h"
+
+#include <clang/Basic/Version.h>
+#include <clang/Tooling/DependencyScanning/DependencyScanningService.h>
+#include <clang/Tooling/DependencyScanning/DependencyScanningTool.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/VirtualFileSystem.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <cstdint>
+#include <thread>
+
+#include "filesystem.h"
+#include "projectmanager.h"
+#include "stringbuilder.h"
+
+// The files of dependencies in the make format: "target: file1 file2 \<newline> file3"
+static std::vector<std::string> parseMakeDependencies(llvm::StringRef deps)
+{
+    std::vector<std::string> files;
+    size_t colon = deps.find(": ");
+    if (colon == llvm::StringRef::npos)
+        return files;
+    deps = deps.substr(colon + 2);
+
+    std::string current;
+    for (size_t i = 0; i < deps.size(); ++i) {
+        char c = deps[i];
+        char next = i + 1 < deps.size() ? deps[i + 1] : '\0';
+        if (c == '\\' && (next == ' ' || next == '#')) {
+            current += next;
+            ++i;
+            continue;
+        }
+        if (c == '$' && next == '$') {
+            current += '$';
+            ++i;
+            continue;
+        }
+        if (c == '\\' && (next == '\n' || next == '\r'))
+            c = ' '; // line continuation
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            if (!current.empty())
+                files.push_back(std::move(current));
+            current.clear();
+            continue;
+        }
+        current += c;
+    }
+    if (!current.empty())
+        files.push_back(std::move(current));
+    return files;
+}
+
+void IncludePlanner::plan(
+    llvm::ArrayRef<Unit> units, unsigned jobs,
+    llvm::function_ref<llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>()> createFS)
+{
+    using namespace clang::tooling::dependencies;
+#if CLANG_VERSION_MAJOR >= 15
+    DependencyScanningService service(ScanningMode::DependencyDirectivesScan,
+                                      ScanningOutputFormat::Make);
+#else
+    DependencyScanningService service(ScanningMode::MinimizedSourcePreprocessing,
+                                      ScanningOutputFormat::Make);
+#endif
+
+    std::vector<std::vector<std::string>> dependencies(units.size());
+    std::atomic<size_t> next { 0 };
+    std::atomic<int> failed { 0 };
+    auto work = [&](llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS) {
+        // The tool is not thread safe, the service is
+#if CLANG_VERSION_MAJOR >= 15
+        DependencyScanningTool tool(service, FS);
+#else
+        // Before clang 15, each tool uses its own real file system
+        (void)FS;
+        DependencyScanningTool tool(service);
+#endif
+        for (size_t i = next++; i < units.size(); i = next++) {
+            // The dependencies in the make format
+            auto deps = tool.getDependencyFile(units[i].command, units[i].directory);
+            if (!deps) {
+                std::cerr << std::string("Planning: could not scan " % units[i].file % ": "
+                                         % llvm::toString(deps.takeError()) % "\n");
+                ++failed;
+                continue;
+            }
+            dependencies[i] = parseMakeDependencies(*deps);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < std::min<size_t>(jobs, units.size()); ++i)
+        threads.emplace_back(work, createFS());
+    work(createFS());
+    for (auto &t : threads)
+        t.join();
+
+    // Everything else is quick enough to be done on one thread
+    struct FileInfo
+    {
+        std::string canonical;
+        uint64_t size = 0;
+        ProjectInfo *project = nullptr; // only if it is generated
+    };
+    llvm::StringMap<FileInfo> files;
+    auto fileInfo = [&](llvm::StringRef file) -> const FileInfo & {
+        auto inserted = files.insert({ file, FileInfo() });
+        FileInfo &info = inserted.first->second;
+        if (inserted.second) {
+            llvm::SmallString<256> canonical;
+            canonicalize(file, canonical);
+            info.canonical = canonical.empty() ? file.str() : std::string(canonical.str());
+            llvm::sys::fs::file_size(info.canonical, info.size);
+            info.project = projectManager.projectForFile(info.canonical);
+            if (info.project && info.project->type == ProjectInfo::External)
+                info.project = nullptr;
+        }
+        return info;
+    };
+
+    // What each unit parses, in bytes
+    std::vector<double> parseCosts(units.size());
+    for (size_t i = 0; i < units.size(); ++i) {
+        for (const auto &dep : dependencies[i])
+            parseCosts[i] += fileInfo(dep).size;
+    }
+
+    // The cheapest unit, or the first in case of equality, owns the header
+    struct Owner
+    {
+        size_t unit;
+        uint64_t size; // of the header
+    };
+    llvm::StringMap<Owner> owners;
+    headerIncluders.clear();
+    for (size_t i = 0; i < units.size(); ++i) {
+        for (const auto &dep : dependencies[i]) {
+            const FileInfo &info = fileInfo(dep);
+            included.insert(info.canonical);
+            if (!info.project || info.canonical == units[i].file)
+                continue;
+            headerIncluders[info.canonical].push_back(i);
+            auto inserted = owners.insert({ info.canonical, Owner { i, info.size } });
+            Owner &current = inserted.first->second;
+            if (parseCosts[i] < parseCosts[current.unit])
+                current.unit = i;
+        }
+    }
+
+    for (auto &it : headerIncluders) {
+        std::stable_sort(it.second.begin(), it.second.end(),
+                         [&](size_t a, size_t b) { return parseCosts[a] < parseCosts[b]; });
+    }
+
+    headerOwners.clear();
+    unitCosts.clear();
+    for (size_t i = 0; i < units.size(); ++i)
+        unitCosts[units[i].file] = parseCosts[i];
+    for (const auto &it : owners) {
+        const Unit &unit = units[it.second.unit];
+        headerOwners[it.first()] = unit.file;
+        // Generating the html of a header costs about as much as parsing it
+        unitCosts[unit.file] += it.second.size;
+    }
+
+    std::cerr << "Planning: " << headerOwners.size() << " headers assigned to "
+              << units.size() - failed << " translation units";
+    if (failed)
+        std::cerr << ", " << failed << " translation units could not be scanned";
+    std::cerr << std::endl;
+}
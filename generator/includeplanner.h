@@ -0,0 +1,98 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+namespace vfs {
+class FileSystem;
+}
+}
+
+struct ProjectManager;
+
+/* Decides which translation unit generates the html of each file of the projects.
+ *
+ * Otherwise, a header is generated by the first translation unit that reaches it, which can be the
+ * most expensive one. Here, the includes of all the translation units are scanned up front with
+ * clang's dependency scanner, which only runs a minimized preprocessor, and each header is given
+ * to the cheapest translation unit that includes it.
+ */
+class IncludePlanner
+{
+public:
+    struct Unit
+    {
+        std::string file; // canonical
+        std::vector<std::string> command; // ready for a ToolInvocation
+        std::string directory;
+    };
+
+    explicit IncludePlanner(ProjectManager &projectManager)
+        : projectManager(projectManager)
+    {
+    }
+
+    // Scan the includes of all the units on 'jobs' threads, and choose the owner of each header.
+    // The scanner changes the working directory of its file system: 'createFS' is called once per
+    // thread.
+    void plan(llvm::ArrayRef<Unit> units, unsigned jobs,
+              llvm::function_ref<llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>()> createFS);
+
+    // header -> the translation unit which should generate it (both canonical)
+    const llvm::StringMap<std::string> &owners() const
+    {
+        return headerOwners;
+    }
+
+    // header -> the indexes in 'units' of the units which include it, the cheapest first
+    const llvm::StringMap<std::vector<size_t>> &includers() const
+    {
+        return headerIncluders;
+    }
+
+    // Estimation of the cost of each unit, in bytes: what it parses, plus the headers it owns
+    const llvm::StringMap<double> &costs() const
+    {
+        return unitCosts;
+    }
+
+    // true if the file (canonical) is included by any of the units
+    bool isIncluded(llvm::StringRef file) const
+    {
+        return included.count(file);
+    }
+
+private:
+    ProjectManager &projectManager;
+    llvm::StringMap<std::string> headerOwners;
+    llvm::StringMap<std::vector<size_t>> headerIncluders;
+    llvm::StringMap<double> unitCosts;
+    llvm::StringSet<> included;
+};
@@ -21,15 +21,21 @@
 
 
 #include "clang/AST/ASTContext.h"
-#include "clang/Tooling/JSONCompilationDatabase.h"
 #include "clang/Tooling/Tooling.h"
 #include "llvm/Support/CommandLine.h"
 
+#include <clang/Basic/Stack.h>
 #include <clang/Frontend/CompilerInstance.h>
+#include <llvm/ADT/STLExtras.h>
 #include <llvm/ADT/StringSwitch.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/thread.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <fstream>
@@ -37,20 +43,31 @@
 #include <initializer_list>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <system_error>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "annotator.h"
 #include "browserastvisitor.h"
 #include "compat.h"
+#include "commandindex.h"
+#include "compiledatabase.h"
+#include "embeddedfilesystem.h"
 #include "filesystem.h"
+#include "forkpool.h"
+#include "includeplanner.h"
+#include "manifest.h"
+#include "preamblecache.h"
 #include "preprocessorcallback.h"
 #include "projectmanager.h"
+#include "refslog.h"
+#include "scheduler.h"
 #include "stringbuilder.h"
-#include "embedded_includes.h"
+#include "workerfilemanager.h"
 #include "generator.h"
 
 namespace cl = llvm::cl;
@@ -94,6 +111,83 @@ cl::opt<bool>
                       cl::desc("Process all files from the compile_commands.json. If this argument "
                                "is passed, the list of sources does not need to be passed"));
 
+cl::opt<unsigned>
+    Jobs("j", cl::value_desc("jobs"),
+         cl::desc("Number of translation units processed in parallel by this process. "
+                  "0 means one per hardware thread. Defaults to 1"),
+         cl::init(1));
+
+cl::opt<bool>
+    UseRefsLog("refs-log",
+               cl::desc("Batch the records of the refs and fnSearch files in log files, and "
+                        "dispatch them to their files at the end of the run"));
+
+cl::opt<bool> HashedRefs("refs-fanout",
+                         cl::desc("Spread the refs files over hashed subdirectories of refs/, "
+                                  "refs/ab/cd/<symbol>, instead of one flat directory"));
+
+cl::opt<bool> PackRefs("refs-pack",
+                       cl::desc("Write the refs files in the -refs-fanout layout, to be packed "
+                                "by codebrowser_refspack at the end of the run"));
+
+cl::opt<bool>
+    Precompress("precompress",
+                cl::desc("Also write a gzip compressed copy, <file>.gz, of the html files, of the "
+                         "refs and fnSearch files, and of the fileIndex, for the web servers "
+                         "which can send them as they are. Needs a generator built with zlib"));
+
+cl::opt<bool> PrecompressOnly(
+    "precompress-only",
+    cl::desc("Like -precompress, but leave the html files empty: the web server must always send "
+             "the .gz files. The refs files are kept, the next runs append to them"));
+
+cl::opt<bool> Serve("serve",
+                    cl::desc("After processing the sources, if any, read lists of files to "
+                             "generate again from stdin, one file per line, each list ended by an "
+                             "empty line. The compilation database stays loaded between the lists, "
+                             "and the stats of each list are written on stdout"));
+
+cl::opt<bool> Incremental(
+    "incremental",
+    cl::desc("Only process the files of the compilation database whose command, content, or "
+             "included files changed since the previous incremental run. The hashes are kept in "
+             "a .manifest file in the output directory"));
+
+cl::opt<bool> PlanHeaders(
+    "plan-headers",
+    cl::desc("Scan the includes of all the translation units before processing them, so that each "
+             "header is generated by the cheapest translation unit that includes it"));
+
+cl::opt<bool> UsePCH("pch",
+                     cl::desc("Build a precompiled header for each group of translation units "
+                              "with the same command which start with the same includes, and use "
+                              "it once the headers it contains are generated"));
+
+cl::opt<bool> CompileDBCache(
+    "compdb-cache",
+    cl::desc("Keep a binary copy of the compilation database in the output directory, which the "
+             "next runs load instead of parsing the compile_commands.json again, as long as it "
+             "did not change"));
+
+cl::opt<bool> Fork(
+    "fork",
+    cl::desc("Once everything is loaded, process each translation unit in a child process forked "
+             "from this one, with up to -j of them at the same time, so that a crash only loses "
+             "one translation unit. Implies -refs-log. Not supported with -incremental"));
+
+cl::opt<unsigned> FileManagerBudget(
+    "file-manager-budget", cl::value_desc("MB"),
+    cl::desc("Start each worker again with an empty file manager (the file cache of the compiler) "
+             "once its entries use about this much memory. The results of the stat calls are "
+             "kept. 0 means no limit"),
+    cl::init(0));
+
+cl::opt<unsigned> FileManagerUnits(
+    "file-manager-units", cl::value_desc("count"),
+    cl::desc("Start each worker again with an empty file manager after this number of "
+             "translation units. 0 means no limit"),
+    cl::init(0));
+
 cl::extrahelp extra(
 
     R"(
@@ -166,20 +260,32 @@ struct BrowserDiagnosticClient : clang::DiagnosticConsumer
     }
 };
 
+/* Filled while processing a translation unit */
+struct ProcessingInfo
+{
+    size_t memoryAtAST = 0; // malloc usage once the whole AST is loaded
+    std::vector<std::string> includedFiles;
+    std::string input; // as marked processed by the BrowserAction
+    bool parsed = false; // the translation unit was parsed, and the files generated
+};
+
 class BrowserASTConsumer : public clang::ASTConsumer
 {
     clang::CompilerInstance &ci;
     Annotator annotator;
     DatabaseType WasInDatabase;
+    ProcessingInfo *info;
 
 public:
     BrowserASTConsumer(clang::CompilerInstance &ci, ProjectManager &projectManager,
-                       DatabaseType WasInDatabase)
+                       DatabaseType WasInDatabase, std::string mainFile, ProcessingInfo *info)
         : clang::ASTConsumer()
         , ci(ci)
         , annotator(projectManager)
         , WasInDatabase(WasInDatabase)
+        , info(info)
     {
+        annotator.setMainFileName(std::move(mainFile));
     }
     virtual ~BrowserASTConsumer()
     {
@@ -191,7 +297,8 @@ public:
         annotator.setSourceMgr(Ctx.getSourceManager(), Ctx.getLangOpts());
         annotator.setMangleContext(Ctx.createMangleContext());
         ci.getPreprocessor().addPPCallbacks(maybe_unique(new PreprocessorCallback(
-            annotator, ci.getPreprocessor(), WasInDatabase == DatabaseType::ProcessFullDirectory)));
+            annotator, ci.getPreprocessor(), WasInDatabase == DatabaseType::ProcessFullDirectory,
+            info ? &info->includedFiles : nullptr)));
         ci.getDiagnostics().setClient(new BrowserDiagnosticClient(annotator), true);
         ci.getDiagnostics().setErrorLimit(0);
     }
@@ -209,6 +316,11 @@ public:
 
     virtual void HandleTranslationUnit(clang::ASTContext &Ctx) override
     {
+        // The whole AST is loaded: that's about the peak of the memory used by this file
+        if (info) {
+            info->memoryAtAST = llvm::sys::Process::GetMallocUsage();
+            info->parsed = true;
+        }
 
         /* if (PP.getDiagnostics().hasErrorOccurred())
              return;*/
@@ -234,26 +346,39 @@ public:
 class BrowserAction : public clang::ASTFrontendAction
 {
     static std::set<std::string> processed;
+    static std::mutex processedMutex;
     DatabaseType WasInDatabase;
+    ProcessingInfo *info;
 
 protected:
     virtual std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(clang::CompilerInstance &CI,
                                                                   llvm::StringRef InFile) override
     {
-        if (processed.count(InFile.str())) {
+        bool inserted;
+        {
+            std::lock_guard<std::mutex> lock(processedMutex);
+            inserted = processed.insert(InFile.str()).second;
+        }
+        if (!inserted) {
             std::cerr << "Skipping already processed " << InFile.str() << std::endl;
             return nullptr;
         }
-        processed.insert(InFile.str());
+        if (info)
+            info->input = InFile.str();
 
         CI.getFrontendOpts().SkipFunctionBodies = true;
 
-        return maybe_unique(new BrowserASTConsumer(CI, *projectManager, WasInDatabase));
+        llvm::SmallString<256> mainFile;
+        canonicalize(InFile, mainFile);
+        return maybe_unique(new BrowserASTConsumer(CI, *projectManager, WasInDatabase,
+                                                   std::string(mainFile.str()), info));
     }
 
 public:
-    BrowserAction(DatabaseType WasInDatabase = DatabaseType::InDatabase)
+    BrowserAction(DatabaseType WasInDatabase = DatabaseType::InDatabase,
+                  ProcessingInfo *info = nullptr)
         : WasInDatabase(WasInDatabase)
+        , info(info)
     {
     }
     virtual bool hasCodeCompletionSupport() const override
@@ -261,14 +386,30 @@ public:
         return true;
     }
     static ProjectManager *projectManager;
+
+    // Allows the files to be processed again by a later run
+    static void reset()
+    {
+        std::lock_guard<std::mutex> lock(processedMutex);
+        processed.clear();
+    }
+
+    // Allows a file which could not be parsed to be tried again
+    static void forget(const std::string &input)
+    {
+        std::lock_guard<std::mutex> lock(processedMutex);
+        processed.erase(input);
+    }
 };
 
 
 std::set<std::string> BrowserAction::processed;
+std::mutex BrowserAction::processedMutex;
 ProjectManager *BrowserAction::projectManager = nullptr;
 
-static bool proceedCommand(std::vector<std::string> command, llvm::StringRef Directory,
-                           llvm::StringRef file, clang::FileManager *FM, DatabaseType WasInDatabase)
+/* The command of the compilation database, changed to be run by a ToolInvocation */
+static std::vector<std::string> adjustCommand(std::vector<std::string> command,
+                                              llvm::StringRef Directory, llvm::StringRef file)
 {
     // This code change all the paths to be absolute paths
     //  FIXME:  it is a bit fragile.
@@ -323,9 +464,46 @@ static bool proceedCommand(std::vector<std::string> command, llvm::StringRef Dir
 
     command.push_back("-Qunused-arguments");
     command.push_back("-Wno-unknown-warning-option");
-    clang::tooling::ToolInvocation Inv(command, maybe_unique(new BrowserAction(WasInDatabase)), FM);
+    return command;
+}
+
+/* 'memory', if not null, receives an estimation of the memory used to process this file.
+ * 'includedFiles', if not null, receives all the files included by this file.
+ * 'pch', if not empty, is loaded instead of parsing the includes it contains.
+ * 'input', if not null, receives the name under which the BrowserAction marked it processed */
+static bool proceedCommand(std::vector<std::string> command, llvm::StringRef Directory,
+                           llvm::StringRef file, clang::FileManager *FM, DatabaseType WasInDatabase,
+                           size_t *memory = nullptr,
+                           std::vector<std::string> *includedFiles = nullptr,
+                           llvm::StringRef pch = {}, std::string *input = nullptr)
+{
+    std::vector<std::string> adjusted = adjustCommand(command, Directory, file);
+    if (!pch.empty()) {
+        adjusted.push_back("-include-pch");
+        adjusted.push_back(pch.str());
+    }
+    size_t memoryBefore = llvm::sys::Process::GetMallocUsage();
+    ProcessingInfo info;
+    clang::tooling::ToolInvocation Inv(adjusted,
+                                       maybe_unique(new BrowserAction(WasInDatabase, &info)), FM);
 
     bool result = Inv.run();
+    if (!result && !pch.empty() && !info.parsed) {
+        // The PCH was rejected, so nothing was generated yet
+        std::cerr << "Parsing " << file.str() << " again without its PCH" << std::endl;
+        if (!info.input.empty())
+            BrowserAction::forget(info.input);
+        return proceedCommand(std::move(command), Directory, file, FM, WasInDatabase, memory,
+                              includedFiles, {}, input);
+    }
+    if (memory) {
+        // With several workers, this also counts what the others allocated meanwhile
+        *memory = info.memoryAtAST > memoryBefore ? info.memoryAtAST - memoryBefore : 0;
+    }
+    if (includedFiles)
+        *includedFiles = std::move(info.includedFiles);
+    if (input)
+        *input = std::move(info.input);
     if (!result) {
         std::cerr << "Error: The file was not recognized as source code: " << file.str()
                   << std::endl;
@@ -333,6 +511,680 @@ static bool proceedCommand(std::vector<std::string> command, llvm::StringRef Dir
     return result;
 }
 
+/* Calls fn(index, worker) for every index in the queue, spread over 'workers' threads.
+ * 'worker' identifies the thread running the call, so it can be used to pick per-thread state */
+static void forEachParallel(WorkQueue &queue, unsigned workers,
+                            llvm::function_ref<void(size_t, unsigned)> fn)
+{
+    size_t i;
+    if (workers <= 1) {
+        while (queue.pop(0, i))
+            fn(i, 0);
+        return;
+    }
+
+    std::vector<llvm::thread> threads;
+    for (unsigned worker = 0; worker < workers; ++worker) {
+        // Parsing needs the same big stack as the main thread
+        threads.emplace_back(clang::DesiredStackSize, [&queue, fn, worker] {
+            size_t i;
+            while (queue.pop(worker, i))
+                fn(i, worker);
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+}
+
+/* What is loaded once, and shared by all the runs of the --serve mode */
+struct GeneratorContext
+{
+    clang::tooling::CompilationDatabase *Compilations;
+    ProjectManager &projectManager;
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS;
+    bool IsProcessingAllDirectory;
+};
+
+struct RunStats
+{
+    int processed = 0;
+    int failed = 0; // the ones that could only be generated without highlighting count as failed
+    int skipped = 0;
+    bool ok = true;
+};
+
+/* The file system seen by the compiler: 'base' with the builtins includes on top */
+static llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+createVFS(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base)
+{
+    llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> VFS(
+        new llvm::vfs::OverlayFileSystem(base));
+    // Map the builtins includes, straight from the data embedded in the executable
+    VFS->pushOverlay(new EmbeddedFileSystem);
+    return VFS;
+}
+
+static bool isHeader(llvm::StringRef filename)
+{
+    return llvm::StringSwitch<bool>(llvm::sys::path::extension(filename))
+        .Cases(".h", ".H", ".hh", ".hpp", true)
+        .Default(false);
+}
+
+static bool isCxxSource(llvm::StringRef filename)
+{
+    return llvm::StringSwitch<bool>(llvm::sys::path::extension(filename))
+        .Cases(".cpp", ".cc", ".cxx", ".c++", ".C", ".cp", true)
+        .Default(false);
+}
+
+/* For the -incremental mode: find the translation units that must be processed again because
+ * their command or the content of the files they include changed, and the files whose content
+ * changed. Remove their html so they are generated again, and their records from the refs. */
+static void invalidateOutdated(Manifest &manifest, const GeneratorContext &ctx,
+                               llvm::ArrayRef<std::string> AbsoluteSources, unsigned jobs)
+{
+    ProjectManager &projectManager = ctx.projectManager;
+    manifest.checkChanges(jobs);
+
+    std::vector<std::string> changed = manifest.changedFiles();
+    std::set<std::string> outdated(changed.begin(), changed.end());
+    for (const auto &file : AbsoluteSources) {
+        auto compileCommandsForFile = ctx.Compilations->getCompileCommands(file);
+        llvm::SmallString<256> filename;
+        canonicalize(file, filename);
+        if (compileCommandsForFile.empty() || isHeader(filename))
+            continue;
+        const auto &command = compileCommandsForFile.front();
+        if (!manifest.isUpToDate(filename,
+                                 Manifest::commandHash(command.CommandLine, command.Directory)))
+            outdated.insert(std::string(filename.str()));
+    }
+
+    std::set<std::string> htmlNames;
+    for (const auto &file : outdated) {
+        manifest.forget(file);
+        ProjectInfo *project = projectManager.projectForFile(file);
+        if (!project || project->type == ProjectInfo::External)
+            continue;
+        projectManager.removeOutput(file, project);
+        htmlNames.insert(project->name % "/"
+                         % llvm::StringRef(file).substr(project->source_path.size()));
+    }
+    std::cerr << "Incremental: " << changed.size() << " changed files, " << htmlNames.size()
+              << " files to generate again" << std::endl;
+    // Only the refs files which have records of these files are read, once the manifest knows
+    // them. Otherwise, all of them are read to find out.
+    std::set<std::string> escapedNames;
+    llvm::SmallString<256> buffer;
+    for (const auto &name : htmlNames)
+        escapedNames.insert(Generator::escapeAttr(name, buffer).str());
+    std::set<std::string> refsFiles;
+    if (manifest.takeRefsFiles(escapedNames, refsFiles)) {
+        RefsLog::purge(projectManager.outputPrefix, htmlNames, jobs, &refsFiles);
+    } else {
+        llvm::StringMap<llvm::StringSet<>> remainingRecords;
+        if (RefsLog::purge(projectManager.outputPrefix, htmlNames, jobs, nullptr,
+                           &remainingRecords))
+            manifest.setRefs(std::move(remainingRecords));
+    }
+}
+
+/* The translation units of the first pass which still need to be processed. 'sourceOfUnit'
+ * receives their index in AbsoluteSources, and 'headers' the headers of the sources */
+static std::vector<IncludePlanner::Unit>
+unitsToProcess(const GeneratorContext &ctx, llvm::ArrayRef<std::string> AbsoluteSources,
+               std::vector<size_t> *sourceOfUnit = nullptr,
+               std::vector<std::string> *headers = nullptr)
+{
+    ProjectManager &projectManager = ctx.projectManager;
+    std::vector<IncludePlanner::Unit> units;
+    for (size_t i = 0; i < AbsoluteSources.size(); ++i) {
+        const std::string &file = AbsoluteSources[i];
+        llvm::SmallString<256> filename;
+        canonicalize(file, filename);
+        ProjectInfo *project = projectManager.projectForFile(filename);
+        if (!project || !projectManager.shouldProcess(filename, project))
+            continue;
+        if (isHeader(filename)) {
+            if (headers)
+                headers->push_back(std::string(filename.str()));
+            continue;
+        }
+        auto compileCommandsForFile = ctx.Compilations->getCompileCommands(file);
+        if (!compileCommandsForFile.empty()) {
+            const auto &command = compileCommandsForFile.front();
+            units.push_back({ std::string(filename.str()),
+                              adjustCommand(command.CommandLine, command.Directory, file),
+                              command.Directory });
+            if (sourceOfUnit)
+                sourceOfUnit->push_back(i);
+        }
+    }
+    return units;
+}
+
+/* For the -plan-headers mode: choose which translation unit generates each header, and give the
+ * estimated costs to the scheduler.
+ * Returns, for each header, the indexes in AbsoluteSources of the translation units which include
+ * it, the cheapest first */
+static llvm::StringMap<std::vector<size_t>> planHeaders(const GeneratorContext &ctx,
+                                                        llvm::ArrayRef<std::string> AbsoluteSources,
+                                                        Scheduler &scheduler, unsigned jobs)
+{
+    ProjectManager &projectManager = ctx.projectManager;
+    std::vector<size_t> sourceOfUnit;
+    std::vector<std::string> headers;
+    std::vector<IncludePlanner::Unit> units =
+        unitsToProcess(ctx, AbsoluteSources, &sourceOfUnit, &headers);
+
+    IncludePlanner planner(projectManager);
+    planner.plan(units, jobs,
+                 [] { return createVFS(llvm::vfs::createPhysicalFileSystem().release()); });
+    projectManager.setHeaderOwners(planner.owners());
+
+    // The scheduler knows the files by their absolute name
+    llvm::StringMap<double> estimates;
+    for (size_t u = 0; u < units.size(); ++u)
+        estimates[AbsoluteSources[sourceOfUnit[u]]] = planner.costs().lookup(units[u].file);
+    scheduler.setEstimates(std::move(estimates));
+
+    for (const auto &header : headers) {
+        if (!planner.isIncluded(header))
+            std::cerr << "Warning: " << header << " is not included by any translation unit"
+                      << std::endl;
+    }
+
+    llvm::StringMap<std::vector<size_t>> includers;
+    for (const auto &it : planner.includers()) {
+        std::vector<size_t> &sources = includers[it.first()];
+        for (size_t u : it.second)
+            sources.push_back(sourceOfUnit[u]);
+    }
+    return includers;
+}
+
+/* For the -fork mode: calls fn(index, worker) for every index in the queue from this thread,
+ * taking from the deque of each worker in turn. The parsing is left to the child processes */
+static void forEachInTurn(WorkQueue &queue, unsigned workers,
+                          llvm::function_ref<void(size_t, unsigned)> fn)
+{
+    size_t i;
+    for (unsigned worker = 0; queue.pop(worker, i); worker = (worker + 1) % workers)
+        fn(i, worker);
+}
+
+/* Generates the files for all the Sources. The files which are not in the compilation database
+ * are processed after the others, with the command of a file with a similar path */
+static RunStats processSources(const GeneratorContext &ctx, llvm::ArrayRef<std::string> Sources)
+{
+    auto Compilations = ctx.Compilations;
+    ProjectManager &projectManager = ctx.projectManager;
+    const auto &VFS = ctx.VFS;
+    bool IsProcessingAllDirectory = ctx.IsProcessingAllDirectory;
+
+    unsigned NumWorkers = Jobs ? Jobs.getValue() : std::thread::hardware_concurrency();
+    NumWorkers = std::max(1u, std::min<unsigned>(NumWorkers, Sources.size()));
+
+    // The FileManager is not thread safe: each worker gets its own, on top of the shared VFS.
+    // They share the results of their stat calls.
+    auto stats = std::make_shared<SharedStatResults>();
+    std::vector<std::unique_ptr<WorkerFileManager>> FileManagers;
+    for (unsigned i = 0; i < NumWorkers; ++i) {
+        FileManagers.push_back(std::make_unique<WorkerFileManager>(
+            VFS, stats, size_t(FileManagerBudget) * 1024 * 1024, FileManagerUnits));
+    }
+
+    std::atomic<int> Progress { 0 };
+    std::atomic<int> Processed { 0 };
+    std::atomic<int> Failed { 0 };
+    std::atomic<int> Skipped { 0 };
+
+    Scheduler scheduler(projectManager.outputPrefix);
+    auto processTimed = [&](llvm::StringRef file, llvm::function_ref<bool(size_t *)> process) {
+        auto start = std::chrono::steady_clock::now();
+        size_t memory = 0;
+        bool success = process(&memory);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (success)
+            scheduler.record(file, elapsed.count(), memory);
+        return success;
+    };
+
+    std::vector<std::string> AbsoluteSources;
+    for (const auto &it : Sources)
+        AbsoluteSources.push_back(clang::tooling::getAbsolutePath(it));
+
+    auto start = std::chrono::system_clock::now();
+    std::unique_ptr<Manifest> manifest;
+    if (Incremental && llvm::sys::Process::GetEnv("MULTIPROCESS_MODE")) {
+        std::cerr << "Warning: -incremental is ignored with MULTIPROCESS_MODE" << std::endl;
+    } else if (Incremental && Fork) {
+        std::cerr << "Warning: -incremental is ignored with -fork" << std::endl;
+    } else if (Incremental && PackRefs) {
+        // The records of the outdated files cannot be removed from the packed refs
+        std::cerr << "Warning: -incremental is ignored with -refs-pack" << std::endl;
+    } else if (Incremental) {
+        manifest = std::make_unique<Manifest>(projectManager.outputPrefix);
+        projectManager.manifest = manifest.get();
+        invalidateOutdated(*manifest, ctx, AbsoluteSources, NumWorkers);
+    }
+    llvm::StringMap<std::vector<size_t>> headerIncluders;
+    if (PlanHeaders)
+        headerIncluders = planHeaders(ctx, AbsoluteSources, scheduler, NumWorkers);
+    std::unique_ptr<PreambleCache> preambles;
+    if (UsePCH) {
+        preambles = std::make_unique<PreambleCache>(projectManager);
+        preambles->build(unitsToProcess(ctx, AbsoluteSources), NumWorkers, [] {
+            return createVFS(llvm::vfs::createPhysicalFileSystem().release());
+        });
+    }
+
+    // With -fork, this thread decides what to process, and the parsing happens in the children
+    std::unique_ptr<ForkPool> pool;
+    if (Fork) {
+        pool = std::make_unique<ForkPool>(NumWorkers);
+        // The pages generated by this process, like those of finishNotInDB, must then not start
+        // the compression threads
+        if (projectManager.precompressor)
+            projectManager.precompressor->compressInCallingThread();
+    }
+    auto forEach = pool ? forEachInTurn : forEachParallel;
+    auto reportCrash = [](llvm::StringRef file, const ForkPool::Status &status) {
+        if (status.signal) {
+            std::cerr << std::string("Error: " % file % ": terminated by signal "
+                                     % std::to_string(status.signal) % "\n");
+        }
+    };
+
+    // Indexed like Sources, so the order of the second pass does not depend on the scheduling
+    std::vector<std::string> Delayed(Sources.size());
+    // The translation units of the first pass which succeeded, indexed like Sources
+    std::vector<char> Succeeded(Sources.size());
+    // The names under which they were marked processed, to process some of them again. Empty with
+    // -fork, where only the children mark them.
+    std::vector<std::string> Inputs(Sources.size());
+
+    WorkQueue SourcesQueue = scheduler.plan(AbsoluteSources, NumWorkers);
+    forEach(SourcesQueue, NumWorkers, [&](size_t i, unsigned worker) {
+        const std::string &it = Sources[i];
+        const std::string &file = AbsoluteSources[i];
+        int progress = ++Progress;
+
+        if (it.empty() || it == "-")
+            return;
+
+        llvm::SmallString<256> filename;
+        canonicalize(file, filename);
+
+        if (auto project = projectManager.projectForFile(filename)) {
+            if (!projectManager.shouldProcess(filename, project)) {
+                std::cerr << std::string("Sources: Skipping already processed " % filename.str()
+                                         % "\n");
+                ++Skipped;
+                return;
+            }
+        } else {
+            std::cerr << std::string("Sources: Skipping file not included by any project "
+                                     % filename.str() % "\n");
+            ++Skipped;
+            return;
+        }
+
+        auto compileCommandsForFile = Compilations->getCompileCommands(file);
+        if (!compileCommandsForFile.empty() && !isHeader(filename)) {
+            std::cerr << std::string("[" % std::to_string(100 * progress / Sources.size())
+                                     % "%] Processing " % file % "\n");
+            const auto &command = compileCommandsForFile.front();
+            std::vector<std::string> includedFiles;
+            std::vector<std::string> pchFiles;
+            std::string pch =
+                preambles ? preambles->pchFor(filename, manifest ? &pchFiles : nullptr) : "";
+            DatabaseType type = IsProcessingAllDirectory ? DatabaseType::ProcessFullDirectory
+                                                         : DatabaseType::InDatabase;
+            if (pool) {
+                pool->run(
+                    [&](size_t *memory) {
+                        return proceedCommand(command.CommandLine, command.Directory, file,
+                                              FileManagers[worker]->next(), type, memory,
+                                              nullptr, pch);
+                    },
+                    [&, i, file, filename = std::string(filename.str())](
+                        const ForkPool::Status &status) {
+                        reportCrash(file, status);
+                        if (status.success)
+                            scheduler.record(file, status.seconds, status.memory);
+                        Succeeded[i] = status.success;
+                        ++(status.success ? Processed : Failed);
+                        projectManager.releaseHeaders(filename);
+                    });
+                return;
+            }
+            bool success = processTimed(file, [&](size_t *memory) {
+                return proceedCommand(command.CommandLine, command.Directory, file,
+                                      FileManagers[worker]->next(), type, memory,
+                                      manifest ? &includedFiles : nullptr, pch, &Inputs[i]);
+            });
+            // The includes of the PCH were not seen by the preprocessor callbacks
+            includedFiles.insert(includedFiles.end(), pchFiles.begin(), pchFiles.end());
+            Succeeded[i] = success;
+            ++(success ? Processed : Failed);
+            projectManager.releaseHeaders(filename);
+            if (success && manifest) {
+                manifest->record(filename,
+                                 Manifest::commandHash(command.CommandLine, command.Directory),
+                                 includedFiles);
+            }
+        } else {
+            std::cerr << std::string("Delayed " % file % "\n");
+            Progress--;
+            Delayed[i] = std::string(filename.str());
+        }
+    });
+
+    if (pool)
+        pool->wait();
+
+    // The headers which were not generated by their planned translation unit can now be generated
+    // by any file
+    if (PlanHeaders)
+        projectManager.setHeaderOwners({});
+
+    std::vector<std::string> NotInDB;
+    for (auto &it : Delayed) {
+        if (!it.empty())
+            NotInDB.push_back(std::move(it));
+    }
+
+    // A header whose planned translation unit failed was refused to the other translation units
+    // which include it. Process one of them again, or else the header on its own with the files
+    // that are not in the database.
+    std::set<size_t> Again;
+    for (const auto &it : headerIncluders) {
+        llvm::StringRef header = it.first();
+        if (!projectManager.shouldProcess(header, projectManager.projectForFile(header)))
+            continue;
+        auto includer = llvm::find_if(it.second, [&](size_t i) { return Succeeded[i]; });
+        if (includer != it.second.end())
+            Again.insert(*includer);
+        else
+            NotInDB.push_back(header.str());
+    }
+    std::vector<std::string> AgainSources;
+    for (size_t i : Again) {
+        AgainSources.push_back(AbsoluteSources[i]);
+        if (!Inputs[i].empty())
+            BrowserAction::forget(Inputs[i]);
+    }
+    WorkQueue AgainQueue = scheduler.plan(AgainSources, NumWorkers);
+    forEach(AgainQueue, NumWorkers, [&](size_t i, unsigned worker) {
+        const std::string &file = AgainSources[i];
+        auto compileCommandsForFile = Compilations->getCompileCommands(file);
+        if (compileCommandsForFile.empty())
+            return;
+        std::cerr << std::string("Processing " % file
+                                 % " again, for the headers of a translation unit which failed\n");
+        const auto &command = compileCommandsForFile.front();
+        DatabaseType type = IsProcessingAllDirectory ? DatabaseType::ProcessFullDirectory
+                                                     : DatabaseType::InDatabase;
+        auto process = [&](size_t *memory) {
+            return proceedCommand(command.CommandLine, command.Directory, file,
+                                  FileManagers[worker]->next(), type, memory);
+        };
+        if (pool) {
+            pool->run(process,
+                      [&, file](const ForkPool::Status &status) { reportCrash(file, status); });
+        } else {
+            process(nullptr);
+        }
+    });
+    if (pool)
+        pool->wait();
+
+    std::mutex OtherIndexMutex;
+
+    std::unique_ptr<CommandIndex> commandIndex;
+    if (!NotInDB.empty())
+        commandIndex = std::make_unique<CommandIndex>(*Compilations);
+
+    // Counts the result of a file of the second pass. The files that could not be parsed are
+    // generated without highlighting.
+    auto finishNotInDB = [&](const std::string &file, bool success) {
+        ++(success ? Processed : Failed);
+        if (success || IsProcessingAllDirectory)
+            return;
+        ProjectInfo *projectinfo = projectManager.projectForFile(file);
+        if (!projectinfo)
+            return;
+        if (!projectManager.claim(file, projectinfo))
+            return;
+
+        auto now = std::time(0);
+        auto tm = localtime(&now);
+        char buf[80];
+        std::strftime(buf, sizeof(buf), "%Y-%b-%d", tm);
+
+        std::string footer = "Generated on <em>" % std::string(buf) % "</em>" % " from project "
+            % projectinfo->name % "</a>";
+        if (!projectinfo->revision.empty())
+            footer %= " revision <em>" % projectinfo->revision % "</em>";
+
+        auto B = llvm::MemoryBuffer::getFile(file);
+        if (!B)
+            return;
+        std::unique_ptr<llvm::MemoryBuffer> Buf = std::move(B.get());
+
+        std::string fn = projectinfo->name % "/"
+            % llvm::StringRef(file).substr(projectinfo->source_path.size());
+
+        Generator g;
+        g.generate(projectManager.outputPrefix, projectManager.dataPath, projectManager.refsLayout,
+                   projectManager.precompressor.get(), fn, Buf->getBufferStart(),
+                   Buf->getBufferEnd(), footer,
+                   "Warning: This file is not a C or C++ file. It does not have highlighting.",
+                   std::set<std::string>());
+
+        std::lock_guard<std::mutex> lock(OtherIndexMutex);
+        std::ofstream fileIndex;
+        fileIndex.open(projectManager.outputPrefix + "/otherIndex", std::ios::app);
+        if (!fileIndex)
+            return;
+        fileIndex << fn << '\n';
+    };
+
+    WorkQueue NotInDBQueue = scheduler.plan(NotInDB, NumWorkers);
+    forEach(NotInDBQueue, NumWorkers, [&](size_t i, unsigned worker) {
+        const std::string &it = NotInDB[i];
+        std::string file = clang::tooling::getAbsolutePath(it);
+        int progress = ++Progress;
+
+        if (auto project = projectManager.projectForFile(file)) {
+            if (!projectManager.shouldProcess(file, project)) {
+                std::cerr << std::string("NotInDB: Skipping already processed " % file % "\n");
+                ++Skipped;
+                return;
+            }
+        } else {
+            std::cerr << std::string("NotInDB: Skipping file not included by any project " % file
+                                     % "\n");
+            ++Skipped;
+            return;
+        }
+
+        auto compileCommandsForFile = Compilations->getCompileCommands(file);
+        std::string fileForCommands = file;
+        if (compileCommandsForFile.empty() || !compileCommandsForFile.front().Heuristic.empty()) {
+            // Not in the database, or only guessed from the file name
+            std::string match = commandIndex->bestMatch(file);
+            if (!match.empty()) {
+                compileCommandsForFile = Compilations->getCompileCommands(match);
+                fileForCommands = match;
+            }
+        }
+
+        bool success = false;
+        if (!compileCommandsForFile.empty()) {
+            std::cerr << std::string("[" % std::to_string(100 * progress / Sources.size())
+                                     % "%] Processing " % file % "\n");
+            auto command = compileCommandsForFile.front().CommandLine;
+            if (fileForCommands != file) {
+                for (auto &arg : command) {
+                    if (arg == fileForCommands || arg == compileCommandsForFile.front().Filename)
+                        arg = it;
+                }
+                // Otherwise the driver parses a .h as C
+                if (isHeader(file) && isCxxSource(fileForCommands))
+                    command.insert(command.begin() + 1, "-xc++");
+            }
+            if (llvm::StringRef(file).ends_with(".qdoc")) {
+                command.insert(command.begin() + 1, "-xc++");
+                // include the header for this .qdoc file
+                command.push_back("-include");
+                command.push_back(llvm::StringRef(file).substr(0, file.size() - 5) % ".h");
+            }
+            DatabaseType type = IsProcessingAllDirectory ? DatabaseType::ProcessFullDirectory
+                                                         : DatabaseType::NotInDatabase;
+            if (pool) {
+                pool->run(
+                    [&](size_t *memory) {
+                        return proceedCommand(std::move(command),
+                                              compileCommandsForFile.front().Directory, file,
+                                              FileManagers[worker]->next(), type, memory);
+                    },
+                    [&, file](const ForkPool::Status &status) {
+                        reportCrash(file, status);
+                        if (status.success)
+                            scheduler.record(file, status.seconds, status.memory);
+                        finishNotInDB(file, status.success);
+                    });
+                return;
+            }
+            success = processTimed(file, [&](size_t *memory) {
+                return proceedCommand(std::move(command), compileCommandsForFile.front().Directory,
+                                      file, FileManagers[worker]->next(), type, memory);
+            });
+        } else {
+            std::cerr << std::string("Could not find commands for " % file % "\n");
+        }
+        finishNotInDB(file, success);
+    });
+    if (pool)
+        pool->wait();
+
+    scheduler.save();
+
+    if (!pool) {
+        // The children of -fork used their own copies
+        size_t peakRetained = 0;
+        unsigned rebuilds = 0;
+        for (const auto &FM : FileManagers) {
+            peakRetained = std::max(peakRetained, FM->peakRetainedMemory());
+            rebuilds += FM->rebuilds();
+        }
+        std::cerr << "File managers: " << rebuilds << " rebuilds, at most "
+                  << peakRetained / (1024 * 1024) << "MB retained by a worker (estimation)"
+                  << std::endl;
+    }
+
+    RunStats stats;
+    stats.processed = Processed;
+    stats.failed = Failed;
+    stats.skipped = Skipped;
+
+    llvm::ArrayRef<int> children;
+    if (pool)
+        children = pool->children();
+    if ((UseRefsLog || pool)
+        && !RefsLog::compact(projectManager.outputPrefix, NumWorkers, true, children))
+        stats.ok = false;
+
+    if (manifest) {
+        // The files that were not generated again still have their records in the refs, and
+        // the files processed again added them again. Allow some slack for the resolution of
+        // the modification times.
+        if (stats.processed + stats.failed > 0
+            && !RefsLog::removeDuplicates(projectManager.outputPrefix,
+                                          start - std::chrono::seconds(2), NumWorkers)) {
+            stats.ok = false;
+        }
+        // The translation units removed from the compilation database are forgotten
+        llvm::StringSet<> databaseFiles;
+        for (const auto &file : Compilations->getAllFiles()) {
+            llvm::SmallString<256> filename;
+            canonicalize(file, filename);
+            databaseFiles.insert(filename);
+        }
+        manifest->save(databaseFiles);
+    }
+
+    if (Precompressor *precompressor = projectManager.precompressor.get()) {
+        if (!precompressor->wait())
+            stats.ok = false;
+        // With MULTIPROCESS_MODE, the files are only complete once merged
+        if (!llvm::sys::Process::GetEnv("MULTIPROCESS_MODE")
+            && !RefsLog::precompress(projectManager.outputPrefix, projectManager.refsLayout,
+                                     start - std::chrono::seconds(2), NumWorkers)) {
+            stats.ok = false;
+        }
+    }
+    return stats;
+}
+
+/* Reads the requests of the --serve mode on stdin, until the end of the input. A request is a
+ * list of files, one per line, ended by an empty line. The html of these files is generated again,
+ * and a line with the stats of the request is written on stdout */
+static void serve(const GeneratorContext &ctx)
+{
+    std::vector<std::string> request;
+    std::string line;
+    while (true) {
+        bool eof = !std::getline(std::cin, line);
+        if (!eof && !line.empty()) {
+            request.push_back(line);
+            continue;
+        }
+        if (!request.empty()) {
+            auto start = std::chrono::steady_clock::now();
+            BrowserAction::reset();
+            ctx.projectManager.forgetClaims();
+            forgetCanonicalPaths();
+            std::set<std::string> htmlNames;
+            for (const auto &file : request) {
+                llvm::SmallString<256> filename;
+                canonicalize(clang::tooling::getAbsolutePath(file), filename);
+                ProjectInfo *project = ctx.projectManager.projectForFile(filename);
+                ctx.projectManager.removeOutput(filename, project);
+                if (project && project->type != ProjectInfo::External)
+                    htmlNames.insert(project->name % "/"
+                                     % filename.str().substr(project->source_path.size()));
+            }
+
+            // The records of these files are removed from the refs before they are generated
+            // again, and the fnSearch lines they add again are merged with the previous ones
+            unsigned jobs = Jobs ? Jobs.getValue() : std::thread::hardware_concurrency();
+            auto since = std::chrono::system_clock::now() - std::chrono::seconds(2);
+            bool purged = RefsLog::purge(ctx.projectManager.outputPrefix, htmlNames, jobs);
+
+            RunStats stats = processSources(ctx, request);
+            if (!purged
+                || (stats.processed + stats.failed > 0
+                    && !RefsLog::removeDuplicates(ctx.projectManager.outputPrefix, since, jobs)))
+                stats.ok = false;
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            char seconds[32];
+            snprintf(seconds, sizeof(seconds), "%.2f", elapsed.count());
+            std::cout << "processed=" << stats.processed << " failed=" << stats.failed
+                      << " skipped=" << stats.skipped << " time=" << seconds << "s memory="
+                      << llvm::sys::Process::GetMallocUsage() / (1024 * 1024) << "MB"
+                      << (stats.ok ? "" : " error") << std::endl;
+            request.clear();
+        }
+        if (eof)
+            break;
+    }
+}
+
 int main(int argc, const char **argv)
 {
     std::string ErrorMessage;
@@ -350,6 +1202,28 @@ int main(int argc, const char **argv)
 #endif
 
     ProjectManager projectManager(OutputPath, DataPath);
+    // The children of -fork cannot share a lock for the refs files
+    projectManager.useRefsLog = UseRefsLog || Fork;
+    RefsLayout refsLayout =
+        PackRefs ? PackedRefsLayout : HashedRefs ? HashedRefsLayout : FlatRefsLayout;
+    if (!projectManager.setRefsLayout(refsLayout)) {
+        std::cerr << "The refs in " << OutputPath.getValue()
+                  << " use another layout: pass the same -refs-fanout or -refs-pack option as "
+                     "the previous runs"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (Precompress || PrecompressOnly) {
+        if (!Precompressor::isAvailable()) {
+            std::cerr << "-precompress needs a generator built with zlib" << std::endl;
+            return EXIT_FAILURE;
+        }
+        // The compression is fast compared to the parsing
+        unsigned threads = Jobs ? Jobs.getValue() : std::thread::hardware_concurrency();
+        projectManager.precompressor = std::make_unique<Precompressor>(
+            PrecompressOnly ? Precompressor::CompressedOnly : Precompressor::AlsoCompressed,
+            threads / 4);
+    }
     for (std::string &s : ProjectPaths) {
         auto colonPos = s.find(':');
         if (colonPos >= s.size()) {
@@ -388,13 +1262,25 @@ int main(int argc, const char **argv)
 
 
     if (!Compilations && llvm::sys::fs::exists(BuildPath)) {
-        if (llvm::sys::fs::is_directory(BuildPath)) {
+        std::string CacheFile =
+            CompileDBCache ? std::string(OutputPath) % "/.compile_commands.cache" : "";
+        llvm::SmallString<256> JSONPath(BuildPath);
+        if (llvm::sys::fs::is_directory(BuildPath))
+            llvm::sys::path::append(JSONPath, "compile_commands.json");
+        if (!llvm::sys::fs::exists(JSONPath)) {
+            // Let the other plugins find a database in that directory
             Compilations = std::unique_ptr<clang::tooling::CompilationDatabase>(
                 clang::tooling::CompilationDatabase::loadFromDirectory(BuildPath, ErrorMessage));
-        } else {
-            Compilations = std::unique_ptr<clang::tooling::CompilationDatabase>(
-                clang::tooling::JSONCompilationDatabase::loadFromFile(
-                    BuildPath, ErrorMessage, clang::tooling::JSONCommandLineSyntax::AutoDetect));
+        } else if (auto DB = MappedCompilationDatabase::loadFromFile(JSONPath, CacheFile,
+                                                                     ErrorMessage)) {
+            if (JSONPath != BuildPath) {
+                // Like the database that CompilationDatabase::loadFromDirectory would have found
+                Compilations = clang::tooling::inferTargetAndDriverMode(
+                    clang::tooling::inferMissingCompileCommands(clang::tooling::expandResponseFiles(
+                        std::move(DB), llvm::vfs::getRealFileSystem())));
+            } else {
+                Compilations = std::move(DB);
+            }
         }
         if (!Compilations && !ErrorMessage.empty()) {
             std::cerr << ErrorMessage << std::endl;
@@ -450,7 +1336,7 @@ int main(int argc, const char **argv)
         }
     }
 
-    if (Sources.empty()) {
+    if (Sources.empty() && !Serve) {
         std::cerr << "No source files.  Please pass source files as argument, or use '-a'"
                   << std::endl;
         return EXIT_FAILURE;
@@ -461,155 +1347,12 @@ int main(int argc, const char **argv)
         return EXIT_FAILURE;
     }
 
-    llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> VFS(
-        new llvm::vfs::OverlayFileSystem(llvm::vfs::getRealFileSystem()));
-    clang::FileManager FM({ "." }, VFS);
-    FM.Retain();
-
-    // Map virtual files
-    {
-        auto InMemoryFS = llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem>(
-            new llvm::vfs::InMemoryFileSystem);
-        VFS->pushOverlay(InMemoryFS);
-        // Map the builtins includes
-        const EmbeddedFile *f = EmbeddedFiles;
-        while (f->filename) {
-            InMemoryFS->addFile(f->filename, 0, llvm::MemoryBuffer::getMemBufferCopy(f->content));
-            f++;
-        }
-    }
-
-    int Progress = 0;
-
-    std::vector<std::string> NotInDB;
-
-    for (const auto &it : Sources) {
-        std::string file = clang::tooling::getAbsolutePath(it);
-        Progress++;
-
-        if (it.empty() || it == "-")
-            continue;
-
-        llvm::SmallString<256> filename;
-        canonicalize(file, filename);
-
-        if (auto project = projectManager.projectForFile(filename)) {
-            if (!projectManager.shouldProcess(filename, project)) {
-                std::cerr << "Sources: Skipping already processed " << filename.c_str()
-                          << std::endl;
-                continue;
-            }
-        } else {
-            std::cerr << "Sources: Skipping file not included by any project " << filename.c_str()
-                      << std::endl;
-            continue;
-        }
-
-        bool isHeader = llvm::StringSwitch<bool>(llvm::sys::path::extension(filename))
-                            .Cases(".h", ".H", ".hh", ".hpp", true)
-                            .Default(false);
-
-        auto compileCommandsForFile = Compilations->getCompileCommands(file);
-        if (!compileCommandsForFile.empty() && !isHeader) {
-            std::cerr << '[' << (100 * Progress / Sources.size()) << "%] Processing " << file
-                      << "\n";
-            proceedCommand(compileCommandsForFile.front().CommandLine,
-                           compileCommandsForFile.front().Directory, file, &FM,
-                           IsProcessingAllDirectory ? DatabaseType::ProcessFullDirectory
-                                                    : DatabaseType::InDatabase);
-        } else {
-            // TODO: Try to find a command line for a file in the same path
-            std::cerr << "Delayed " << file << "\n";
-            Progress--;
-            NotInDB.push_back(std::string(filename.str()));
-            continue;
-        }
-    }
-
-    for (const auto &it : NotInDB) {
-        std::string file = clang::tooling::getAbsolutePath(it);
-        Progress++;
-
-        if (auto project = projectManager.projectForFile(file)) {
-            if (!projectManager.shouldProcess(file, project)) {
-                std::cerr << "NotInDB: Skipping already processed " << file.c_str() << std::endl;
-                continue;
-            }
-        } else {
-            std::cerr << "NotInDB: Skipping file not included by any project " << file.c_str()
-                      << std::endl;
-            continue;
-        }
-
-        llvm::StringRef similar;
-
-        auto compileCommandsForFile = Compilations->getCompileCommands(file);
-        std::string fileForCommands = file;
-        if (compileCommandsForFile.empty()) {
-            // Find the element with the bigger prefix
-            auto lower = std::lower_bound(AllFiles.cbegin(), AllFiles.cend(), file);
-            if (lower == AllFiles.cend())
-                lower = AllFiles.cbegin();
-            compileCommandsForFile = Compilations->getCompileCommands(*lower);
-            fileForCommands = *lower;
-        }
-
-        bool success = false;
-        if (!compileCommandsForFile.empty()) {
-            std::cerr << '[' << (100 * Progress / Sources.size()) << "%] Processing " << file
-                      << "\n";
-            auto command = compileCommandsForFile.front().CommandLine;
-            std::replace(command.begin(), command.end(), fileForCommands, it);
-            if (llvm::StringRef(file).ends_with(".qdoc")) {
-                command.insert(command.begin() + 1, "-xc++");
-                // include the header for this .qdoc file
-                command.push_back("-include");
-                command.push_back(llvm::StringRef(file).substr(0, file.size() - 5) % ".h");
-            }
-            success = proceedCommand(std::move(command), compileCommandsForFile.front().Directory,
-                                     file, &FM,
-                                     IsProcessingAllDirectory ? DatabaseType::ProcessFullDirectory
-                                                              : DatabaseType::NotInDatabase);
-        } else {
-            std::cerr << "Could not find commands for " << file << "\n";
-        }
-
-        if (!success && !IsProcessingAllDirectory) {
-            ProjectInfo *projectinfo = projectManager.projectForFile(file);
-            if (!projectinfo)
-                continue;
-            if (!projectManager.shouldProcess(file, projectinfo))
-                continue;
-
-            auto now = std::time(0);
-            auto tm = localtime(&now);
-            char buf[80];
-            std::strftime(buf, sizeof(buf), "%Y-%b-%d", tm);
-
-            std::string footer = "Generated on <em>" % std::string(buf) % "</em>" % " from project "
-                % projectinfo->name % "</a>";
-            if (!projectinfo->revision.empty())
-                footer %= " revision <em>" % projectinfo->revision % "</em>";
-
-            auto B = llvm::MemoryBuffer::getFile(file);
-            if (!B)
-                continue;
-            std::unique_ptr<llvm::MemoryBuffer> Buf = std::move(B.get());
-
-            std::string fn = projectinfo->name % "/"
-                % llvm::StringRef(file).substr(projectinfo->source_path.size());
-
-            Generator g;
-            g.generate(projectManager.outputPrefix, projectManager.dataPath, fn,
-                       Buf->getBufferStart(), Buf->getBufferEnd(), footer,
-                       "Warning: This file is not a C or C++ file. It does not have highlighting.",
-                       std::set<std::string>());
-
-            std::ofstream fileIndex;
-            fileIndex.open(projectManager.outputPrefix + "/otherIndex", std::ios::app);
-            if (!fileIndex)
-                continue;
-            fileIndex << fn << '\n';
-        }
-    }
+    auto VFS = createVFS(llvm::vfs::getRealFileSystem());
+    GeneratorContext ctx { Compilations.get(), projectManager, VFS, IsProcessingAllDirectory };
+    RunStats stats;
+    if (!Sources.empty())
+        stats = processSources(ctx, Sources);
+    if (Serve)
+        serve(ctx);
+    return stats.ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,318 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "manifest.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+#include "filesystem.h"
+#include "stringbuilder.h"
+
+/* The manifest file contains first a line per file: F <tab> hash <tab> path
+ * Then for each translation unit a line: T <tab> command hash <tab> path
+ * followed by a line with the indexes of its files: I <tab> index1 <space> index2 ...
+ * The hashes are hexadecimal, the indexes refer to the order of the F lines.
+ * Then a line per refs file: P <tab> path
+ * and for each html file a line with the refs files it has records in:
+ * R <tab> index1 <space> index2 ... <tab> html name, the indexes referring to the P lines.
+ * A manifest with refs ends with the line: E <tab> refs */
+
+Manifest::Manifest(llvm::StringRef outputPrefix)
+    : manifestFile(outputPrefix % "/.manifest")
+{
+    auto B = llvm::MemoryBuffer::getFile(manifestFile);
+    if (!B)
+        return;
+
+    std::vector<llvm::StringRef> files;
+    std::vector<llvm::StringRef> refsFiles;
+    bool corruptedRefs = false;
+    llvm::StringRef unitName;
+    TranslationUnit *unit = nullptr;
+    llvm::StringRef content = B.get()->getBuffer();
+    while (!content.empty()) {
+        auto split = content.split('\n');
+        content = split.second;
+        llvm::SmallVector<llvm::StringRef, 3> fields;
+        split.first.split(fields, '\t', 2);
+        uint64_t hash;
+        if (fields.size() == 3 && fields[0] == "F" && !fields[1].getAsInteger(16, hash)) {
+            auto it = recordedHashes.insert({ fields[2], hash }).first;
+            files.push_back(it->first());
+        } else if (fields.size() == 3 && fields[0] == "T" && !fields[1].getAsInteger(16, hash)) {
+            unitName = fields[2];
+            unit = &units[unitName];
+            unit->command = hash;
+        } else if (fields.size() == 2 && fields[0] == "I" && unit) {
+            llvm::SmallVector<llvm::StringRef, 64> indexes;
+            fields[1].split(indexes, ' ', -1, false);
+            for (auto index : indexes) {
+                size_t i;
+                if (index.getAsInteger(10, i) || i >= files.size()) {
+                    // Corrupted: do not trust that unit
+                    units.erase(units.find(unitName));
+                    break;
+                }
+                unit->files.push_back(files[i].str());
+            }
+            unit = nullptr;
+        } else if (fields.size() == 2 && fields[0] == "P") {
+            refsFiles.push_back(fields[1]);
+        } else if (fields.size() == 3 && fields[0] == "R") {
+            llvm::SmallVector<llvm::StringRef, 64> indexes;
+            fields[1].split(indexes, ' ', -1, false);
+            llvm::StringSet<> &refs = refsOfFiles[fields[2]];
+            for (auto index : indexes) {
+                size_t i;
+                if (index.getAsInteger(10, i) || i >= refsFiles.size()) {
+                    corruptedRefs = true;
+                    break;
+                }
+                refs.insert(refsFiles[i]);
+            }
+        } else if (fields.size() == 2 && fields[0] == "E" && fields[1] == "refs") {
+            hasRefs = true;
+        }
+    }
+    if (corruptedRefs)
+        hasRefs = false;
+    if (!hasRefs) // they are all found again by RefsLog::purge
+        refsOfFiles.clear();
+}
+
+uint64_t Manifest::commandHash(llvm::ArrayRef<std::string> command, llvm::StringRef directory)
+{
+    std::string all = directory.str();
+    for (const auto &arg : command)
+        all %= llvm::StringRef("\0", 1) % arg;
+    return llvm::xxHash64(all);
+}
+
+uint64_t Manifest::currentHash(llvm::StringRef file)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = currentHashes.find(file);
+        if (it != currentHashes.end())
+            return it->second;
+    }
+    uint64_t hash = 0; // files that can't be read
+    auto B = llvm::MemoryBuffer::getFile(file, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (B)
+        hash = llvm::xxHash64(B.get()->getBuffer());
+    std::lock_guard<std::mutex> lock(mutex);
+    currentHashes[file] = hash;
+    return hash;
+}
+
+void Manifest::checkChanges(unsigned jobs)
+{
+    std::vector<llvm::StringRef> files;
+    for (const auto &it : recordedHashes)
+        files.push_back(it.first());
+
+    std::atomic<size_t> next { 0 };
+    auto work = [&] {
+        for (size_t i = next++; i < files.size(); i = next++) {
+            if (currentHash(files[i]) != recordedHashes.lookup(files[i])) {
+                std::lock_guard<std::mutex> lock(mutex);
+                changed.insert(files[i]);
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min<size_t>(jobs, files.size()); ++i)
+        threads.emplace_back(work);
+    work();
+    for (auto &t : threads)
+        t.join();
+}
+
+std::vector<std::string> Manifest::changedFiles() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> result;
+    for (const auto &it : changed)
+        result.push_back(it.first().str());
+    return result;
+}
+
+bool Manifest::isUpToDate(llvm::StringRef file, uint64_t command) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = units.find(file);
+    if (it == units.end() || it->second.command != command)
+        return false;
+    for (const auto &f : it->second.files) {
+        if (changed.count(f))
+            return false;
+    }
+    return true;
+}
+
+void Manifest::forget(llvm::StringRef file)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = units.find(file);
+    if (it != units.end()) {
+        units.erase(it);
+        modified = true;
+    }
+}
+
+void Manifest::record(llvm::StringRef file, uint64_t command,
+                      llvm::ArrayRef<std::string> includedFiles)
+{
+    TranslationUnit unit;
+    unit.command = command;
+    std::vector<uint64_t> hashes;
+    auto add = [&](llvm::StringRef f) {
+        llvm::SmallString<256> canonical;
+        canonicalize(f, canonical);
+        if (canonical.empty()) // the file does not exist (anymore)
+            canonical = f;
+        unit.files.push_back(std::string(canonical.str()));
+        hashes.push_back(currentHash(canonical));
+    };
+    add(file);
+    for (const auto &f : includedFiles)
+        add(f);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < unit.files.size(); ++i)
+        recordedHashes[unit.files[i]] = hashes[i];
+    units[unit.files.front()] = std::move(unit);
+    modified = true;
+}
+
+void Manifest::recordRefs(llvm::StringRef htmlName, llvm::ArrayRef<std::string> refsFiles)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    llvm::StringSet<> &refs = refsOfFiles[htmlName];
+    for (const auto &f : refsFiles)
+        refs.insert(f);
+    modified = true;
+}
+
+bool Manifest::takeRefsFiles(const std::set<std::string> &htmlNames,
+                             std::set<std::string> &refsFiles)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &name : htmlNames) {
+        auto it = refsOfFiles.find(name);
+        if (it == refsOfFiles.end())
+            continue;
+        for (const auto &f : it->second)
+            refsFiles.insert(f.first().str());
+        refsOfFiles.erase(it);
+        modified = true;
+    }
+    return hasRefs;
+}
+
+void Manifest::setRefs(llvm::StringMap<llvm::StringSet<>> refs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    refsOfFiles = std::move(refs);
+    hasRefs = true;
+    modified = true;
+}
+
+void Manifest::save(const llvm::StringSet<> &databaseFiles)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = units.begin(); it != units.end();) {
+        auto unit = it++;
+        if (!databaseFiles.count(unit->first())) {
+            units.erase(unit);
+            modified = true;
+        }
+    }
+    if (!modified)
+        return;
+
+    // Other generators may share the output directory
+    std::string tmpFile =
+        manifestFile % ".tmp" % std::to_string(llvm::sys::Process::getProcessId());
+    std::error_code error_code;
+    {
+        llvm::raw_fd_ostream out(tmpFile, error_code, llvm::sys::fs::OF_None);
+        if (!error_code) {
+            // Only keep the files still used by a translation unit
+            llvm::StringMap<size_t> indexes;
+            for (const auto &unit : units) {
+                for (const auto &f : unit.second.files) {
+                    if (indexes.insert({ f, indexes.size() }).second) {
+                        out << "F\t";
+                        out.write_hex(recordedHashes.lookup(f));
+                        out << '\t' << f << '\n';
+                    }
+                }
+            }
+            for (const auto &unit : units) {
+                out << "T\t";
+                out.write_hex(unit.second.command);
+                out << '\t' << unit.first() << "\nI\t";
+                bool first = true;
+                for (const auto &f : unit.second.files) {
+                    if (!first)
+                        out << ' ';
+                    first = false;
+                    out << indexes[f];
+                }
+                out << '\n';
+            }
+            llvm::StringMap<size_t> refsIndexes;
+            for (const auto &file : refsOfFiles) {
+                for (const auto &f : file.second) {
+                    if (refsIndexes.insert({ f.first(), refsIndexes.size() }).second)
+                        out << "P\t" << f.first() << '\n';
+                }
+            }
+            for (const auto &file : refsOfFiles) {
+                out << "R\t";
+                bool first = true;
+                for (const auto &f : file.second) {
+                    if (!first)
+                        out << ' ';
+                    first = false;
+                    out << refsIndexes[f.first()];
+                }
+                out << '\t' << file.first() << '\n';
+            }
+            if (hasRefs)
+                out << "E\trefs\n";
+        }
+    }
+    if (!error_code)
+        error_code = llvm::sys::fs::rename(tmpFile, manifestFile);
+    if (error_code) {
+        llvm::sys::fs::remove(tmpFile);
+        std::cerr << "Error writing " << manifestFile << ": " << error_code.message() << std::endl;
+    }
+}
@@ -0,0 +1,97 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+/* Records, in a sidecar file of the output directory, what each translation unit was generated
+ * from: a hash of its command line, and the content hash of every file it included.
+ *
+ * On the next incremental run, a translation unit only needs to be processed again if its
+ * command changed, or if the content of any of these files changed.
+ */
+class Manifest
+{
+public:
+    explicit Manifest(llvm::StringRef outputPrefix);
+
+    static uint64_t commandHash(llvm::ArrayRef<std::string> command, llvm::StringRef directory);
+
+    // Hash the current content of all the files of the manifest, on 'jobs' threads
+    void checkChanges(unsigned jobs);
+
+    // The files of the manifest whose content changed since they were recorded (or which
+    // were removed). Only valid after checkChanges()
+    std::vector<std::string> changedFiles() const;
+
+    // true if the translation unit was recorded with this command, and none of the files it
+    // included changed. Only valid after checkChanges()
+    bool isUpToDate(llvm::StringRef file, uint64_t command) const;
+
+    // Remove the translation unit, so it is not considered up to date until it is recorded again
+    void forget(llvm::StringRef file);
+
+    // 'file' and 'includedFiles' do not need to be canonical
+    void record(llvm::StringRef file, uint64_t command, llvm::ArrayRef<std::string> includedFiles);
+
+    // The html file 'htmlName' has records in these refs files, relative to the output directory.
+    // The html names are without the .html extension, and escaped as in the records.
+    void recordRefs(llvm::StringRef htmlName, llvm::ArrayRef<std::string> refsFiles);
+
+    // Add to 'refsFiles' the refs files which have records of one of these html files, and
+    // forget them. Returns false if the refs files of the records are not known: the manifest
+    // did not exist or was written without them. They must then be given with setRefs.
+    bool takeRefsFiles(const std::set<std::string> &htmlNames, std::set<std::string> &refsFiles);
+
+    // html name -> all the refs files which have its records
+    void setRefs(llvm::StringMap<llvm::StringSet<>> refs);
+
+    // Write the manifest, without the translation units which are not among 'databaseFiles', the
+    // canonical names of the files of the compilation database
+    void save(const llvm::StringSet<> &databaseFiles);
+
+private:
+    struct TranslationUnit
+    {
+        uint64_t command = 0;
+        std::vector<std::string> files; // including itself
+    };
+
+    uint64_t currentHash(llvm::StringRef file);
+
+    std::string manifestFile;
+    llvm::StringMap<TranslationUnit> units;
+    llvm::StringMap<uint64_t> recordedHashes; // when the files were last recorded
+    llvm::StringMap<uint64_t> currentHashes; // cache of the hashes computed during this run
+    llvm::StringSet<> changed;
+    llvm::StringMap<llvm::StringSet<>> refsOfFiles; // html name -> refs files, see recordRefs
+    bool hasRefs = false; // refsOfFiles covers all the records
+    bool modified = false;
+    mutable std::mutex mutex;
+};
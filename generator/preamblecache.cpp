@@ -0,0 +1,326 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "preamblecache.h"
+
+#include <clang/Basic/Stack.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendActions.h>
+#include <clang/Frontend/Utils.h>
+#include <clang/Tooling/ArgumentsAdjusters.h>
+#include <clang/Tooling/Tooling.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/thread.h>
+
+#include <iostream>
+
+#include "compat.h"
+#include "filesystem.h"
+#include "projectmanager.h"
+#include "stringbuilder.h"
+
+// The #include lines at the start of the file, before anything else but comments.
+// The names between quotes found next to the file are made absolute, as the PCH is not built
+// from the same directory.
+static std::vector<std::string> leadingIncludes(llvm::StringRef file)
+{
+    std::vector<std::string> includes;
+    auto B = llvm::MemoryBuffer::getFile(file);
+    if (!B)
+        return includes;
+    llvm::StringRef content = B.get()->getBuffer();
+    llvm::StringRef directory = llvm::sys::path::parent_path(file);
+
+    while (true) {
+        content = content.ltrim();
+        if (content.consume_front("//")) {
+            content = content.substr(std::min(content.find('\n'), content.size()));
+            continue;
+        }
+        if (content.consume_front("/*")) {
+            size_t end = content.find("*/");
+            if (end == llvm::StringRef::npos)
+                break;
+            content = content.substr(end + 2);
+            continue;
+        }
+        if (!content.consume_front("#"))
+            break;
+        llvm::StringRef line = content.substr(0, content.find('\n')).ltrim();
+        if (!line.consume_front("include"))
+            break;
+        line = line.ltrim();
+        if (line.empty() || (line[0] != '<' && line[0] != '"'))
+            break;
+        size_t close = line.find(line[0] == '<' ? '>' : '"', 1);
+        if (close == llvm::StringRef::npos)
+            break;
+        llvm::StringRef name = line.substr(1, close - 1);
+        llvm::StringRef rest = line.substr(close + 1).ltrim();
+        if (!rest.empty() && !rest.starts_with("//") && !rest.starts_with("/*"))
+            break;
+
+        if (line[0] == '"') {
+            llvm::SmallString<256> local(directory);
+            llvm::sys::path::append(local, name);
+            if (llvm::sys::fs::exists(local))
+                includes.push_back("#include \"" % local.str() % "\"");
+            else
+                includes.push_back("#include \"" % name % "\"");
+        } else {
+            includes.push_back("#include <" % name % ">");
+        }
+        // Only skip the include itself: a comment after it is handled by the next iteration
+        content = content.substr(name.end() + 1 - content.begin());
+    }
+    return includes;
+}
+
+// The command of the unit, without what depends on the file itself
+static std::vector<std::string> commandWithoutFile(const PreambleCache::Unit &unit)
+{
+    std::vector<std::string> command =
+        clang::tooling::getClangStripDependencyFileAdjuster()(unit.command, unit.file);
+    llvm::erase_if(command, [&](const std::string &arg) {
+        if (arg.empty() || arg[0] == '-')
+            return false;
+        llvm::SmallString<256> canonical;
+        canonicalize(arg, canonical);
+        return canonical.str() == unit.file;
+    });
+    return command;
+}
+
+static llvm::StringRef headerLanguage(llvm::StringRef file)
+{
+    llvm::StringRef extension = llvm::sys::path::extension(file);
+    if (extension == ".c")
+        return "c-header";
+    if (extension == ".m")
+        return "objective-c-header";
+    if (extension == ".mm")
+        return "objective-c++-header";
+    return "c++-header";
+}
+
+namespace {
+// Records all the files of the PCH, including the system ones: the projects can be in
+// system include directories
+struct PreambleDependencies : clang::DependencyCollector
+{
+    bool needSystemDependencies() override
+    {
+        return true;
+    }
+};
+
+class BuildPreambleAction : public clang::GeneratePCHAction
+{
+    std::string output;
+    std::shared_ptr<PreambleDependencies> dependencies;
+
+public:
+    BuildPreambleAction(std::string output, std::shared_ptr<PreambleDependencies> dependencies)
+        : output(std::move(output))
+        , dependencies(std::move(dependencies))
+    {
+    }
+
+protected:
+    bool BeginInvocation(clang::CompilerInstance &CI) override
+    {
+        CI.getFrontendOpts().OutputFile = output;
+        // The headers of a PCH are never generated with it
+        CI.getFrontendOpts().SkipFunctionBodies = true;
+        CI.addDependencyCollector(dependencies);
+        return clang::GeneratePCHAction::BeginInvocation(CI);
+    }
+};
+}
+
+PreambleCache::PreambleCache(ProjectManager &projectManager)
+    : projectManager(projectManager)
+{
+}
+
+PreambleCache::~PreambleCache()
+{
+    for (const auto &preamble : preambles) {
+        llvm::sys::fs::remove(preamble->pch);
+        llvm::sys::fs::remove(preamble->pch % ".h");
+    }
+    if (!directory.empty())
+        llvm::sys::fs::remove(directory);
+}
+
+void PreambleCache::build(
+    llvm::ArrayRef<Unit> units, unsigned jobs,
+    llvm::function_ref<llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>()> createFS)
+{
+    // The key of a group: the command, and the includes it starts with
+    std::vector<std::string> commands(units.size());
+    std::vector<std::vector<std::string>> includes(units.size());
+    llvm::StringMap<size_t> prefixCount;
+    auto key = [&](size_t unit, size_t includeCount) {
+        std::string key = commands[unit];
+        for (size_t i = 0; i < includeCount; ++i) {
+            key += includes[unit][i];
+            key += '\n';
+        }
+        return key;
+    };
+    auto hasForcedInclude = [](llvm::ArrayRef<std::string> command) {
+        return llvm::is_contained(command, "-include");
+    };
+    std::vector<bool> eligible(units.size());
+    for (size_t u = 0; u < units.size(); ++u) {
+        auto command = commandWithoutFile(units[u]);
+        // Only one PCH can be loaded
+        eligible[u] = !llvm::is_contained(command, "-include-pch");
+        if (!eligible[u])
+            continue;
+        for (const auto &arg : command) {
+            commands[u] += arg;
+            commands[u] += '\0';
+        }
+        commands[u] += '\0';
+        includes[u] = leadingIncludes(units[u].file);
+        for (size_t n = hasForcedInclude(command) ? 0 : 1; n <= includes[u].size(); ++n)
+            prefixCount[key(u, n)]++;
+    }
+
+    // Each unit goes to the group with the longest prefix that is shared by enough units
+    llvm::StringMap<size_t> groupOfKey;
+    std::vector<std::vector<size_t>> groups;
+    for (size_t u = 0; u < units.size(); ++u) {
+        if (!eligible[u])
+            continue;
+        for (size_t n = includes[u].size() + 1; n-- > 0;) {
+            std::string k = key(u, n);
+            auto count = prefixCount.find(k);
+            if (count == prefixCount.end() || count->second < MinimumGroupSize)
+                continue;
+            auto inserted = groupOfKey.insert({ k, groups.size() });
+            if (inserted.second)
+                groups.push_back({});
+            groups[inserted.first->second].push_back(u);
+            includes[u].resize(n);
+            break;
+        }
+    }
+    if (groups.empty())
+        return;
+
+    llvm::SmallString<256> dir;
+    if (auto error_code = llvm::sys::fs::createUniqueDirectory("codebrowser-pch", dir)) {
+        std::cerr << "Error: cannot create a directory for the PCH: " << error_code.message()
+                  << std::endl;
+        return;
+    }
+    directory = std::string(dir.str());
+
+    // Build the PCH of each group, with the command of its first unit
+    for (size_t g = 0; g < groups.size(); ++g) {
+        preambles.push_back(std::make_unique<Preamble>());
+        preambles.back()->pch = directory % "/" % std::to_string(g) % ".pch";
+    }
+    std::atomic<size_t> next { 0 };
+    auto work = [&] {
+        llvm::IntrusiveRefCntPtr<clang::FileManager> FM(new clang::FileManager({ "." }, createFS()));
+        for (size_t g = next++; g < groups.size(); g = next++) {
+            Preamble &preamble = *preambles[g];
+            const Unit &unit = units[groups[g].front()];
+            std::string header = preamble.pch % ".h";
+            {
+                std::error_code error_code;
+                llvm::raw_fd_ostream out(header, error_code, llvm::sys::fs::OF_None);
+                for (const auto &include : includes[groups[g].front()])
+                    out << include << '\n';
+            }
+
+            std::vector<std::string> command = commandWithoutFile(unit);
+            command.push_back("-x");
+            command.push_back(std::string(headerLanguage(unit.file)));
+            command.push_back(header);
+            auto dependencies = std::make_shared<PreambleDependencies>();
+            clang::tooling::ToolInvocation Inv(
+                command, maybe_unique(new BuildPreambleAction(preamble.pch, dependencies)),
+                FM.get());
+            clang::IgnoringDiagConsumer diagnostics;
+            Inv.setDiagnosticConsumer(&diagnostics);
+            if (!Inv.run() || !llvm::sys::fs::exists(preamble.pch)) {
+                std::cerr << std::string("PCH: could not build the PCH of " % unit.file
+                                         % ", the units starting like it are parsed entirely\n");
+                preamble.pch.clear();
+                continue;
+            }
+
+            for (const auto &file : dependencies->getDependencies()) {
+                llvm::SmallString<256> canonical;
+                canonicalize(file, canonical);
+                if (canonical.empty() || canonical.str() == header)
+                    continue;
+                preamble.files.push_back(std::string(canonical.str()));
+                ProjectInfo *project = projectManager.projectForFile(canonical);
+                if (project && project->type != ProjectInfo::External)
+                    preamble.generated.push_back({ preamble.files.back(), project });
+            }
+        }
+    };
+    std::vector<llvm::thread> threads;
+    for (size_t i = 1; i < std::min<size_t>(jobs, groups.size()); ++i)
+        threads.emplace_back(clang::DesiredStackSize, work);
+    work();
+    for (auto &t : threads)
+        t.join();
+
+    size_t covered = 0;
+    for (size_t g = 0; g < groups.size(); ++g) {
+        if (preambles[g]->pch.empty())
+            continue;
+        for (size_t u : groups[g])
+            preambleOfUnit[units[u].file] = g;
+        covered += groups[g].size();
+    }
+    std::cerr << "PCH: " << groups.size() << " groups, covering " << covered << " of "
+              << units.size() << " translation units" << std::endl;
+}
+
+std::string PreambleCache::pchFor(llvm::StringRef file, std::vector<std::string> *files) const
+{
+    auto it = preambleOfUnit.find(file);
+    if (it == preambleOfUnit.end())
+        return {};
+    const Preamble &preamble = *preambles[it->second];
+    if (!preamble.ready) {
+        for (const auto &generated : preamble.generated) {
+            if (projectManager.shouldProcess(generated.first, generated.second))
+                return {};
+        }
+        // Once generated, the html files stay
+        preamble.ready = true;
+    }
+    if (files)
+        *files = preamble.files;
+    return preamble.pch;
+}
@@ -0,0 +1,84 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "includeplanner.h"
+
+namespace llvm {
+namespace vfs {
+class FileSystem;
+}
+}
+
+struct ProjectInfo;
+struct ProjectManager;
+
+/* Precompiled headers shared by the translation units which start with the same includes.
+ *
+ * The units are grouped by command line, and by the longest list of leading #include lines that
+ * at least MinimumGroupSize of them have in common. One PCH of these includes is built for each
+ * group, and the units of the group load it instead of parsing the headers again.
+ *
+ * Nothing from a PCH is lexed again, so the preprocessor callbacks are not called for the headers
+ * it contains: a unit only uses its PCH once all the headers of the projects in it are generated.
+ */
+class PreambleCache
+{
+public:
+    static constexpr size_t MinimumGroupSize = 3;
+
+    using Unit = IncludePlanner::Unit;
+
+    explicit PreambleCache(ProjectManager &projectManager);
+    ~PreambleCache(); // removes the PCH files
+
+    // Group the units and build the PCH of each group, on 'jobs' threads
+    void build(llvm::ArrayRef<Unit> units, unsigned jobs,
+               llvm::function_ref<llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>()> createFS);
+
+    // The PCH to use for the unit (canonical), or an empty string if it has none, or if a header
+    // of its PCH still needs to be generated. 'files', if not null, receives the files of the PCH
+    std::string pchFor(llvm::StringRef file, std::vector<std::string> *files = nullptr) const;
+
+private:
+    struct Preamble
+    {
+        std::string pch;
+        std::vector<std::string> files; // canonical
+        std::vector<std::pair<std::string, ProjectInfo *>> generated; // the files of projects
+        mutable std::atomic<bool> ready { false }; // all the generated files were generated
+    };
+
+    ProjectManager &projectManager;
+    std::string directory; // temporary, for the PCH files
+    std::vector<std::unique_ptr<Preamble>> preambles;
+    llvm::StringMap<size_t> preambleOfUnit;
+};
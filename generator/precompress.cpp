@@ -0,0 +1,223 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "precompress.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Process.h>
+
+#include <iostream>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "stringbuilder.h"
+
+// Beyond that, add() waits for the compression threads
+static constexpr size_t MaxPendingBytes = 256 * 1024 * 1024;
+
+Precompressor::Precompressor(Mode mode, unsigned threads)
+    : mode(mode)
+    , threadCount(std::max(1u, threads))
+    , owner(llvm::sys::Process::getProcessId())
+{
+}
+
+Precompressor::~Precompressor()
+{
+    if (llvm::sys::Process::getProcessId() != owner)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    for (auto &t : threads)
+        t.join();
+}
+
+bool Precompressor::isAvailable()
+{
+#ifdef HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Precompressor::add(std::string path, std::string content)
+{
+    // The threads of the parent do not exist in the child processes of -fork, and the mutex may
+    // have been copied locked
+    if (synchronous || llvm::sys::Process::getProcessId() != owner) {
+        if (!writeCompressed(path, content))
+            failed = true;
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (threads.empty()) {
+        for (unsigned i = 0; i < threadCount; ++i)
+            threads.emplace_back([this] { run(); });
+    }
+    queueChanged.wait(lock, [&] { return pendingBytes < MaxPendingBytes; });
+    ++pending;
+    pendingBytes += content.size();
+    queue.emplace_back(std::move(path), std::move(content));
+    lock.unlock();
+    queueChanged.notify_all();
+}
+
+void Precompressor::compressInCallingThread()
+{
+    synchronous = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    for (auto &t : threads)
+        t.join();
+    threads.clear();
+}
+
+bool Precompressor::wait()
+{
+    if (llvm::sys::Process::getProcessId() == owner) {
+        std::unique_lock<std::mutex> lock(mutex);
+        queueChanged.wait(lock, [&] { return pending == 0; });
+    }
+    return !failed;
+}
+
+void Precompressor::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        queueChanged.wait(lock, [&] { return !queue.empty() || stopping; });
+        if (queue.empty())
+            return;
+        auto file = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        bool success = writeCompressed(file.first, file.second);
+        lock.lock();
+        if (!success)
+            failed = true;
+        --pending;
+        pendingBytes -= file.second.size();
+        queueChanged.notify_all();
+    }
+}
+
+bool Precompressor::writeCompressed(llvm::StringRef path, llvm::StringRef content)
+{
+#ifdef HAVE_ZLIB
+    std::string compressed;
+    z_stream stream = {};
+    // 15 + 16: the gzip format
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY)
+        != Z_OK)
+        return false;
+    compressed.resize(deflateBound(&stream, content.size()));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(content.data()));
+    stream.avail_in = content.size();
+    stream.next_out = reinterpret_cast<Bytef *>(compressed.data());
+    stream.avail_out = compressed.size();
+    int result = deflate(&stream, Z_FINISH);
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END)
+        return false;
+
+    // The web server must not see a partial file
+    std::string target = path % ".gz";
+    std::string tmpFile = target % ".tmp" % std::to_string(llvm::sys::Process::getProcessId());
+    std::error_code error_code;
+    {
+        llvm::raw_fd_ostream out(tmpFile, error_code, llvm::sys::fs::OF_None);
+        if (!error_code) {
+            out << compressed;
+            out.close();
+            error_code = out.error();
+        }
+    }
+    if (!error_code)
+        error_code = llvm::sys::fs::rename(tmpFile, target);
+    if (error_code) {
+        llvm::sys::fs::remove(tmpFile);
+        std::cerr << std::string("Error writing " % target % ": " % error_code.message() % "\n");
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+PrecompressedOStream::PrecompressedOStream(std::string path, std::error_code &EC,
+                                           Precompressor *precompressor, std::string writePath)
+    : path(std::move(path))
+    , writePath(writePath.empty() ? this->path : std::move(writePath))
+    , file(this->writePath, EC, llvm::sys::fs::OF_None)
+    , precompressor(precompressor)
+{
+}
+
+PrecompressedOStream::~PrecompressedOStream()
+{
+    close();
+}
+
+void PrecompressedOStream::close()
+{
+    if (closed)
+        return;
+    closed = true;
+    flush();
+    if (precompressor && precompressor->mode == Precompressor::AlsoCompressed)
+        file << content;
+    file.close();
+    if (file.has_error()) {
+        std::cerr << std::string("Error writing " % path % ": " % file.error().message() % "\n");
+        file.clear_error();
+        if (writePath != path)
+            llvm::sys::fs::remove(writePath);
+        return;
+    }
+    if (writePath != path) {
+        if (auto EC = llvm::sys::fs::rename(writePath, path)) {
+            std::cerr << std::string("Error writing " % path % ": " % EC.message() % "\n");
+            llvm::sys::fs::remove(writePath);
+            return;
+        }
+    }
+    if (precompressor)
+        precompressor->add(std::move(path), std::move(content));
+}
+
+void PrecompressedOStream::write_impl(const char *ptr, size_t size)
+{
+    pos += size;
+    if (precompressor)
+        content.append(ptr, size);
+    else
+        file.write(ptr, size);
+}
@@ -0,0 +1,111 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* Writes a gzip compressed copy, <file>.gz, of the generated files, that the web server can send
+ * as it is (nginx's gzip_static, ...) instead of compressing the files for every request.
+ *
+ * The html files are compressed on background threads, while the next translation units are
+ * parsed: PrecompressedOStream queues the content of a page once it is written.
+ * With CompressedOnly, the html files are left empty. They are still needed by the next runs
+ * to know which files were generated. The web server must then always send the .gz files
+ * (nginx's "gzip_static always; gunzip on;").
+ */
+class Precompressor
+{
+public:
+    enum Mode { AlsoCompressed, CompressedOnly };
+
+    Precompressor(Mode mode, unsigned threads);
+    ~Precompressor(); // waits for the queued files
+
+    const Mode mode;
+
+    // Whether the generator was built with zlib. Otherwise nothing can be compressed
+    static bool isAvailable();
+
+    // Queue 'content' to be written compressed to <path>.gz. Blocks while too much is queued,
+    // if the compression is slower than the generation.
+    // In the child processes of -fork, the file is compressed right away.
+    void add(std::string path, std::string content);
+
+    // Stop the threads once the queued files are written, and compress the next files right
+    // away in add: a process which forks must not have other threads running, see ForkPool
+    void compressInCallingThread();
+
+    // Wait until all the queued files are written. Returns false if one of them failed
+    bool wait();
+
+    // Write <path>.gz, in this thread
+    static bool writeCompressed(llvm::StringRef path, llvm::StringRef content);
+
+private:
+    void run();
+
+    unsigned threadCount;
+    int owner; // the process which owns the threads
+    std::vector<std::thread> threads; // started by the first add
+    std::mutex mutex;
+    std::condition_variable queueChanged;
+    std::deque<std::pair<std::string, std::string>> queue;
+    size_t pending = 0; // the files queued or being written
+    size_t pendingBytes = 0;
+    bool stopping = false;
+    std::atomic<bool> synchronous { false };
+    std::atomic<bool> failed { false };
+};
+
+/* The stream of a generated file. Without precompressor, it writes the file. Otherwise, the
+ * content is kept until close(), then written to the file unless the mode is CompressedOnly, and
+ * queued to the precompressor. */
+class PrecompressedOStream : public llvm::raw_ostream
+{
+public:
+    // When 'writePath' is given, the content is written there and renamed to 'path' on close
+    PrecompressedOStream(std::string path, std::error_code &EC, Precompressor *precompressor,
+                         std::string writePath = {});
+    ~PrecompressedOStream() override;
+
+    void close();
+
+private:
+    void write_impl(const char *ptr, size_t size) override;
+    uint64_t current_pos() const override { return pos; }
+
+    std::string path;
+    std::string writePath;
+    llvm::raw_fd_ostream file;
+    Precompressor *precompressor;
+    std::string content;
+    uint64_t pos = 0;
+    bool closed = false;
+};
@@ -151,7 +151,7 @@ void PreprocessorCallback::MacroExpands(const clang::Token &MacroNameTok, MyMacr
             std::string tag = "class=\"macro\" title=\""
                 % Generator::escapeAttr(expansion, expansionBuffer) % "\" data-ref=\"" % ref % "\"";
             annotator.generator(FID).addTag("span", tag, sm.getFileOffset(loc),
-                                            MacroNameTok.getLength());
+                                            MacroNameTok.getLength(), {}, Generator::Preprocessor);
             return;
         }
 
@@ -168,7 +168,8 @@ void PreprocessorCallback::MacroExpands(const clang::Token &MacroNameTok, MyMacr
         % llvm::Twine(sm.getExpansionLineNumber(defLoc)).str() % "\" title=\""
         % Generator::escapeAttr(expansion, expansionBuffer) % "\" data-ref=\"" % ref % "\""
         % dataProj;
-    annotator.generator(FID).addTag("a", tag, sm.getFileOffset(loc), MacroNameTok.getLength());
+    annotator.generator(FID).addTag("a", tag, sm.getFileOffset(loc), MacroNameTok.getLength(), {},
+                                    Generator::Preprocessor);
 }
 
 void PreprocessorCallback::MacroDefined(const clang::Token &MacroNameTok,
@@ -191,7 +192,8 @@ void PreprocessorCallback::MacroDefined(const clang::Token &MacroNameTok,
 
     annotator.generator(FID).addTag("dfn",
                                     "class=\"macro\" id=\"" % ref % "\" data-ref=\"" % ref % "\"",
-                                    sm.getFileOffset(loc), MacroNameTok.getLength());
+                                    sm.getFileOffset(loc), MacroNameTok.getLength(), {},
+                                    Generator::Preprocessor);
 }
 
 void PreprocessorCallback::MacroUndefined(const clang::Token &MacroNameTok,
@@ -228,7 +230,7 @@ void PreprocessorCallback::MacroUndefined(const clang::Token &MacroNameTok,
         if (link.empty()) {
             std::string tag = "class=\"macro\" data-ref=\"" % ref % "\"";
             annotator.generator(FID).addTag("span", tag, sm.getFileOffset(loc),
-                                            MacroNameTok.getLength());
+                                            MacroNameTok.getLength(), {}, Generator::Preprocessor);
             return;
         }
 
@@ -244,7 +246,8 @@ void PreprocessorCallback::MacroUndefined(const clang::Token &MacroNameTok,
     std::string tag = "class=\"macro\" href=\"" % link % "#"
         % llvm::Twine(sm.getExpansionLineNumber(defLoc)).str() % "\" data-ref=\"" % ref % "\""
         % dataProj;
-    annotator.generator(FID).addTag("a", tag, sm.getFileOffset(loc), MacroNameTok.getLength());
+    annotator.generator(FID).addTag("a", tag, sm.getFileOffset(loc), MacroNameTok.getLength(), {},
+                                    Generator::Preprocessor);
 }
 
 void PreprocessorCallback::InclusionDirective(
@@ -256,6 +259,10 @@ void PreprocessorCallback::InclusionDirective(
 #endif
     clang::SrcMgr::CharacteristicKind)
 {
+    // Also the files skipped because of their include guard: they are still dependencies
+    if (File && includedFiles)
+        includedFiles->push_back(File->getName().str());
+
     if (!HashLoc.isValid() || !HashLoc.isFileID() || !File)
         return;
     clang::SourceManager &sm = annotator.getSourceMgr();
@@ -270,7 +277,8 @@ void PreprocessorCallback::InclusionDirective(
     auto B = sm.getFileOffset(FilenameRange.getBegin());
     auto E = sm.getFileOffset(FilenameRange.getEnd());
 
-    annotator.generator(FID).addTag("a", "href=\"" % link % "\"", B, E - B);
+    annotator.generator(FID).addTag("a", "href=\"" % link % "\"", B, E - B, {},
+                                    Generator::Preprocessor);
 }
 
 void PreprocessorCallback::Defined(const clang::Token &MacroNameTok, MyMacroDefinition MD,
@@ -307,7 +315,7 @@ void PreprocessorCallback::Defined(const clang::Token &MacroNameTok, MyMacroDefi
         if (link.empty()) {
             std::string tag = "class=\"macro\" data-ref=\"" % ref % "\"";
             annotator.generator(FID).addTag("span", tag, sm.getFileOffset(loc),
-                                            MacroNameTok.getLength());
+                                            MacroNameTok.getLength(), {}, Generator::Preprocessor);
             return;
         }
 
@@ -323,7 +331,8 @@ void PreprocessorCallback::Defined(const clang::Token &MacroNameTok, MyMacroDefi
     std::string tag = "class=\"macro\" href=\"" % link % "#"
         % llvm::Twine(sm.getExpansionLineNumber(defLoc)).str() % "\" data-ref=\"" % ref % "\""
         % dataProj;
-    annotator.generator(FID).addTag("a", tag, sm.getFileOffset(loc), MacroNameTok.getLength());
+    annotator.generator(FID).addTag("a", tag, sm.getFileOffset(loc), MacroNameTok.getLength(), {},
+                                    Generator::Preprocessor);
 }
 
 void PreprocessorCallback::HandlePPCond(clang::SourceLocation Loc, clang::SourceLocation IfLoc)
@@ -346,5 +355,6 @@ void PreprocessorCallback::HandlePPCond(clang::SourceLocation Loc, clang::Source
 
     annotator.generator(FID).addTag(
         "span", ("data-ppcond=\"" + clang::Twine(SM.getExpansionLineNumber(IfLoc)) + "\"").str(),
-        SM.getFileOffset(Loc), clang::Lexer::MeasureTokenLength(Loc, SM, PP.getLangOpts()));
+        SM.getFileOffset(Loc), clang::Lexer::MeasureTokenLength(Loc, SM, PP.getLangOpts()), {},
+        Generator::Preprocessor);
 }
@@ -27,6 +27,8 @@
 #include <clang/Lex/PPCallbacks.h>
 
 #include <map>
+#include <string>
+#include <vector>
 
 namespace clang {
 class Preprocessor;
@@ -41,12 +43,15 @@ class PreprocessorCallback : public clang::PPCallbacks
     bool disabled = false; // To prevent recurstion
     bool seenPragma = false; // To detect _Pragma in expansion
     bool recoverIncludePath; // If we should try to find the include paths harder
+    std::vector<std::string> *includedFiles; // If not null, receives all the included files
 
 public:
-    PreprocessorCallback(Annotator &fm, clang::Preprocessor &PP, bool recoverIncludePath)
+    PreprocessorCallback(Annotator &fm, clang::Preprocessor &PP, bool recoverIncludePath,
+                         std::vector<std::string> *includedFiles = nullptr)
         : annotator(fm)
         , PP(PP)
         , recoverIncludePath(recoverIncludePath)
+        , includedFiles(includedFiles)
     {
     }
 
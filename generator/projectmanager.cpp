@@ -23,14 +23,25 @@
 
 #include <llvm/ADT/SmallString.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <shared_mutex>
 #include <system_error>
+#include <thread>
 
 #include "filesystem.h"
 #include "stringbuilder.h"
 
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
 ProjectManager::ProjectManager(std::string outputPrefix, std::string _dataPath)
     : outputPrefix(std::move(outputPrefix))
     , dataPath(std::move(_dataPath))
@@ -55,28 +66,60 @@ bool ProjectManager::addProject(ProjectInfo info)
         filename += '/';
     info.source_path = filename.c_str();
 
+    std::unique_lock<std::shared_mutex> lock(projectCacheMutex);
+    ProjectNode *node = &projectTree;
+    llvm::StringRef path = info.source_path;
+    for (size_t slash = path.find('/'); slash != llvm::StringRef::npos;
+         path = path.substr(slash + 1), slash = path.find('/')) {
+        auto &child = node->children[path.substr(0, slash)];
+        if (!child)
+            child = std::make_unique<ProjectNode>();
+        node = child.get();
+    }
+    // For the same path, the last project wins
+    node->project = projects.size();
     projects.push_back(std::move(info));
+    // The cached pointers may have moved, and the new project may be a better match
+    projectCache.clear();
     return true;
 }
 
 ProjectInfo *ProjectManager::projectForFile(llvm::StringRef filename)
 {
-    unsigned int match_length = 0;
     ProjectInfo *result = nullptr;
+    {
+        std::shared_lock<std::shared_mutex> lock(projectCacheMutex);
+        auto it = projectCache.find(filename);
+        if (it != projectCache.end())
+            return it->second;
 
-    for (auto &it : projects) {
-        const std::string &source_path = it.source_path;
-        if (source_path.size() < match_length) {
-            continue;
-        }
-        if (filename.starts_with(source_path)) {
-            result = &it;
-            match_length = source_path.size();
+        // The longest source_path which is a prefix of the file name. Each of them ends with a
+        // '/', so only the directories of the file name can match, not its last component.
+        const ProjectNode *node = &projectTree;
+        llvm::StringRef path = filename;
+        for (size_t slash = path.find('/'); slash != llvm::StringRef::npos;
+             path = path.substr(slash + 1), slash = path.find('/')) {
+            auto child = node->children.find(path.substr(0, slash));
+            if (child == node->children.end())
+                break;
+            node = child->second.get();
+            if (node->project >= 0)
+                result = &projects[node->project];
         }
     }
+
+    std::unique_lock<std::shared_mutex> lock(projectCacheMutex);
+    projectCache.try_emplace(filename, result);
     return result;
 }
 
+std::string ProjectManager::htmlFileName(llvm::StringRef filename,
+                                         const ProjectInfo *project) const
+{
+    return outputPrefix % "/" % project->name % "/" % filename.substr(project->source_path.size())
+        % ".html";
+}
+
 bool ProjectManager::shouldProcess(llvm::StringRef filename, ProjectInfo *project) const
 {
     if (!project)
@@ -84,40 +127,257 @@ bool ProjectManager::shouldProcess(llvm::StringRef filename, ProjectInfo *projec
     if (project->type == ProjectInfo::External)
         return false;
 
-    std::string fn = outputPrefix % "/" % project->name % "/"
-        % filename.substr(project->source_path.size()) % ".html";
-    return !llvm::sys::fs::exists(fn);
+    std::string fn = htmlFileName(filename, project);
+    {
+        std::lock_guard<std::mutex> lock(claimedMutex);
+        if (claimed.count(fn) || generated.count(fn))
+            return false;
+    }
+    if (!llvm::sys::fs::exists(fn))
+        return true;
     // || boost::filesystem::last_write_time(p) < entry->getModificationTime();
+    std::lock_guard<std::mutex> lock(claimedMutex);
+    generated.insert(fn);
+    return false;
+}
+
+bool ProjectManager::claim(llvm::StringRef filename, ProjectInfo *project,
+                           llvm::StringRef mainFile)
+{
+    if (!project)
+        return false;
+    if (project->type == ProjectInfo::External)
+        return false;
+
+    std::string fn = htmlFileName(filename, project);
+    {
+        std::lock_guard<std::mutex> lock(claimedMutex);
+        auto owner = headerOwners.find(filename);
+        if (owner != headerOwners.end() && owner->second != mainFile
+            && !releasedOwners.count(owner->second))
+            return false;
+        if (generated.count(fn))
+            return false;
+        // Whatever happens next, no other thread of this process needs to try again
+        if (!claimed.insert(fn).second)
+            return false;
+    }
+
+    // The claim marker <html>.claim holds the pid of its owner. Generator::generate writes the
+    // page next to it and renames it over the html file. The marker is kept afterwards, so that
+    // creating it only succeeds for a page which was never claimed, and the html file is only
+    // looked at when it already exists.
+    std::string marker = claimMarker(fn);
+    std::error_code error_code = createClaimMarker(marker);
+    if (!error_code)
+        return true;
+    if (error_code != std::errc::file_exists)
+        return false;
+    if (llvm::sys::fs::exists(fn)) {
+        std::lock_guard<std::mutex> lock(claimedMutex);
+        generated.insert(fn);
+        return false;
+    }
+    // The marker of a process which crashed or was killed is taken over, so the page is generated
+    // again. That process may still have completed the page before its end.
+    return takeOverClaimMarker(marker) && !llvm::sys::fs::exists(fn);
+}
+
+std::string ProjectManager::claimMarker(llvm::StringRef htmlFile)
+{
+    return htmlFile % ".claim";
+}
+
+std::error_code ProjectManager::createClaimMarker(const std::string &marker)
+{
+    int fd;
+    std::error_code error_code =
+        llvm::sys::fs::openFileForWrite(marker, fd, llvm::sys::fs::CD_CreateNew);
+    if (error_code == std::errc::no_such_file_or_directory) {
+        create_directories(llvm::sys::path::parent_path(marker));
+        error_code = llvm::sys::fs::openFileForWrite(marker, fd, llvm::sys::fs::CD_CreateNew);
+    }
+    if (error_code)
+        return error_code;
+    llvm::raw_fd_ostream out(fd, /*shouldClose=*/true);
+    out << llvm::sys::Process::getProcessId();
+    return {};
+}
+
+// The pid written in the marker, or 0 if it cannot be read (yet)
+static int claimMarkerOwner(const std::string &marker)
+{
+    auto buffer = llvm::MemoryBuffer::getFile(marker);
+    int pid = 0;
+    if (!buffer || llvm::StringRef((*buffer)->getBuffer()).trim().getAsInteger(10, pid))
+        return 0;
+    return pid;
+}
+
+static bool isProcessAlive(int pid)
+{
+#ifndef _WIN32
+    return ::kill(pid, 0) == 0 || errno != ESRCH;
+#else
+    (void)pid;
+    return true; // The marker is then only taken over by the process which wrote it
+#endif
+}
+
+// Whether the owner of the marker will not complete its page
+static bool isStaleClaimMarker(const std::string &marker)
+{
+    int owner = claimMarkerOwner(marker);
+    if (owner == 0) {
+        // The owner is still writing its pid, unless it died right after creating the marker
+        llvm::sys::fs::file_status status;
+        return !llvm::sys::fs::status(marker, status)
+            && std::chrono::system_clock::now() - status.getLastModificationTime()
+            >= std::chrono::minutes(1);
+    }
+    if (owner == llvm::sys::Process::getProcessId()) {
+        // Our own marker is stale: this process already decided to claim the file again
+        // (forgetClaims, released header)
+        return true;
+    }
+    // Another process generates the page, unless it is gone
+    return !isProcessAlive(owner);
+}
+
+bool ProjectManager::takeOverClaimMarker(const std::string &marker)
+{
+    // The takeovers of a marker are serialized by a lock on <marker>.lock, which is released by
+    // the system if its holder dies. The marker is only replaced if it is still stale once
+    // locked: after a takeover, it holds the pid of a running process, so only one process
+    // takes it over.
+    int fd;
+    if (llvm::sys::fs::openFileForWrite(marker + ".lock", fd, llvm::sys::fs::CD_OpenAlways))
+        return false;
+    bool tookOver = false;
+    if (!llvm::sys::fs::tryLockFile(fd)) {
+        if (isStaleClaimMarker(marker)) {
+            std::string tmp = marker % ".tmp" % std::to_string(llvm::sys::Process::getProcessId());
+            std::error_code error_code;
+            {
+                llvm::raw_fd_ostream out(tmp, error_code, llvm::sys::fs::OF_None);
+                if (!error_code)
+                    out << llvm::sys::Process::getProcessId();
+            }
+            if (!error_code)
+                error_code = llvm::sys::fs::rename(tmp, marker);
+            if (error_code)
+                llvm::sys::fs::remove(tmp);
+            tookOver = !error_code;
+        }
+        llvm::sys::fs::unlockFile(fd);
+    }
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+    return tookOver;
+}
+
+void ProjectManager::forgetClaims()
+{
+    std::lock_guard<std::mutex> lock(claimedMutex);
+    claimed.clear();
+}
+
+void ProjectManager::setHeaderOwners(llvm::StringMap<std::string> owners)
+{
+    std::lock_guard<std::mutex> lock(claimedMutex);
+    headerOwners = std::move(owners);
+    releasedOwners.clear();
+}
+
+void ProjectManager::releaseHeaders(llvm::StringRef mainFile)
+{
+    std::lock_guard<std::mutex> lock(claimedMutex);
+    releasedOwners.insert(mainFile);
+}
+
+void ProjectManager::removeOutput(llvm::StringRef filename, ProjectInfo *project)
+{
+    if (!project || project->type == ProjectInfo::External)
+        return;
+    std::string fn = htmlFileName(filename, project);
+    {
+        std::lock_guard<std::mutex> lock(claimedMutex);
+        generated.erase(fn);
+    }
+    llvm::sys::fs::remove(fn);
+    llvm::sys::fs::remove(fn + ".gz");
+    llvm::sys::fs::remove(claimMarker(fn));
+}
+
+bool ProjectManager::setRefsLayout(RefsLayout layout)
+{
+    std::string refsDir = outputPrefix % "/refs";
+    std::string marker = refsDir % "/.layout";
+    unsigned existing = layout; // if nothing was generated yet
+    if (auto B = llvm::MemoryBuffer::getFile(marker)) {
+        if (B.get()->getBuffer().trim().getAsInteger(10, existing))
+            existing = 0;
+    } else {
+        // The flat layout has files and the _M directory directly in refs/, the hashed layout
+        // only has directories named after the hash
+        std::error_code EC;
+        for (llvm::sys::fs::directory_iterator it(refsDir, EC), DirEnd; it != DirEnd && !EC;
+             it.increment(EC)) {
+            auto fileName = llvm::sys::path::filename(it->path());
+            if (fileName == "_M"
+                || (!fileName.starts_with(".")
+                    && it->type() != llvm::sys::fs::file_type::directory_file)) {
+                existing = FlatRefsLayout;
+                break;
+            }
+        }
+    }
+    if (existing != unsigned(layout))
+        return false;
+    refsLayout = layout;
+    if (layout == FlatRefsLayout || llvm::sys::fs::exists(marker))
+        return true;
+
+    // Several generators may start at the same time: the rename is atomic
+    create_directories(refsDir);
+    std::string tmpFile = marker % ".tmp" % std::to_string(llvm::sys::Process::getProcessId());
+    std::error_code error_code;
+    {
+        llvm::raw_fd_ostream out(tmpFile, error_code, llvm::sys::fs::OF_None);
+        if (error_code)
+            return false;
+        out << unsigned(layout) << "\n";
+        out.close();
+        error_code = out.error();
+    }
+    if (!error_code)
+        error_code = llvm::sys::fs::rename(tmpFile, marker);
+    if (error_code)
+        llvm::sys::fs::remove(tmpFile);
+    return !error_code;
 }
 
 std::string ProjectManager::includeRecovery(llvm::StringRef includeName, llvm::StringRef from)
 {
-    if (includeRecoveryCache.empty()) {
+    std::lock_guard<std::mutex> lock(includeRecoveryMutex);
+    if (!includeIndex) {
+        std::vector<std::string> roots;
         for (const auto &proj : projects) {
             // skip sub project
             llvm::StringRef sourcePath(proj.source_path);
             auto parentPath = sourcePath.substr(0, sourcePath.rfind('/'));
             if (projectForFile(parentPath))
                 continue;
-
-            std::error_code EC;
-            for (llvm::sys::fs::recursive_directory_iterator it(sourcePath, EC), DirEnd;
-                 it != DirEnd && !EC; it.increment(EC)) {
-                auto fileName = llvm::sys::path::filename(it->path());
-                if (fileName.starts_with(".")) {
-                    it.no_push();
-                    continue;
-                }
-                includeRecoveryCache.insert({ std::string(fileName), it->path() });
-            }
+            roots.push_back(proj.source_path);
         }
+        includeIndex = std::make_unique<IncludeIndex>();
+        includeIndex->build(roots, std::max(1u, std::thread::hardware_concurrency()),
+                            std::string(outputPrefix % "/.include_index"));
     }
     llvm::StringRef includeFileName = llvm::sys::path::filename(includeName);
     std::string resolved;
     int weight = -1000;
-    auto range = includeRecoveryCache.equal_range(std::string(includeFileName));
-    for (auto it = range.first; it != range.second; ++it) {
-        llvm::StringRef candidate(it->second);
+    for (const std::string &file : includeIndex->filesNamed(includeFileName)) {
+        llvm::StringRef candidate(file);
         unsigned int suf_len = 0;
         while (suf_len < std::min(candidate.size(), includeName.size())) {
             if (candidate[candidate.size() - suf_len - 1]
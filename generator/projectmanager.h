@@ -21,13 +21,25 @@
 
 #pragma once
 
+#include <llvm/ADT/StringMap.h>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
 
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
-#include <unordered_map>
+#include <system_error>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "filesystem.h"
+#include "includeindex.h"
+#include "precompress.h"
+
+class Manifest;
+
 struct ProjectInfo
 {
     std::string name;
@@ -76,17 +88,81 @@ struct ProjectManager
     std::string outputPrefix;
     std::string dataPath;
 
-    // the file name need to be canonicalized
-    ProjectInfo *projectForFile(llvm::StringRef filename); // don't keep a cache
+    // Batch the refs and fnSearch records in the refs log instead of appending them directly
+    bool useRefsLog = false;
+
+    // The layout of the refs files, see refs_file_name
+    RefsLayout refsLayout = FlatRefsLayout;
+
+    // Use that refs layout, and record it in the output directory. Fails if the output directory
+    // already contains refs in another layout
+    bool setRefsLayout(RefsLayout layout);
+
+    // Writes the .gz copies of the output files. Null if they are not wanted
+    std::unique_ptr<Precompressor> precompressor;
+
+    // With -incremental, records which refs files have records of each generated file
+    Manifest *manifest = nullptr;
+
+    // the file name need to be canonicalized. The results are cached until a project is added
+    ProjectInfo *projectForFile(llvm::StringRef filename);
 
     // return true if the filename should be proesseded.
     // 'project' is the value returned by projectForFile
     bool shouldProcess(llvm::StringRef filename, ProjectInfo *project) const;
 
+    // Same as shouldProcess, but also reserves the generation of that file for the caller.
+    // Only one caller gets true for a given file, across all threads and all the processes
+    // writing in the same output directory.
+    // 'mainFile' is the canonical name of the translation unit of the caller: a header which was
+    // planned for another translation unit is not claimed, until that one releases its headers.
+    bool claim(llvm::StringRef filename, ProjectInfo *project, llvm::StringRef mainFile = {});
+
+    // The file which reserves the generation of the html file 'htmlFile', see claim
+    static std::string claimMarker(llvm::StringRef htmlFile);
+
+    // header -> the translation unit which should generate it, both canonical
+    void setHeaderOwners(llvm::StringMap<std::string> owners);
+
+    // Called once a translation unit was processed, whether it succeeded or not: the headers it
+    // did not generate can now be claimed by any translation unit
+    void releaseHeaders(llvm::StringRef mainFile);
+
+    // Forget what was claimed by this process, so the files can be claimed again by a later run
+    // in the same process. The html files that already exist are still not processed again.
+    void forgetClaims();
+
+    // Remove the generated html of the file, so that it will be generated again
+    void removeOutput(llvm::StringRef filename, ProjectInfo *project);
+
+    // The file of the projects which most likely is the include 'includeName' which was not
+    // found from 'from'. Lists the projects the first time, see IncludeIndex.
     std::string includeRecovery(llvm::StringRef includeName, llvm::StringRef from);
 
 private:
     static std::vector<ProjectInfo> systemProjects();
 
-    std::unordered_multimap<std::string, std::string> includeRecoveryCache;
+    std::string htmlFileName(llvm::StringRef filename, const ProjectInfo *project) const;
+
+    static std::error_code createClaimMarker(const std::string &marker);
+    static bool takeOverClaimMarker(const std::string &marker);
+
+    std::unordered_set<std::string> claimed; // html files claimed by this process
+    mutable llvm::StringSet<> generated; // html files known to exist, so not stat'ed again
+    llvm::StringMap<std::string> headerOwners;
+    llvm::StringSet<> releasedOwners;
+    mutable std::mutex claimedMutex;
+
+    // The projects by the components of their source_path, for projectForFile
+    struct ProjectNode
+    {
+        llvm::StringMap<std::unique_ptr<ProjectNode>> children;
+        int project = -1; // index in 'projects'
+    };
+    ProjectNode projectTree;
+    llvm::StringMap<ProjectInfo *> projectCache; // canonical file name -> projectForFile
+    std::shared_mutex projectCacheMutex;
+
+    std::unique_ptr<IncludeIndex> includeIndex; // built by the first includeRecovery
+    std::mutex includeRecoveryMutex; // includeRecovery can be called from several threads
 };
@@ -0,0 +1,397 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "refslog.h"
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/xxhash.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_set>
+
+#include "filesystem.h"
+#include "generator.h"
+#include "precompress.h"
+#include "stringbuilder.h"
+
+static std::string logDirectory(llvm::StringRef outputPrefix)
+{
+    return outputPrefix % "/refslog";
+}
+
+// Calls fn(i) for every i in [0, count), on 'jobs' threads
+static void parallelFor(size_t count, unsigned jobs, llvm::function_ref<void(size_t)> fn)
+{
+    std::atomic<size_t> next { 0 };
+    auto work = [&] {
+        for (size_t i = next++; i < count; i = next++)
+            fn(i);
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min<size_t>(jobs, count); ++i)
+        threads.emplace_back(work);
+    work();
+    for (auto &t : threads)
+        t.join();
+}
+
+RefsLog::RefsLog(llvm::StringRef outputPrefix)
+    : outputPrefix(outputPrefix)
+    , shards(NumShards)
+{
+}
+
+RefsLog::~RefsLog()
+{
+    flush();
+}
+
+void RefsLog::add(llvm::StringRef path, llvm::StringRef data)
+{
+    std::string &shard = shards[llvm::xxHash64(path) % NumShards];
+    shard %= std::to_string(data.size()) % " " % path % "\n" % data;
+}
+
+void RefsLog::flush()
+{
+    if (std::all_of(shards.begin(), shards.end(), [](const std::string &s) { return s.empty(); }))
+        return;
+
+    std::string dir = logDirectory(outputPrefix);
+    create_directories(dir);
+    // One set of log files per thread, so there is no need to lock them
+    std::string suffix = std::to_string(llvm::sys::Process::getProcessId()) % "-"
+        % std::to_string(llvm::get_threadid());
+    for (unsigned i = 0; i < NumShards; ++i) {
+        if (shards[i].empty())
+            continue;
+        std::string filename = dir % "/" % std::to_string(i) % "." % suffix;
+        if (auto error_code = append_to_file(filename, shards[i])) {
+            std::cerr << "Error writing " << filename << ": " << error_code.message() << std::endl;
+        }
+        shards[i].clear();
+    }
+}
+
+static bool writePending(llvm::StringRef outputPrefix, llvm::StringMap<std::string> &pending)
+{
+    bool success = true;
+    for (const auto &it : pending) {
+        std::string filename = outputPrefix % "/" % it.first();
+        if (auto error_code = append_to_file(filename, it.second)) {
+            std::cerr << "Error writing " << filename << ": " << error_code.message() << std::endl;
+            success = false;
+        }
+    }
+    pending.clear();
+    return success;
+}
+
+// Dispatch the records of all the logs of a shard. The records are grouped per destination file
+// in memory, and written once the buffered data goes over the limit.
+static bool compactShard(llvm::StringRef outputPrefix, const std::vector<std::string> &logs)
+{
+    const size_t pendingLimit = 64 * 1024 * 1024;
+    llvm::StringMap<std::string> pending;
+    size_t pendingSize = 0;
+    bool success = true;
+
+    for (const auto &log : logs) {
+        auto B = llvm::MemoryBuffer::getFile(log);
+        if (!B) {
+            std::cerr << "Error reading " << log << ": " << B.getError().message() << std::endl;
+            success = false;
+            continue;
+        }
+        llvm::StringRef content = B.get()->getBuffer();
+        while (!content.empty()) {
+            auto header = content.split('\n');
+            auto sizeAndPath = header.first.split(' ');
+            size_t size;
+            if (sizeAndPath.first.getAsInteger(10, size) || sizeAndPath.second.empty()
+                || size > header.second.size()) {
+                std::cerr << "Truncated or corrupted refs log " << log << std::endl;
+                success = false;
+                break;
+            }
+            llvm::StringRef data = header.second.substr(0, size);
+            pending[sizeAndPath.second].append(data.data(), data.size());
+            pendingSize += size;
+            content = header.second.substr(size);
+        }
+        if (pendingSize > pendingLimit) {
+            success &= writePending(outputPrefix, pending);
+            pendingSize = 0;
+        }
+    }
+    success &= writePending(outputPrefix, pending);
+
+    if (success) {
+        for (const auto &log : logs)
+            llvm::sys::fs::remove(log);
+    }
+    return success;
+}
+
+bool RefsLog::compact(llvm::StringRef outputPrefix, unsigned jobs, bool ownLogsOnly,
+                      llvm::ArrayRef<int> childProcesses)
+{
+    std::string dir = logDirectory(outputPrefix);
+    llvm::StringSet<> processes;
+    processes.insert(std::to_string(llvm::sys::Process::getProcessId()));
+    for (int pid : childProcesses)
+        processes.insert(std::to_string(pid));
+    std::vector<std::vector<std::string>> logsPerShard(NumShards);
+    std::error_code EC;
+    for (llvm::sys::fs::directory_iterator it(dir, EC), DirEnd; it != DirEnd && !EC;
+         it.increment(EC)) {
+        llvm::StringRef name = llvm::sys::path::filename(it->path());
+        auto shardAndSuffix = name.split('.');
+        unsigned shard;
+        if (shardAndSuffix.first.getAsInteger(10, shard) || shard >= NumShards)
+            continue;
+        if (ownLogsOnly && !processes.count(shardAndSuffix.second.split('-').first))
+            continue;
+        logsPerShard[shard].push_back(it->path());
+    }
+    if (EC == std::errc::no_such_file_or_directory)
+        return true; // nothing was logged
+    if (EC) {
+        std::cerr << "Error reading " << dir << ": " << EC.message() << std::endl;
+        return false;
+    }
+
+    // The shards have different destination files, so they can be dispatched in parallel
+    std::atomic<bool> success { true };
+    parallelFor(NumShards, jobs, [&](size_t shard) {
+        auto &logs = logsPerShard[shard];
+        std::sort(logs.begin(), logs.end());
+        if (!compactShard(outputPrefix, logs))
+            success = false;
+    });
+
+    if (success)
+        llvm::sys::fs::remove(dir); // fails if other processes still have logs there
+    return success;
+}
+
+// The files under refs/ and fnSearch/ accepted by 'filter', and whether they are in fnSearch/.
+// The subdirectories are visited, so that both refs layouts are handled.
+static std::vector<std::pair<std::string, bool>>
+listRefsFiles(llvm::StringRef outputPrefix,
+              llvm::function_ref<bool(const llvm::sys::fs::directory_entry &)> filter)
+{
+    std::vector<std::pair<std::string, bool>> files;
+    llvm::StringSet<> names;
+    for (auto dir : { "/refs", "/fnSearch" }) {
+        bool isFnSearch = llvm::StringRef(dir) == "/fnSearch";
+        std::error_code EC;
+        for (llvm::sys::fs::recursive_directory_iterator it(outputPrefix + dir, EC), DirEnd;
+             it != DirEnd && !EC; it.increment(EC)) {
+            // Skip the layout marker
+            if (llvm::sys::path::filename(it->path()).starts_with("."))
+                continue;
+            if (it->type() != llvm::sys::fs::file_type::directory_file) {
+                names.insert(it->path());
+                if (filter(*it))
+                    files.emplace_back(it->path(), isFnSearch);
+            }
+        }
+    }
+    // Skip the copies written by Precompressor. A symbol name can also end with ".gz"
+    llvm::erase_if(files, [&](const std::pair<std::string, bool> &file) {
+        llvm::StringRef name = file.first;
+        return name.ends_with(".gz") && names.count(name.drop_back(3));
+    });
+    return files;
+}
+
+// Calls fn(filename, content, isFnSearch) for each of the files, given with whether they are in
+// fnSearch/, on 'jobs' threads. If fn returns true, the content was modified and is written back.
+// The files which do not exist are skipped.
+static bool
+rewriteRefsFiles(const std::vector<std::pair<std::string, bool>> &files, unsigned jobs,
+                 llvm::function_ref<bool(llvm::StringRef, std::string &, bool)> fn)
+{
+    std::atomic<bool> success { true };
+    parallelFor(files.size(), jobs, [&](size_t i) {
+        const std::string &filename = files[i].first;
+        auto B = llvm::MemoryBuffer::getFile(filename);
+        if (B.getError() == std::errc::no_such_file_or_directory)
+            return;
+        if (!B) {
+            std::cerr << "Error reading " << filename << ": " << B.getError().message()
+                      << std::endl;
+            success = false;
+            return;
+        }
+        std::string content = B.get()->getBuffer().str();
+        if (!fn(filename, content, files[i].second))
+            return;
+        std::error_code error_code;
+        llvm::raw_fd_ostream out(filename, error_code, llvm::sys::fs::OF_None);
+        if (!error_code) {
+            out << content;
+            out.close();
+            error_code = out.error();
+        }
+        if (error_code) {
+            std::cerr << "Error writing " << filename << ": " << error_code.message()
+                      << std::endl;
+            success = false;
+        }
+    });
+    return success;
+}
+
+// Same as above, for each file under refs/ and fnSearch/ accepted by 'filter'
+static bool rewriteRefsFiles(llvm::StringRef outputPrefix, unsigned jobs,
+                             llvm::function_ref<bool(const llvm::sys::fs::directory_entry &)> filter,
+                             llvm::function_ref<bool(llvm::StringRef, std::string &, bool)> fn)
+{
+    return rewriteRefsFiles(listRefsFiles(outputPrefix, filter), jobs, fn);
+}
+
+// Calls fn with each record of a refs file. A record is a line, except for the docs that can
+// span several lines: a record always starts with '<' since it is escaped everywhere else.
+// In the fnSearch files, every line is a record.
+template<typename F>
+static void forEachRecord(llvm::StringRef content, bool isFnSearch, F &&fn)
+{
+    while (!content.empty()) {
+        size_t end = content.find('\n');
+        while (!isFnSearch && end != llvm::StringRef::npos && end + 1 < content.size()
+               && content[end + 1] != '<') {
+            end = content.find('\n', end + 1);
+        }
+        end = end == llvm::StringRef::npos ? content.size() : end + 1;
+        fn(content.substr(0, end));
+        content = content.substr(end);
+    }
+}
+
+bool RefsLog::purge(llvm::StringRef outputPrefix, const std::set<std::string> &files,
+                    unsigned jobs, const std::set<std::string> *refsFiles,
+                    llvm::StringMap<llvm::StringSet<>> *remainingRecords)
+{
+    if (files.empty() && !remainingRecords)
+        return true;
+    std::unordered_set<std::string> attributes;
+    llvm::SmallString<256> buffer;
+    for (const auto &file : files)
+        attributes.insert(Generator::escapeAttr(file, buffer).str());
+
+    std::mutex remainingMutex;
+    auto anyFile = [](const llvm::sys::fs::directory_entry &) { return true; };
+    auto removeRecords = [&](llvm::StringRef filename, std::string &content, bool isFnSearch) {
+        if (isFnSearch)
+            return false;
+        std::string result;
+        std::set<std::string> remaining;
+        forEachRecord(content, false, [&](llvm::StringRef record) {
+            // <use f='...' l='...'/> or <doc f='...' l='...'>...</doc>
+            size_t pos = record.find(" f='");
+            if (pos != llvm::StringRef::npos && pos < record.find('>')) {
+                llvm::StringRef f = record.substr(pos + 4);
+                f = f.substr(0, f.find('\''));
+                if (attributes.count(f.str()))
+                    return;
+                if (remainingRecords)
+                    remaining.insert(f.str());
+            }
+            result += record;
+        });
+        if (remainingRecords && !remaining.empty()) {
+            llvm::StringRef relative = filename.substr(outputPrefix.size() + 1);
+            std::lock_guard<std::mutex> lock(remainingMutex);
+            for (const auto &f : remaining)
+                (*remainingRecords)[f].insert(relative);
+        }
+        if (result.size() == content.size())
+            return false;
+        content = std::move(result);
+        return true;
+    };
+    if (!refsFiles)
+        return rewriteRefsFiles(outputPrefix, jobs, anyFile, removeRecords);
+    std::vector<std::pair<std::string, bool>> paths;
+    for (const auto &f : *refsFiles)
+        paths.emplace_back(outputPrefix % "/" % f, false);
+    return rewriteRefsFiles(paths, jobs, removeRecords);
+}
+
+bool RefsLog::removeDuplicates(llvm::StringRef outputPrefix,
+                               std::chrono::system_clock::time_point since, unsigned jobs)
+{
+    auto modifiedSince = [&](const llvm::sys::fs::directory_entry &entry) {
+        auto status = entry.status();
+        return status && status->getLastModificationTime() >= since;
+    };
+    auto dedup = [&](llvm::StringRef, std::string &content, bool isFnSearch) {
+        std::unordered_set<std::string_view> seen;
+        std::string result;
+        forEachRecord(content, isFnSearch, [&](llvm::StringRef record) {
+            if (seen.insert(std::string_view(record)).second)
+                result += record;
+        });
+        if (result.size() == content.size())
+            return false;
+        content = std::move(result);
+        return true;
+    };
+    return rewriteRefsFiles(outputPrefix, jobs, modifiedSince, dedup);
+}
+
+bool RefsLog::precompress(llvm::StringRef outputPrefix, RefsLayout layout,
+                          std::chrono::system_clock::time_point since, unsigned jobs)
+{
+    std::string refsDir = outputPrefix % "/refs/";
+    auto modifiedSince = [&](const llvm::sys::fs::directory_entry &entry) {
+        if (layout == PackedRefsLayout && llvm::StringRef(entry.path()).starts_with(refsDir))
+            return false;
+        auto status = entry.status();
+        return status && status->getLastModificationTime() >= since;
+    };
+    std::vector<std::pair<std::string, bool>> files = listRefsFiles(outputPrefix, modifiedSince);
+    std::string fileIndex = outputPrefix % "/fileIndex";
+    llvm::sys::fs::file_status status;
+    if (!llvm::sys::fs::status(fileIndex, status) && status.getLastModificationTime() >= since)
+        files.emplace_back(fileIndex, false);
+
+    std::atomic<bool> success { true };
+    parallelFor(files.size(), jobs, [&](size_t i) {
+        const std::string &filename = files[i].first;
+        auto B = llvm::MemoryBuffer::getFile(filename);
+        if (!B || !Precompressor::writeCompressed(filename, B.get()->getBuffer()))
+            success = false;
+    });
+    return success;
+}
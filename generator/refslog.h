@@ -0,0 +1,86 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <chrono>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "filesystem.h"
+
+/* Batches the records that Annotator::generate appends to the files of refs/ and fnSearch/.
+ *
+ * Writing directly costs one open/append/close per symbol and per translation unit. Instead,
+ * the records of a translation unit are buffered and appended to a few log files in
+ * $OUTPUTDIR/refslog/, one per shard and per thread. compact() then dispatches them to their
+ * final files.
+ *
+ * Each record in a log file is a header line "<size> <path>\n" followed by <size> bytes of data
+ * to append to the file at <path>, relative to the output directory.
+ */
+class RefsLog
+{
+public:
+    static constexpr unsigned NumShards = 64;
+
+    explicit RefsLog(llvm::StringRef outputPrefix);
+    ~RefsLog();
+
+    // Buffer data to be appended to 'path', relative to the output directory
+    void add(llvm::StringRef path, llvm::StringRef data);
+
+    // Append the buffered records to the log files of the current thread
+    void flush();
+
+    // Move the logged records to their files, and remove the logs.
+    // If ownLogsOnly is true, only the logs written by the current process are compacted, so
+    // that several generators can compact concurrently in the same output directory. The logs of
+    // 'childProcesses' are then compacted too.
+    static bool compact(llvm::StringRef outputPrefix, unsigned jobs, bool ownLogsOnly = false,
+                        llvm::ArrayRef<int> childProcesses = {});
+
+    // Remove from the refs the records located in one of these files. The files are given as the
+    // html names used in the records (f='...'), without the .html extension.
+    // Only the refs files in 'refsFiles' (relative to the output directory) are read, or all of
+    // them if it is null. 'remainingRecords', if not null, then receives for each html name, as
+    // escaped in the records, the refs files which still have its records.
+    static bool purge(llvm::StringRef outputPrefix, const std::set<std::string> &files,
+                      unsigned jobs, const std::set<std::string> *refsFiles = nullptr,
+                      llvm::StringMap<llvm::StringSet<>> *remainingRecords = nullptr);
+
+    // Remove the duplicated records from the refs and fnSearch files modified since 'since'
+    static bool removeDuplicates(llvm::StringRef outputPrefix,
+                                 std::chrono::system_clock::time_point since, unsigned jobs);
+
+    // Write the .gz copies of the refs and fnSearch files, and of the fileIndex, modified since
+    // 'since', see Precompressor. The refs of the packed layout are left to codebrowser_refspack
+    static bool precompress(llvm::StringRef outputPrefix, RefsLayout layout,
+                            std::chrono::system_clock::time_point since, unsigned jobs);
+
+private:
+    std::string outputPrefix;
+    std::vector<std::string> shards;
+};
@@ -0,0 +1,220 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "scheduler.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <queue>
+#include <utility>
+
+#include "stringbuilder.h"
+
+WorkQueue::WorkQueue(std::vector<std::deque<size_t>> itemsPerWorker)
+{
+    for (auto &items : itemsPerWorker) {
+        workers.push_back(std::make_unique<Worker>());
+        workers.back()->items = std::move(items);
+    }
+}
+
+bool WorkQueue::pop(unsigned worker, size_t &item)
+{
+    for (unsigned i = 0; i < workers.size(); ++i) {
+        // Start with our own deque, then try to steal from the others
+        Worker &w = *workers[(worker + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.items.empty()) {
+            item = w.items.front();
+            w.items.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Rough estimation of the cost of a file which was never processed: its size, plus what its
+// includes will bring in.
+static double estimateFromContent(llvm::StringRef file)
+{
+    auto B = llvm::MemoryBuffer::getFile(file);
+    if (!B)
+        return 0;
+    llvm::StringRef content = B.get()->getBuffer();
+    int includes = 0;
+    while (!content.empty()) {
+        auto split = content.split('\n');
+        llvm::StringRef line = split.first.ltrim();
+        if (line.consume_front("#") && line.ltrim().starts_with("include"))
+            includes++;
+        content = split.second;
+    }
+    const double bytesPerInclude = 16 * 1024;
+    return B.get()->getBufferSize() + includes * bytesPerInclude;
+}
+
+Scheduler::Scheduler(llvm::StringRef outputPrefix)
+    : timingsFile(outputPrefix % "/.timings")
+{
+    auto B = llvm::MemoryBuffer::getFile(timingsFile);
+    if (!B)
+        return;
+
+    // Each line is: seconds <tab> memory <tab> file. The last line for a file wins.
+    llvm::StringRef content = B.get()->getBuffer();
+    while (!content.empty()) {
+        auto split = content.split('\n');
+        content = split.second;
+        llvm::SmallVector<llvm::StringRef, 3> fields;
+        split.first.split(fields, '\t', 2);
+        Cost cost;
+        if (fields.size() != 3 || fields[0].getAsDouble(cost.seconds)
+            || fields[1].getAsInteger(10, cost.memory))
+            continue;
+        history[fields[2]] = cost;
+    }
+}
+
+WorkQueue Scheduler::plan(llvm::ArrayRef<std::string> files, unsigned workers)
+{
+    std::vector<std::deque<size_t>> itemsPerWorker(std::max(1u, workers));
+    if (workers <= 1) {
+        for (size_t i = 0; i < files.size(); ++i)
+            itemsPerWorker[0].push_back(i);
+        return WorkQueue(std::move(itemsPerWorker));
+    }
+
+    std::vector<Cost> costs(files.size());
+    std::vector<size_t> unknown;
+    double knownSeconds = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        auto it = history.find(files[i]);
+        if (it != history.end()) {
+            costs[i] = it->second;
+            knownSeconds += it->second.seconds;
+        } else {
+            auto estimate = estimates.find(files[i]);
+            costs[i].seconds = estimate != estimates.end() ? estimate->second
+                                                           : estimateFromContent(files[i]);
+            unknown.push_back(i);
+        }
+    }
+
+    // Bring the estimations to the same scale as the measured timings, assuming the new files are
+    // on average like the known ones.
+    size_t knownCount = files.size() - unknown.size();
+    if (knownCount && !unknown.empty()) {
+        double estimated = 0;
+        for (size_t i : unknown)
+            estimated += costs[i].seconds;
+        if (estimated > 0) {
+            double scale = (knownSeconds / knownCount) / (estimated / unknown.size());
+            for (size_t i : unknown)
+                costs[i].seconds *= scale;
+        }
+    }
+
+    std::vector<size_t> order(files.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (costs[a].seconds != costs[b].seconds)
+            return costs[a].seconds > costs[b].seconds;
+        return costs[a].memory > costs[b].memory;
+    });
+
+    // Longest first: each file goes to the worker with the least work so far. As they are sorted,
+    // every deque also starts with its most expensive file.
+    using Load = std::pair<double, unsigned>;
+    std::priority_queue<Load, std::vector<Load>, std::greater<Load>> loads;
+    for (unsigned w = 0; w < workers; ++w)
+        loads.push({ 0, w });
+    for (size_t i : order) {
+        Load least = loads.top();
+        loads.pop();
+        itemsPerWorker[least.second].push_back(i);
+        loads.push({ least.first + costs[i].seconds, least.second });
+    }
+    return WorkQueue(std::move(itemsPerWorker));
+}
+
+void Scheduler::setEstimates(llvm::StringMap<double> estimates)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->estimates = std::move(estimates);
+}
+
+void Scheduler::record(llvm::StringRef file, double seconds, size_t memory)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto inserted = history.insert({ file, Cost() });
+    inserted.first->second = { seconds, memory };
+    recorded.push_back(std::string(file));
+}
+
+void Scheduler::save()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (recorded.empty())
+        return;
+
+    auto write = [&](llvm::raw_ostream &os, llvm::StringRef file) {
+        const Cost &cost = history[file];
+        os << llvm::format("%.3f", cost.seconds) << '\t' << cost.memory << '\t' << file << '\n';
+    };
+
+    std::error_code error_code;
+    if (llvm::sys::Process::GetEnv("MULTIPROCESS_MODE")) {
+        // Other generators are writing to the same file: only append what we have.
+        // scripts/runner.py orders its queue by these timings, and compacts the file at the end
+        std::string lines;
+        llvm::raw_string_ostream os(lines);
+        for (const auto &file : recorded)
+            write(os, file);
+        os.flush();
+        llvm::raw_fd_ostream out(timingsFile, error_code, llvm::sys::fs::OF_Append);
+        if (!error_code)
+            out << lines;
+    } else {
+        // Other generators may also save their timings here
+        std::string tmpFile =
+            timingsFile % ".tmp" % std::to_string(llvm::sys::Process::getProcessId());
+        {
+            llvm::raw_fd_ostream out(tmpFile, error_code, llvm::sys::fs::OF_None);
+            if (!error_code) {
+                for (const auto &it : history)
+                    write(out, it.first());
+            }
+        }
+        if (!error_code)
+            error_code = llvm::sys::fs::rename(tmpFile, timingsFile);
+        if (error_code)
+            llvm::sys::fs::remove(tmpFile);
+    }
+    if (error_code) {
+        std::cerr << "Error writing " << timingsFile << ": " << error_code.message() << std::endl;
+    }
+}
@@ -0,0 +1,87 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* The indexes of the files left to process, split in one deque per worker.
+ * A worker takes the files from the front of its own deque. Once it is empty, it steals the
+ * front of the deque of another worker, so nobody stays idle while there is work left. */
+class WorkQueue
+{
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<size_t> items;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+
+public:
+    explicit WorkQueue(std::vector<std::deque<size_t>> itemsPerWorker);
+
+    // Returns false when there is nothing left to process for anyone
+    bool pop(unsigned worker, size_t &item);
+};
+
+/* Decides in which order and on which worker the translation units are processed.
+ *
+ * The wall time and memory used by each file is recorded in a sidecar file in the output
+ * directory, and the next runs start with the most expensive files so that no long file is left
+ * alone at the end. Files without history are estimated from their size and number of includes.
+ */
+class Scheduler
+{
+public:
+    explicit Scheduler(llvm::StringRef outputPrefix);
+
+    // 'files' are absolute paths. With a single worker, the original order is kept.
+    WorkQueue plan(llvm::ArrayRef<std::string> files, unsigned workers);
+
+    void record(llvm::StringRef file, double seconds, size_t memory);
+
+    // Estimations of the cost of the files without history, in any unit, to use instead of
+    // looking at their content
+    void setEstimates(llvm::StringMap<double> estimates);
+
+    // Write the timings recorded during this run, merged with the previous ones.
+    void save();
+
+private:
+    struct Cost
+    {
+        double seconds = 0;
+        size_t memory = 0; // bytes
+    };
+
+    std::string timingsFile;
+    llvm::StringMap<Cost> history; // including what was recorded in this run
+    llvm::StringMap<double> estimates;
+    std::vector<std::string> recorded; // the keys of history updated in this run
+    std::mutex mutex;
+};
@@ -0,0 +1,126 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "workerfilemanager.h"
+
+#include <clang/Basic/FileManager.h>
+#include <clang/Basic/FileSystemStatCache.h>
+#include <llvm/Support/Path.h>
+
+#include <mutex>
+
+// What the FileManager allocates for each path it looks up, besides the path itself: the entry of
+// its maps, and the FileEntry or DirectoryEntry. This is only meant as an order of magnitude.
+static constexpr size_t EntryOverhead = 192;
+
+/* Installed in each FileManager of the worker. The FileManager caches all the results itself, so
+ * each call here is a new entry in the current FileManager */
+class WorkerFileManager::StatCache : public clang::FileSystemStatCache
+{
+    WorkerFileManager &owner;
+
+public:
+    explicit StatCache(WorkerFileManager &owner)
+        : owner(owner)
+    {
+    }
+
+    std::error_code getStat(llvm::StringRef Path, llvm::vfs::Status &Status, bool isFile,
+                            std::unique_ptr<llvm::vfs::File> *F,
+                            llvm::vfs::FileSystem &FS) override
+    {
+        owner.retained += Path.size() + EntryOverhead;
+
+        // The relative paths depend on the working directory of the translation unit
+        if (!llvm::sys::path::is_absolute(Path))
+            return get(Path, Status, isFile, F, nullptr, FS);
+
+        llvm::ErrorOr<llvm::vfs::Status> known = std::error_code();
+        if (owner.stats->lookup(Path, known)) {
+            // The FileManager opens the file later if it needs its content
+            if (!known)
+                return known.getError();
+            if (isFile == known->isDirectory())
+                return std::make_error_code(isFile ? std::errc::is_a_directory
+                                                   : std::errc::not_a_directory);
+            Status = *known;
+            return {};
+        }
+
+        std::error_code error = get(Path, Status, isFile, F, nullptr, FS);
+        if (error && error != std::errc::no_such_file_or_directory)
+            return error; // maybe transient, do not keep it
+        if (error)
+            owner.stats->insert(Path, error);
+        else
+            owner.stats->insert(Path, Status);
+        return error;
+    }
+};
+
+bool SharedStatResults::lookup(llvm::StringRef path,
+                               llvm::ErrorOr<llvm::vfs::Status> &result) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = stats.find(path);
+    if (it == stats.end())
+        return false;
+    result = it->second;
+    return true;
+}
+
+void SharedStatResults::insert(llvm::StringRef path,
+                               const llvm::ErrorOr<llvm::vfs::Status> &result)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    stats.try_emplace(path, result);
+}
+
+WorkerFileManager::WorkerFileManager(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS,
+                                     std::shared_ptr<SharedStatResults> stats, size_t budget,
+                                     unsigned maxUnits)
+    : VFS(std::move(VFS))
+    , budget(budget)
+    , maxUnits(maxUnits)
+    , stats(std::move(stats))
+{
+    rebuild();
+    rebuildCount = 0;
+}
+
+WorkerFileManager::~WorkerFileManager() = default;
+
+clang::FileManager *WorkerFileManager::next()
+{
+    if ((budget && retained > budget) || (maxUnits && units >= maxUnits))
+        rebuild();
+    ++units;
+    return FM.get();
+}
+
+void WorkerFileManager::rebuild()
+{
+    // A translation unit still running keeps its reference to the previous one
+    FM = new clang::FileManager({ "." }, VFS);
+    FM->setStatCache(std::make_unique<StatCache>(*this));
+    peak = std::max(peak, retained);
+    retained = 0;
+    units = 0;
+    ++rebuildCount;
+}
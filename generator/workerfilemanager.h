@@ -0,0 +1,91 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/VirtualFileSystem.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <shared_mutex>
+
+namespace clang {
+class FileManager;
+}
+
+/* The results of the stat calls of the compiler, for the absolute paths, shared by the
+ * FileManagers of all the workers. The files are not expected to change during a run. */
+class SharedStatResults
+{
+public:
+    // false if the path was not seen yet
+    bool lookup(llvm::StringRef path, llvm::ErrorOr<llvm::vfs::Status> &result) const;
+    void insert(llvm::StringRef path, const llvm::ErrorOr<llvm::vfs::Status> &result);
+
+private:
+    mutable std::shared_mutex mutex;
+    llvm::StringMap<llvm::ErrorOr<llvm::vfs::Status>> stats;
+};
+
+/* The FileManager used by one worker for all its translation units.
+ *
+ * A FileManager never forgets a file: over a long run, it ends up with an entry for every file
+ * included by any of the translation units of the worker. With a budget, it is replaced by a new
+ * one between two translation units once its entries are estimated to use more than the budget,
+ * or once it was used for a given number of translation units.
+ * The results of the stat calls outlive the rebuilds, so the new FileManager does not need to
+ * query the file system again for the files that the previous one, or another worker, already
+ * knew.
+ */
+class WorkerFileManager
+{
+public:
+    // A budget or maxUnits of 0 means no limit
+    WorkerFileManager(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS,
+                      std::shared_ptr<SharedStatResults> stats, size_t budget = 0,
+                      unsigned maxUnits = 0);
+    ~WorkerFileManager();
+
+    // The FileManager to use for the next translation unit
+    clang::FileManager *next();
+
+    // Estimation of the memory used by the entries of the current FileManager
+    size_t retainedMemory() const { return retained; }
+    size_t peakRetainedMemory() const { return std::max(peak, retained); }
+    unsigned rebuilds() const { return rebuildCount; }
+
+private:
+    class StatCache;
+
+    void rebuild();
+
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS;
+    llvm::IntrusiveRefCntPtr<clang::FileManager> FM;
+    size_t budget;
+    unsigned maxUnits;
+    unsigned units = 0;
+    size_t retained = 0;
+    size_t peak = 0;
+    unsigned rebuildCount = 0;
+    std::shared_ptr<SharedStatResults> stats;
+};
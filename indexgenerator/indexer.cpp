@@ -21,7 +21,9 @@
 
 
 #include <algorithm>
+#include <cstdio>
 #include <ctime>
+#include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
@@ -33,25 +35,91 @@
 
 #include "../global.h"
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 const char *data_url = "../data";
 
+// The layout of the refs, from refs/.layout written by the generator. Empty for the flat layout
+std::string refs_layout;
+
 std::map<std::string, std::string, std::greater<std::string> > project_map;
 
+// Like the -precompress options of the generator: also write a gzip compressed copy of the
+// index.html files, and leave them empty with PrecompressOnly
+enum PrecompressMode { NoPrecompress, Precompress, PrecompressOnly };
+PrecompressMode precompress = NoPrecompress;
+
 struct FolderInfo {
 //    std::string name;
     std::map<std::string, std::shared_ptr<FolderInfo>> subfolders;
 };
 
 std::string extractMetaFromHTML(std::string metaName, std::string fullPath) {
-    std::ifstream filein(fullPath, std::ifstream::in);
     std::string needle = "<meta name=\"woboq:interestingDefinitions\" content=\"";
     std::string endneedle = "\"/>\n";
+#ifdef HAVE_ZLIB
+    // The files left empty by -precompress-only are read from their .gz copy.
+    // gzgets reads the files which are not compressed too.
+    std::error_code ec;
+    if (std::filesystem::file_size(fullPath, ec) == 0 && !ec)
+        fullPath += ".gz";
+    gzFile filein = gzopen(fullPath.c_str(), "rb");
+    if (!filein)
+        return "";
+    std::string result;
+    std::string line;
+    char buffer[4096];
+    while (gzgets(filein, buffer, sizeof(buffer))) {
+        line += buffer;
+        if (line.back() != '\n' && !gzeof(filein))
+            continue;
+        if (line.back() == '\n')
+            line.pop_back();
+        if (line.find(needle, 0) == 0) {
+            result = line.substr(needle.length(), line.length() - needle.length() - endneedle.length());
+            break;
+        }
+        line.clear();
+    }
+    gzclose(filein);
+    return result;
+#else
+    std::ifstream filein(fullPath, std::ifstream::in);
     for (std::string line; std::getline(filein, line); ) {
         if (line.find(needle, 0) == 0) {
             return line.substr(needle.length(), line.length() - needle.length() - endneedle.length());
         }
     }
     return "";
+#endif
+}
+
+// Write the content of a generated file, and its .gz copy depending on 'precompress'
+bool writeOutput(const std::string &filename, const std::string &content) {
+    std::ofstream myfile(filename, std::ios::binary);
+    if (precompress != PrecompressOnly)
+        myfile << content;
+    myfile.close();
+    if (!myfile)
+        return false;
+#ifdef HAVE_ZLIB
+    if (precompress != NoPrecompress) {
+        // The web server must not see a partial file
+        std::string tmpFile = filename + ".gz.tmp";
+        gzFile out = gzopen(tmpFile.c_str(), "wb9");
+        if (!out)
+            return false;
+        bool ok = content.empty() || gzwrite(out, content.data(), content.size()) > 0;
+        ok = gzclose(out) == Z_OK && ok;
+        if (!ok || std::rename(tmpFile.c_str(), (filename + ".gz").c_str()) != 0) {
+            std::remove(tmpFile.c_str());
+            return false;
+        }
+    }
+#endif
+    return true;
 }
 
 std::string cutNameSpace(std::string &className) {
@@ -62,7 +130,7 @@ std::string cutNameSpace(std::string &className) {
         return className;
 }
 
-void linkInterestingDefinitions(std::ofstream &myfile, std::string linkFile, std::string &interestingDefitions)
+void linkInterestingDefinitions(std::ostream &myfile, std::string linkFile, std::string &interestingDefitions)
 {
     if (interestingDefitions.length() == 0) {
         return;
@@ -86,13 +154,8 @@ void linkInterestingDefinitions(std::ofstream &myfile, std::string linkFile, std
 }
 
 void gererateRecursisively(FolderInfo *folder, const std::string &root, const std::string &path, const std::string &rel = "") {
-    std::ofstream myfile;
+    std::ostringstream myfile;
     std::string filename = root + "/" + path + "index.html";
-    myfile.open(filename);
-    if (!myfile) {
-        std::cerr << "Error generating " << filename << std::endl;
-        return;
-    }
     std::cerr << "Generating " << filename << std::endl;
 
     std::string data_path = data_url[0] == '.' ? (rel + data_url) : std::string(data_url);
@@ -134,8 +197,13 @@ void gererateRecursisively(FolderInfo *folder, const std::string &root, const st
               "<link rel=\"stylesheet\" href=\"" << data_path << "/indexstyle.css\"/>\n";
     myfile << "<script type=\"text/javascript\" src=\"" << data_path << "/jquery/jquery.min.js\"></script>\n";
     myfile << "<script type=\"text/javascript\" src=\"" << data_path << "/jquery/jquery-ui.min.js\"></script>\n";
-    myfile << "<script>var path = '"<< path <<"'; var root_path = '"<< rel <<"'; var project='"<< project <<"'; var ecma_script_api_version = 2;</script>\n"
-              "<script src='" << data_path << "/indexscript.js'></script>\n"
+    myfile << "<script>var path = '"<< path <<"'; var root_path = '"<< rel <<"'; var project='"<< project <<"'; var ecma_script_api_version = 2;";
+    if (!refs_layout.empty())
+        myfile << " var refs_layout = " << refs_layout << ";";
+    myfile << "</script>\n";
+    if (refs_layout == "3")
+        myfile << "<script src='" << data_path << "/refspack.js'></script>\n";
+    myfile << "<script src='" << data_path << "/indexscript.js'></script>\n"
               "</head>\n<body>\n";
     myfile << "<div id='header'><div id='toprightlogo'><a href='https://code.woboq.org'></a></div>\n";
     myfile << "<p><input id='searchline' placeholder='Search for a file or function'  type='text'/></p>\n";
@@ -184,6 +252,9 @@ void gererateRecursisively(FolderInfo *folder, const std::string &root, const st
     }
     myfile << "<br />Powered by <a href='https://woboq.com'><img alt='Woboq' src='https://code.woboq.org/woboq-16.png' width='41' height='16' /></a> <a href='https://code.woboq.org'>Code Browser</a> "
             CODEBROWSER_VERSION "\n<br/>Generator usage only permitted with license</p>\n</body></html>\n";
+
+    if (!writeOutput(filename, myfile.str()))
+        std::cerr << "Error generating " << filename << std::endl;
 }
 
 int main(int argc, char **argv) {
@@ -214,6 +285,13 @@ int main(int argc, char **argv) {
                         project_map[s.substr(0, colonPos)] = s.substr(secondColonPos + 1);
                     }
                 }
+            } else if (arg=="-precompress" || arg=="-precompress-only") {
+#ifdef HAVE_ZLIB
+                precompress = arg == "-precompress" ? Precompress : PrecompressOnly;
+#else
+                std::cerr << arg << " needs an indexgenerator built with zlib" << std::endl;
+                return -1;
+#endif
             } else if (arg=="-e") {
                 i++;
                 // ignore -e XXX  for compatibility with the generator project definitions
@@ -229,9 +307,14 @@ int main(int argc, char **argv) {
     }
 
     if (root.empty()) {
-        std::cerr << "Usage: " << argv[0] << " <path> [-d data_url] [-p project_definition]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <path> [-d data_url] [-p project_definition] [-precompress|-precompress-only]" << std::endl;
         return -1;
     }
+    std::ifstream layoutFile(root + "/refs/.layout");
+    std::getline(layoutFile, refs_layout);
+    if (refs_layout.find_first_not_of("0123456789") != std::string::npos)
+        refs_layout.clear();
+
     std::ifstream fileIndex(root + "/" + "fileIndex");
     std::string line;
 
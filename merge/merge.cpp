@@ -0,0 +1,294 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+/* Merges the files written by generators running in MULTIPROCESS_MODE.
+ *
+ * Each generator appends to <file>___suf<N> instead of <file> in refs/ and its subdirectories,
+ * fnSearch/ and in the output directory itself (fileIndex). For each such file, the lines of all
+ * the shards are concatenated in shard order, the duplicated lines are removed (keeping the first
+ * occurrence), and the result is written to <file> without a trailing new line. The shards are then
+ * deleted.
+ * The output is the same as the do_merge function of scripts/runner.py, which splits lines like
+ * Python's str.splitlines().
+ * With -precompress, a gzip compressed copy <file>.gz of each merged file is written too, like the
+ * generator does when it is not in MULTIPROCESS_MODE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static const std::string_view suffix = "___suf";
+
+struct MergeTask
+{
+    fs::path target;
+    std::map<unsigned long, fs::path> shards; // ordered by shard number
+};
+
+static bool readFile(const fs::path &path, std::string &content)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    file.seekg(0, std::ios::end);
+    content.resize(file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(content.data(), content.size());
+    return !file.fail();
+}
+
+// Returns the length of the line break starting at pos, or 0 if there is none.
+// Same separators as Python's str.splitlines()
+static size_t lineBreakLength(std::string_view text, size_t pos)
+{
+    switch (static_cast<unsigned char>(text[pos])) {
+    case '\n':
+    case '\v':
+    case '\f':
+    case 0x1c:
+    case 0x1d:
+    case 0x1e:
+        return 1;
+    case '\r':
+        return pos + 1 < text.size() && text[pos + 1] == '\n' ? 2 : 1;
+    case 0xc2: // U+0085 NEXT LINE
+        return text.substr(pos, 2) == "\xc2\x85" ? 2 : 0;
+    case 0xe2: // U+2028 LINE SEPARATOR and U+2029 PARAGRAPH SEPARATOR
+        return text.substr(pos, 3) == "\xe2\x80\xa8" || text.substr(pos, 3) == "\xe2\x80\xa9"
+            ? 3
+            : 0;
+    default:
+        return 0;
+    }
+}
+
+template<typename F>
+static void forEachLine(std::string_view text, F &&f)
+{
+    size_t start = 0;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        // fast path: skip the characters that can't start a line break
+        unsigned char c = text[pos];
+        if (c > 0x1e && c != 0xc2 && c != 0xe2) {
+            ++pos;
+            continue;
+        }
+        if (size_t len = lineBreakLength(text, pos)) {
+            f(text.substr(start, pos - start));
+            pos += len;
+            start = pos;
+        } else {
+            ++pos;
+        }
+    }
+    if (start < text.size())
+        f(text.substr(start));
+}
+
+#ifdef HAVE_ZLIB
+static bool writeCompressed(const fs::path &target, std::string_view content)
+{
+    // The web server must not see a partial file
+    std::string tmpFile = target.string() + ".gz.tmp";
+    gzFile file = gzopen(tmpFile.c_str(), "wb9");
+    if (!file)
+        return false;
+    bool ok = content.empty() || gzwrite(file, content.data(), content.size()) > 0;
+    ok = gzclose(file) == Z_OK && ok;
+    std::error_code ec;
+    if (ok)
+        fs::rename(tmpFile, target.string() + ".gz", ec);
+    if (!ok || ec) {
+        fs::remove(tmpFile, ec);
+        return false;
+    }
+    return true;
+}
+#endif
+
+static bool merge(const MergeTask &task, bool precompress)
+{
+    // The lines are views into the contents of the shards, which are kept until the end.
+    std::vector<std::string> contents(task.shards.size());
+    std::unordered_set<std::string_view> seen;
+    std::string output;
+    bool first = true;
+
+    size_t i = 0;
+    for (const auto &shard : task.shards) {
+        std::string &content = contents[i++];
+        if (!readFile(shard.second, content)) {
+            std::cerr << "Error reading " << shard.second.string() << std::endl;
+            return false;
+        }
+        forEachLine(content, [&](std::string_view line) {
+            if (!seen.insert(line).second)
+                return;
+            if (!first)
+                output += '\n';
+            first = false;
+            output.append(line);
+        });
+    }
+
+    FILE *file = std::fopen(task.target.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Error writing " << task.target.string() << ": " << std::strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    bool ok = std::fwrite(output.data(), 1, output.size(), file) == output.size();
+    ok = std::fclose(file) == 0 && ok;
+#ifdef HAVE_ZLIB
+    if (ok && precompress)
+        ok = writeCompressed(task.target, output);
+#endif
+    if (!ok) {
+        std::cerr << "Error writing " << task.target.string() << std::endl;
+        return false;
+    }
+
+    for (const auto &shard : task.shards) {
+        std::error_code ec;
+        fs::remove(shard.second, ec);
+    }
+    return true;
+}
+
+// Find the sharded files in the directory, and in its subdirectories if 'recursive'
+static void scanDirectory(const fs::path &dir, std::vector<MergeTask> &tasks,
+                          bool recursive = false)
+{
+    std::map<std::string, MergeTask> found;
+    std::vector<fs::path> subdirectories;
+    std::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; it != end && !ec; it.increment(ec)) {
+        std::error_code typeError;
+        if (recursive && it->is_directory(typeError)) {
+            subdirectories.push_back(it->path());
+            continue;
+        }
+        std::string name = it->path().filename().string();
+        auto pos = name.find(suffix);
+        if (pos == std::string::npos)
+            continue;
+        std::string_view number = std::string_view(name).substr(pos + suffix.size());
+        // Only the names generated by runner.py: <file>___suf<N>
+        if (number.empty() || number.size() > 9
+            || !std::all_of(number.begin(), number.end(), [](char c) { return c >= '0' && c <= '9'; })
+            || (number[0] == '0' && number.size() > 1))
+            continue;
+        std::string base = name.substr(0, pos);
+        MergeTask &task = found[base];
+        task.target = dir / base;
+        task.shards[std::stoul(std::string(number))] = it->path();
+    }
+    if (ec && ec != std::errc::no_such_file_or_directory)
+        std::cerr << "Error reading " << dir.string() << ": " << ec.message() << std::endl;
+    for (auto &it : found)
+        tasks.push_back(std::move(it.second));
+    for (const auto &subdirectory : subdirectories)
+        scanDirectory(subdirectory, tasks, true);
+}
+
+int main(int argc, char **argv)
+{
+    std::string root;
+    unsigned jobs = std::thread::hardware_concurrency();
+    bool precompress = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            jobs = std::stoul(argv[++i]);
+        } else if (arg == "-precompress") {
+#ifndef HAVE_ZLIB
+            std::cerr << "-precompress needs a codebrowser_merge built with zlib" << std::endl;
+            return -1;
+#endif
+            precompress = true;
+        } else if (root.empty() && !arg.empty() && arg[0] != '-') {
+            root = arg;
+        } else {
+            root.clear();
+            break;
+        }
+    }
+    if (root.empty()) {
+        std::cerr << "Usage: " << argv[0] << " <output_dir> [-j jobs] [-precompress]" << std::endl;
+        return -1;
+    }
+    jobs = std::max(1u, jobs);
+
+    std::vector<MergeTask> tasks;
+    // refs/ has the _M subdirectory, or the directories of the hashed layout: refs/ab/cd/
+    scanDirectory(root + "/refs", tasks, true);
+    for (const char *dir : { "/fnSearch", "" })
+        scanDirectory(root + dir, tasks);
+
+    // The biggest files first, so that they do not end up last on a single thread
+    std::vector<std::pair<uintmax_t, size_t>> order;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        uintmax_t size = 0;
+        for (const auto &shard : tasks[i].shards) {
+            std::error_code ec;
+            auto s = fs::file_size(shard.second, ec);
+            if (!ec)
+                size += s;
+        }
+        order.emplace_back(size, i);
+    }
+    std::sort(order.begin(), order.end(), std::greater<>());
+
+    std::atomic<size_t> next { 0 };
+    std::atomic<bool> success { true };
+    auto work = [&] {
+        for (size_t i = next++; i < order.size(); i = next++) {
+            if (!merge(tasks[order[i].second], precompress))
+                success = false;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < std::min<size_t>(jobs, order.size()); ++i)
+        threads.emplace_back(work);
+    work();
+    for (auto &t : threads)
+        t.join();
+
+    std::cout << "Merged " << tasks.size() << " files" << std::endl;
+    return success ? 0 : 1;
+}
@@ -0,0 +1,254 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+/* Moves the refs files of an output directory generated with -refs-pack into the packed refs
+ * of <output_dir>/refspack/, see refspack.h.
+ *
+ * The refs already packed by a previous run are kept, and the refs files of the new run are
+ * appended to them. The refs files are then removed, unless -keep is passed. Each shard records
+ * the size of the files it packed: running again on files which were kept, or which were not
+ * removed because of an interruption, only packs what the generator appended to them since.
+ * With -find <ref>, prints the packed refs of a symbol instead.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "refspack.h"
+
+namespace fs = std::filesystem;
+
+static bool readFile(const fs::path &path, std::string &content)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    file.seekg(0, std::ios::end);
+    content.resize(file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(content.data(), content.size());
+    return !file.fail();
+}
+
+static bool isHashDirectory(const std::string &name)
+{
+    return name.size() == 2 && std::all_of(name.begin(), name.end(), [](char c) {
+               return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+           });
+}
+
+// The refs files of the hashed layout, refs/ab/cd/<key>, by shard of the pack
+static bool listRefsFiles(const fs::path &refsDir,
+                          std::vector<std::pair<fs::path, std::string>> (&files)[RefsPackShards])
+{
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(refsDir, ec), end; it != end && !ec;
+         it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (name.empty() || name[0] == '.') {
+            if (it->is_directory())
+                it.disable_recursion_pending();
+            continue;
+        }
+        if (it->is_directory())
+            continue;
+        fs::path relative = it->path().lexically_relative(refsDir);
+        auto component = relative.begin();
+        if (component == relative.end() || !isHashDirectory(component->string())
+            || ++component == relative.end() || !isHashDirectory(component->string())) {
+            std::cerr << "Not a refs file of the hashed layout: " << it->path().string()
+                      << std::endl;
+            return false;
+        }
+        if (name.find("___suf") != std::string::npos) {
+            std::cerr << "The refs files must be merged first: " << it->path().string()
+                      << std::endl;
+            return false;
+        }
+        fs::path key;
+        for (++component; component != relative.end(); ++component)
+            key /= *component;
+        std::string k = key.generic_string();
+        files[refsPackShard(k)].emplace_back(it->path(), std::move(k));
+    }
+    if (ec && ec != std::errc::no_such_file_or_directory) {
+        std::cerr << "Error reading " << refsDir.string() << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// The key under which a shard records the size of the refs files it contains, so that the files
+// kept with -keep, or left by an interrupted run, are not packed again. The refs files starting
+// with '.' are not listed, so it cannot be the key of a symbol.
+static const std::string PackedFilesKey = ".packed";
+
+static bool packShard(const std::string &root, unsigned shard,
+                      const std::vector<std::pair<fs::path, std::string>> &files)
+{
+    RefsPackWriter writer;
+    std::string fileName = refsPackFileName(root, shard);
+    std::unordered_map<std::string, uint64_t> packedSizes;
+    if (fs::exists(fileName)) {
+        RefsPackReader previous;
+        auto add = [&](std::string_view key, std::string_view refs) {
+            if (key != PackedFilesKey) {
+                writer.add(key, refs);
+                return;
+            }
+            // Lines of "<size> <key>"
+            while (!refs.empty()) {
+                std::string_view line = refs.substr(0, refs.find('\n'));
+                refs.remove_prefix(std::min(refs.size(), line.size() + 1));
+                size_t space = line.find(' ');
+                uint64_t size = 0;
+                if (space == std::string_view::npos
+                    || std::from_chars(line.data(), line.data() + space, size).ptr
+                        != line.data() + space)
+                    continue;
+                packedSizes[std::string(line.substr(space + 1))] = size;
+            }
+        };
+        if (!previous.open(fileName) || !previous.forEach(add)) {
+            std::cerr << "Error reading " << fileName << std::endl;
+            return false;
+        }
+    }
+    std::string content;
+    std::string packedFiles;
+    for (const auto &file : files) {
+        if (!readFile(file.first, content)) {
+            std::cerr << "Error reading " << file.first.string() << std::endl;
+            return false;
+        }
+        // The generator only appends to the refs files: only what was added since the file was
+        // packed is new
+        auto packed = packedSizes.find(file.second);
+        std::string_view added = content;
+        if (packed != packedSizes.end() && packed->second <= content.size())
+            added.remove_prefix(packed->second);
+        if (!added.empty())
+            writer.add(file.second, added);
+        packedFiles += std::to_string(content.size()) + " " + file.second + "\n";
+    }
+    if (!packedFiles.empty())
+        writer.add(PackedFilesKey, packedFiles);
+    return writer.write(fileName);
+}
+
+int main(int argc, char **argv)
+{
+    std::string root;
+    std::string findRef;
+    bool keep = false;
+    unsigned jobs = std::thread::hardware_concurrency();
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            jobs = std::stoul(argv[++i]);
+        } else if (arg == "-find" && i + 1 < argc) {
+            findRef = argv[++i];
+        } else if (arg == "-keep") {
+            keep = true;
+        } else if (root.empty() && !arg.empty() && arg[0] != '-') {
+            root = arg;
+        } else {
+            root.clear();
+            break;
+        }
+    }
+    if (root.empty()) {
+        std::cerr << "Usage: " << argv[0] << " <output_dir> [-j jobs] [-keep]\n"
+                  << "       " << argv[0] << " <output_dir> -find <ref>" << std::endl;
+        return -1;
+    }
+
+    if (!findRef.empty()) {
+        PackedRefs packedRefs;
+        if (!packedRefs.open(root)) {
+            std::cerr << "No packed refs in " << root << std::endl;
+            return 1;
+        }
+        // The key is the name of the refs file in the flat layout
+        std::replace(findRef.begin(), findRef.end(), ':', '.');
+        auto refs = packedRefs.find(findRef);
+        if (!refs)
+            return 1;
+        std::cout << *refs;
+        return 0;
+    }
+
+    std::string layout;
+    std::ifstream layoutFile(root + "/refs/.layout");
+    std::getline(layoutFile, layout);
+    if (layout != "3") {
+        std::cerr << "The refs of " << root << " were not generated with -refs-pack" << std::endl;
+        return 1;
+    }
+
+    fs::path refsDir = fs::path(root) / "refs";
+    std::vector<std::pair<fs::path, std::string>> files[RefsPackShards];
+    if (!listRefsFiles(refsDir, files))
+        return 1;
+
+    std::error_code ec;
+    fs::create_directories(root + "/refspack", ec);
+    std::atomic<unsigned> next { 0 };
+    std::atomic<bool> success { true };
+    auto work = [&] {
+        for (unsigned shard = next++; shard < RefsPackShards; shard = next++) {
+            if (!packShard(root, shard, files[shard]))
+                success = false;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < std::min(std::max(1u, jobs), RefsPackShards); ++i)
+        threads.emplace_back(work);
+    work();
+    for (auto &t : threads)
+        t.join();
+    if (!success)
+        return 1;
+
+    size_t count = 0;
+    for (const auto &shardFiles : files) {
+        count += shardFiles.size();
+        if (keep)
+            continue;
+        for (const auto &file : shardFiles) {
+            fs::remove(file.first, ec);
+            // Remove the directories left empty: refs/ab/cd/_M, refs/ab/cd and refs/ab
+            fs::path dir = file.first.parent_path();
+            while (dir != refsDir && fs::is_empty(dir, ec) && fs::remove(dir, ec))
+                dir = dir.parent_path();
+        }
+    }
+    std::cout << "Packed " << count << " refs files" << std::endl;
+    return 0;
+}
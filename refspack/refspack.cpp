@@ -0,0 +1,444 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "refspack.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const char PackMagic[8] = { 'C', 'B', 'R', 'P', 'A', 'C', 'K', '1' };
+constexpr size_t HeaderSize = 64;
+constexpr size_t BlockTableEntrySize = 16;
+constexpr size_t IndexEntrySize = 20;
+// The uncompressed size after which a block is closed. A symbol is never split across blocks
+constexpr size_t BlockSize = 64 * 1024;
+
+void appendU32(std::string &out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out += char(value >> (8 * i));
+}
+
+void appendU64(std::string &out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        out += char(value >> (8 * i));
+}
+
+uint32_t readU32(const char *data)
+{
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i)
+        value = (value << 8) | uint8_t(data[i]);
+    return value;
+}
+
+uint64_t readU64(const char *data)
+{
+    return readU32(data) | (uint64_t(readU32(data + 4)) << 32);
+}
+
+void appendVarint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out += char(value | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+bool readVarint(std::string_view &in, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+        uint8_t byte = in.front();
+        in.remove_prefix(1);
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// Calls fn with each record of a refs file. A record starts with '<' at the start of a line: the
+// docs can span several lines. Same as forEachRecord in generator/refslog.cpp
+template<typename F>
+void forEachRecord(std::string_view content, F &&fn)
+{
+    while (!content.empty()) {
+        size_t end = content.find('\n');
+        while (end != std::string_view::npos && end + 1 < content.size()
+               && content[end + 1] != '<') {
+            end = content.find('\n', end + 1);
+        }
+        end = end == std::string_view::npos ? content.size() : end + 1;
+        fn(content.substr(0, end));
+        content.remove_prefix(end);
+    }
+}
+
+// Splits "<tag f='file' l='line'rest" in its parts
+bool splitRecord(std::string_view record, std::string_view &tag, std::string_view &file,
+                 uint64_t &line, std::string_view &rest)
+{
+    if (record.size() < 2 || record[0] != '<')
+        return false;
+    size_t tagEnd = record.find(' ');
+    if (tagEnd == std::string_view::npos || tagEnd == 1)
+        return false;
+    tag = record.substr(1, tagEnd - 1);
+    if (tag.find_first_of("<>/'\n") != std::string_view::npos)
+        return false;
+    std::string_view s = record.substr(tagEnd);
+    if (s.substr(0, 4) != " f='")
+        return false;
+    s.remove_prefix(4);
+    size_t fileEnd = s.find('\'');
+    if (fileEnd == std::string_view::npos)
+        return false;
+    file = s.substr(0, fileEnd);
+    s.remove_prefix(fileEnd);
+    if (s.substr(0, 5) != "' l='")
+        return false;
+    s.remove_prefix(5);
+    size_t lineEnd = s.find('\'');
+    // Only the lines that are written back the same
+    if (lineEnd == std::string_view::npos || lineEnd == 0 || lineEnd > 18
+        || (s[0] == '0' && lineEnd > 1))
+        return false;
+    line = 0;
+    for (char c : s.substr(0, lineEnd)) {
+        if (c < '0' || c > '9')
+            return false;
+        line = line * 10 + (c - '0');
+    }
+    rest = s.substr(lineEnd + 1);
+    return true;
+}
+
+}
+
+unsigned refsPackShard(std::string_view key)
+{
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash % RefsPackShards;
+}
+
+std::string refsPackFileName(const std::string &outputDir, unsigned shard)
+{
+    return outputDir + "/refspack/" + std::to_string(shard) + ".pack";
+}
+
+void RefsPackWriter::add(std::string_view key, std::string_view data)
+{
+    std::string &existing = refs[std::string(key)];
+    // The merged refs files do not end with a new line
+    if (!existing.empty() && existing.back() != '\n')
+        existing += '\n';
+    existing.append(data);
+}
+
+bool RefsPackWriter::write(const std::string &path) const
+{
+    std::vector<const std::pair<const std::string, std::string> *> sorted;
+    sorted.reserve(refs.size());
+    for (const auto &it : refs)
+        sorted.push_back(&it);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const auto *a, const auto *b) { return a->first < b->first; });
+
+    std::unordered_map<std::string_view, uint32_t> stringIds;
+    std::vector<std::string_view> strings;
+    auto stringId = [&](std::string_view s) {
+        auto inserted = stringIds.emplace(s, strings.size());
+        if (inserted.second)
+            strings.push_back(s);
+        return inserted.first->second;
+    };
+
+    std::string tmpFile = path + ".tmp";
+    FILE *file = std::fopen(tmpFile.c_str(), "wb");
+    if (!file) {
+        std::fprintf(stderr, "Error writing %s: %s\n", tmpFile.c_str(), std::strerror(errno));
+        return false;
+    }
+    bool ok = std::fwrite(std::string(HeaderSize, '\0').data(), 1, HeaderSize, file) == HeaderSize;
+    uint64_t offset = HeaderSize;
+
+    std::string blockTable, index, keys, block, compressed;
+    uint32_t blockCount = 0;
+    auto flushBlock = [&] {
+        if (block.empty())
+            return;
+        uLongf compressedSize = compressBound(block.size());
+        compressed.resize(compressedSize);
+        if (compress2(reinterpret_cast<Bytef *>(compressed.data()), &compressedSize,
+                      reinterpret_cast<const Bytef *>(block.data()), block.size(),
+                      Z_DEFAULT_COMPRESSION)
+            != Z_OK) {
+            ok = false;
+        }
+        ok = ok && std::fwrite(compressed.data(), 1, compressedSize, file) == compressedSize;
+        appendU64(blockTable, offset);
+        appendU32(blockTable, compressedSize);
+        appendU32(blockTable, block.size());
+        offset += compressedSize;
+        ++blockCount;
+        block.clear();
+    };
+
+    for (const auto *it : sorted) {
+        size_t start = block.size();
+        forEachRecord(it->second, [&](std::string_view record) {
+            std::string_view tag, fileName, rest;
+            uint64_t line;
+            if (splitRecord(record, tag, fileName, line, rest)) {
+                appendVarint(block, stringId(tag) + 1);
+                appendVarint(block, stringId(fileName));
+                appendVarint(block, line);
+                appendVarint(block, rest.size());
+                block.append(rest);
+            } else {
+                appendVarint(block, 0);
+                appendVarint(block, record.size());
+                block.append(record);
+            }
+        });
+        appendU32(index, keys.size());
+        appendU32(index, it->first.size());
+        appendU32(index, blockCount);
+        appendU32(index, start);
+        appendU32(index, block.size() - start);
+        keys.append(it->first);
+        if (block.size() >= BlockSize)
+            flushBlock();
+    }
+    flushBlock();
+
+    std::string stringOffsets, stringData;
+    for (std::string_view s : strings) {
+        appendU32(stringOffsets, stringData.size());
+        stringData.append(s);
+    }
+    appendU32(stringOffsets, stringData.size());
+
+    std::string header(PackMagic, sizeof(PackMagic));
+    appendU32(header, sorted.size());
+    appendU32(header, blockCount);
+    appendU32(header, strings.size());
+    appendU32(header, 0);
+    uint64_t sectionOffset = offset;
+    for (const std::string *section : { &blockTable, &index, &keys, &stringOffsets }) {
+        appendU64(header, sectionOffset);
+        sectionOffset += section->size();
+    }
+    appendU64(header, sectionOffset);
+
+    for (const std::string *section : { &blockTable, &index, &keys, &stringOffsets, &stringData })
+        ok = ok && std::fwrite(section->data(), 1, section->size(), file) == section->size();
+    ok = ok && std::fseek(file, 0, SEEK_SET) == 0
+        && std::fwrite(header.data(), 1, header.size(), file) == header.size();
+    ok = std::fclose(file) == 0 && ok;
+    if (ok)
+        ok = std::rename(tmpFile.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        std::fprintf(stderr, "Error writing %s\n", path.c_str());
+        std::remove(tmpFile.c_str());
+    }
+    return ok;
+}
+
+bool RefsPackReader::open(const std::string &path)
+{
+    file.open(path, std::ios::binary);
+    char header[HeaderSize];
+    if (!file.read(header, HeaderSize) || std::memcmp(header, PackMagic, sizeof(PackMagic)) != 0)
+        return false;
+    keyCount = readU32(header + 8);
+    blockCount = readU32(header + 12);
+    stringCount = readU32(header + 16);
+    uint64_t sections[5];
+    for (int i = 0; i < 5; ++i)
+        sections[i] = readU64(header + 24 + 8 * i);
+
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = file.tellg();
+    // The sections follow each other, with the sizes given by the counts
+    if (sections[0] < HeaderSize || sections[4] > fileSize
+        || sections[1] - sections[0] != uint64_t(blockCount) * BlockTableEntrySize
+        || sections[2] - sections[1] != uint64_t(keyCount) * IndexEntrySize
+        || sections[3] < sections[2]
+        || sections[4] - sections[3] != (uint64_t(stringCount) + 1) * 4) {
+        return false;
+    }
+    metadataOffset = sections[0];
+    metadata.resize(fileSize - metadataOffset);
+    file.seekg(metadataOffset);
+    if (!file.read(metadata.data(), metadata.size()))
+        return false;
+    blockTable = metadata.data();
+    index = metadata.data() + (sections[1] - metadataOffset);
+    keys = metadata.data() + (sections[2] - metadataOffset);
+    stringOffsets = metadata.data() + (sections[3] - metadataOffset);
+    strings = metadata.data() + (sections[4] - metadataOffset);
+
+    // Check the offsets once, so that the lookups do not have to
+    uint64_t keysSize = sections[3] - sections[2];
+    for (uint32_t i = 0; i < keyCount; ++i) {
+        const char *e = index + i * IndexEntrySize;
+        if (uint64_t(readU32(e)) + readU32(e + 4) > keysSize || readU32(e + 8) >= blockCount)
+            return false;
+    }
+    uint64_t stringsSize = fileSize - sections[4];
+    for (uint32_t i = 0; i < stringCount; ++i) {
+        if (readU32(stringOffsets + 4 * i) > readU32(stringOffsets + 4 * i + 4)
+            || readU32(stringOffsets + 4 * i + 4) > stringsSize)
+            return false;
+    }
+    return true;
+}
+
+std::string_view RefsPackReader::key(uint32_t i) const
+{
+    const char *e = index + i * IndexEntrySize;
+    return std::string_view(keys + readU32(e), readU32(e + 4));
+}
+
+bool RefsPackReader::readBlock(uint32_t block, std::string &data)
+{
+    const char *e = blockTable + block * BlockTableEntrySize;
+    uint64_t offset = readU64(e);
+    uint32_t compressedSize = readU32(e + 8);
+    uLongf size = readU32(e + 12);
+    if (offset + compressedSize > metadataOffset)
+        return false;
+    std::string compressed(compressedSize, '\0');
+    {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        file.clear();
+        file.seekg(offset);
+        if (!file.read(compressed.data(), compressedSize))
+            return false;
+    }
+    data.resize(size);
+    return uncompress(reinterpret_cast<Bytef *>(data.data()), &size,
+                      reinterpret_cast<const Bytef *>(compressed.data()), compressedSize)
+        == Z_OK
+        && size == data.size();
+}
+
+std::string RefsPackReader::decode(std::string_view data) const
+{
+    auto string = [&](uint64_t id) {
+        if (id >= stringCount)
+            return std::string_view();
+        uint32_t begin = readU32(stringOffsets + 4 * id);
+        return std::string_view(strings + begin, readU32(stringOffsets + 4 * id + 4) - begin);
+    };
+    std::string result;
+    uint64_t tag, fileName, line, size;
+    while (!data.empty()) {
+        if (!readVarint(data, tag))
+            break;
+        if (tag) {
+            if (!readVarint(data, fileName) || !readVarint(data, line))
+                break;
+            result += '<';
+            result += string(tag - 1);
+            result += " f='";
+            result += string(fileName);
+            result += "' l='";
+            result += std::to_string(line);
+            result += '\'';
+        }
+        if (!readVarint(data, size) || size > data.size())
+            break;
+        result.append(data.substr(0, size));
+        data.remove_prefix(size);
+    }
+    return result;
+}
+
+std::optional<std::string> RefsPackReader::find(std::string_view k)
+{
+    uint32_t low = 0, high = keyCount;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (key(middle) < k)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low == keyCount || key(low) != k)
+        return std::nullopt;
+    const char *e = index + low * IndexEntrySize;
+    std::string block;
+    if (!readBlock(readU32(e + 8), block))
+        return std::nullopt;
+    uint32_t offset = readU32(e + 12);
+    uint32_t size = readU32(e + 16);
+    if (uint64_t(offset) + size > block.size())
+        return std::nullopt;
+    return decode(std::string_view(block).substr(offset, size));
+}
+
+bool RefsPackReader::forEach(const std::function<void(std::string_view, std::string_view)> &fn)
+{
+    std::string block;
+    uint32_t current = blockCount;
+    for (uint32_t i = 0; i < keyCount; ++i) {
+        const char *e = index + i * IndexEntrySize;
+        uint32_t b = readU32(e + 8);
+        if (b != current) {
+            if (!readBlock(b, block))
+                return false;
+            current = b;
+        }
+        uint32_t offset = readU32(e + 12);
+        uint32_t size = readU32(e + 16);
+        if (uint64_t(offset) + size > block.size())
+            return false;
+        fn(key(i), decode(std::string_view(block).substr(offset, size)));
+    }
+    return true;
+}
+
+bool PackedRefs::open(const std::string &outputDir)
+{
+    for (unsigned i = 0; i < RefsPackShards; ++i) {
+        if (!shards[i].open(refsPackFileName(outputDir, i)))
+            return false;
+    }
+    return true;
+}
+
+std::optional<std::string> PackedRefs::find(std::string_view key)
+{
+    return shards[refsPackShard(key)].find(key);
+}
@@ -0,0 +1,126 @@
+/****************************************************************************
+ * Copyright (C) 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+ *
+ * This file is part of the Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by KDAB may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and KDAB.
+ * For further information see https://codebrowser.dev/
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+/* Packed refs: all the refs files of an output directory in a few pack files.
+ *
+ * Written by codebrowser_refspack in <output_dir>/refspack/<shard>.pack, and read by the
+ * RefsPackReader below, by codebrowser_serve, and by data/refspack.js.
+ * The key of a symbol is the name of its file in a flat refs directory (the ref after
+ * replace_invalid_filename_chars), and its shard is the FNV-1a hash of the key modulo
+ * RefsPackShards. codebrowser_refspack also stores, under the key ".packed" of each shard, the
+ * size of the refs files it packed there.
+ *
+ * A shard file is, with all the integers in little endian:
+ *   header (64 bytes):
+ *     char magic[8] = "CBRPACK1";
+ *     uint32_t keyCount, blockCount, stringCount, reserved;
+ *     uint64_t blockTableOffset, indexOffset, keysOffset, stringOffsetsOffset, stringsOffset;
+ *   the blocks: the encoded refs of consecutive keys, each block compressed with zlib;
+ *   block table: blockCount x { uint64_t offset; uint32_t compressedSize, size; }
+ *   index, sorted by key: keyCount x { uint32_t keyOffset, keyLength, block, offset, size; }
+ *   keys: the bytes of all the keys;
+ *   string offsets: (stringCount + 1) x uint32_t, the offsets of the strings in:
+ *   strings: the bytes of all the strings (file names and tags).
+ * Everything after the blocks has a fixed layout: it can be used in place, and a lookup only
+ * reads the block of the symbol.
+ *
+ * In a block, the refs of a symbol are a sequence of records. A record of the text format
+ * "<tag f='file' l='line'rest" is encoded as the varints tag + 1, file and line, which are
+ * indexes in the strings for the tag and the file, followed by varint size and the bytes of
+ * 'rest'. Any other record is encoded as the varints 0 and size, followed by its bytes.
+ * The varints are unsigned LEB128.
+ */
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+constexpr unsigned RefsPackShards = 16;
+
+// The shard of the pack where the refs of 'key' are
+unsigned refsPackShard(std::string_view key);
+
+// The path of a shard file in the output directory
+std::string refsPackFileName(const std::string &outputDir, unsigned shard);
+
+class RefsPackWriter
+{
+public:
+    // Add the refs of a symbol, in the text format of the refs files. Adding the same key again
+    // appends to its refs
+    void add(std::string_view key, std::string_view refs);
+
+    bool write(const std::string &path) const;
+
+private:
+    std::unordered_map<std::string, std::string> refs;
+};
+
+class RefsPackReader
+{
+public:
+    bool open(const std::string &path);
+
+    // The refs of 'key', in the text format of the refs files
+    std::optional<std::string> find(std::string_view key);
+
+    // Calls fn(key, refs) for each key, in order
+    bool forEach(const std::function<void(std::string_view, std::string_view)> &fn);
+
+    size_t size() const { return keyCount; }
+
+private:
+    std::string_view key(uint32_t i) const;
+    bool readBlock(uint32_t block, std::string &data);
+    std::string decode(std::string_view data) const;
+
+    std::ifstream file;
+    std::mutex fileMutex; // find can be called from several threads
+    std::string metadata; // everything after the blocks
+    uint64_t metadataOffset = 0;
+    uint32_t keyCount = 0;
+    uint32_t blockCount = 0;
+    uint32_t stringCount = 0;
+    const char *blockTable = nullptr;
+    const char *index = nullptr;
+    const char *keys = nullptr;
+    const char *stringOffsets = nullptr;
+    const char *strings = nullptr;
+};
+
+/* The packed refs of an output directory */
+class PackedRefs
+{
+public:
+    // Returns false if the output directory has no pack
+    bool open(const std::string &outputDir);
+
+    std::optional<std::string> find(std::string_view key);
+
+private:
+    RefsPackReader shards[RefsPackShards];
+};
@@ -5,6 +5,7 @@
 # the original file
 #
 import argparse
+import gzip
 import json
 import multiprocessing
 import os
@@ -30,6 +31,14 @@ def generate(args, queue, lock, tid):
     while True:
         name = queue.get()
         cmd = [args.gen, "-b", args.compile_commands, "-o", args.out_dir]
+        if args.compdb_cache:
+            cmd.append("-compdb-cache")
+        if args.refs_fanout:
+            cmd.append("-refs-fanout")
+        if args.refspack:
+            cmd.append("-refs-pack")
+        if args.precompress:
+            cmd.append("-precompress")
         for project in args.projects:
             cmd.append("-p")
             cmd.append(project)
@@ -58,7 +67,7 @@ def generate(args, queue, lock, tid):
         queue.task_done()
 
 
-def do_file(directory, f, max_task):
+def do_file(directory, f, max_task, precompress):
     # for a file name f
     # look for all f___suf[0 - max_task]
     # then merge them into one file and delete them
@@ -79,12 +88,17 @@ def do_file(directory, f, max_task):
     new_file = directory.joinpath(f)
     # print("create new file: {}".format(str(new_file)))
     new_file.write_text(txt)
+    if precompress:
+        tmp_file = directory.joinpath(f + ".gz.tmp")
+        with gzip.open(tmp_file, "wb", compresslevel=9) as gz:
+            gz.write(new_file.read_bytes())
+        tmp_file.replace(directory.joinpath(f + ".gz"))
     # remove old ones
     for fil in possible_files:
         fil.unlink()
 
 
-def do_merge_dir(d, max_task):
+def do_merge_dir(d, max_task, precompress):
     dirPath = Path(d)
     files = set()
     for f in os.listdir(d):
@@ -96,24 +110,61 @@ def do_merge_dir(d, max_task):
             continue
 
     for f in files:
-        do_file(dirPath, f, max_task)
+        do_file(dirPath, f, max_task, precompress)
 
 
-def do_merge(out, max_task):
+def do_merge(out, max_task, precompress):
     fnsearch = out + "/fnSearch"
     print("Merging ", fnsearch)
-    do_merge_dir(fnsearch, max_task)
+    do_merge_dir(fnsearch, max_task, precompress)
 
+    # refs/_M, or the refs/ab/cd/ directories of the hashed layout
     refs = out + "/refs"
     print("Merging ", refs)
-    do_merge_dir(refs, max_task)
-
-    refsM = out + "/refs/_M"
-    print("Merging ", refsM)
-    do_merge_dir(refsM, max_task)
+    for d, _, _ in os.walk(refs):
+        do_merge_dir(d, max_task, precompress)
 
     print("Merging fileIndex")
-    do_merge_dir(out, max_task)
+    do_merge_dir(out, max_task, precompress)
+
+
+def load_timings(out):
+    # The .timings file of the generators: seconds <tab> memory <tab> file.
+    # The last line of a file wins
+    timings = dict()
+    try:
+        with open(os.path.join(out, ".timings"), encoding="utf-8") as f:
+            for line in f:
+                fields = line.rstrip("\n").split("\t", 2)
+                if len(fields) != 3:
+                    continue
+                try:
+                    timings[fields[2]] = (float(fields[0]), fields[1])
+                except ValueError:
+                    continue
+    except OSError:
+        pass
+    return timings
+
+
+def compact_timings(out):
+    # The generators only append to the file: keep one line per file
+    timings = load_timings(out)
+    if not timings:
+        return
+    path = os.path.join(out, ".timings")
+    tmp_path = path + ".tmp"
+    with open(tmp_path, "w", encoding="utf-8") as f:
+        for name, (seconds, memory) in timings.items():
+            f.write("%.3f\t%s\t%s\n" % (seconds, memory, name))
+    os.replace(tmp_path, path)
+
+
+def pack_refs(args, max_task):
+    ret = subprocess.call([args.refspack, args.out_dir, "-j", str(max_task)])
+    if ret != 0:
+        print("Error: codebrowser_refspack failed")
+    return ret
 
 
 def main():
@@ -124,8 +175,20 @@ def main():
                         help="number of generators to be run in parallel.")
     parser.add_argument(
         "-e", dest="gen", help="Path to codebrowser_generator.")
+    parser.add_argument(
+        "-m", dest="merge", help="Path to codebrowser_merge. If not specified, the files are merged by this script.")
     parser.add_argument("-p", dest="compile_commands",
                         help="Path to a compile_commands.json file.")
+    parser.add_argument("-c", dest="compdb_cache", action="store_true",
+                        help="Let the generators share a binary cache of the compile_commands.json, instead of each parsing it.")
+    parser.add_argument("-f", dest="fork", action="store_true",
+                        help="Run a single generator, which forks a process per file, instead of starting a generator per file.")
+    parser.add_argument("-r", dest="refs_fanout", action="store_true",
+                        help="Spread the refs files over hashed subdirectories of refs/ (generator option -refs-fanout).")
+    parser.add_argument("-k", dest="refspack",
+                        help="Path to codebrowser_refspack. If specified, the refs are packed at the end (generator option -refs-pack).")
+    parser.add_argument("-z", dest="precompress", action="store_true",
+                        help="Also write a gzip compressed copy of the generated files (generator option -precompress).")
     parser.add_argument("-o", dest="out_dir",
                         help="Path to output directory.")
     parser.add_argument("-a", dest="projects", action='extend', nargs='*',
@@ -159,16 +222,46 @@ def main():
 
     print("using compile_commands.json: {}".format(compile_commands))
 
+    max_task = args.j
+    if max_task == 0:
+        max_task = multiprocessing.cpu_count()
+
+    if args.fork:
+        # The generator loads everything once, and dispatches the references itself
+        cmd = [args.gen, "-b", compile_commands, "-o", args.out_dir,
+               "-a", "-fork", "-j", str(max_task)]
+        if args.compdb_cache:
+            cmd.append("-compdb-cache")
+        if args.refs_fanout:
+            cmd.append("-refs-fanout")
+        if args.refspack:
+            cmd.append("-refs-pack")
+        if args.precompress:
+            cmd.append("-precompress")
+        for project in args.projects:
+            cmd.append("-p")
+            cmd.append(project)
+        if args.externalprojects is not None:
+            for p in args.externalprojects:
+                cmd.append("-e")
+                cmd.append(p)
+        print(" ".join(cmd))
+        ret = subprocess.call(cmd)
+        if ret == 0 and args.refspack:
+            ret = pack_refs(args, max_task)
+        sys.exit(ret)
+
     # Load the database and extract all files.
     database = json.load(open(compile_commands))
     files = set(
         [make_absolute(entry["file"], entry["directory"])
          for entry in database]
     )
-
-    max_task = args.j
-    if max_task == 0:
-        max_task = multiprocessing.cpu_count()
+    # Start with the longest files of the previous runs, so that no long file is left alone
+    # at the end. The files without history come first, their time is unknown.
+    timings = load_timings(args.out_dir)
+    files = sorted(files, key=lambda f: (
+        f in timings, -timings[f][0] if f in timings else 0, f))
 
     try:
         task_queue = queue.Queue(max_task)
@@ -183,8 +276,11 @@ def main():
             idx = idx + 1
 
         # Fill the queue with files.
-        for name in files:
+        for i, name in enumerate(files):
             task_queue.put(name)
+            if i == 0 and args.compdb_cache:
+                # The first generator writes the cache that the others load
+                task_queue.join()
 
         # Wait for all threads to be done.
         task_queue.join()
@@ -198,11 +294,25 @@ def main():
     print("Merging files...")
     start = time.time()
 
-    do_merge(args.out_dir, max_task)
+    if args.merge is not None:
+        cmd = [args.merge, args.out_dir, "-j", str(max_task)]
+        if args.precompress:
+            cmd.append("-precompress")
+        ret = subprocess.call(cmd)
+        if ret != 0:
+            print("Error: codebrowser_merge failed")
+            exit(1)
+    else:
+        do_merge(args.out_dir, max_task, args.precompress)
 
     end = time.time()
     print("Merged all files in: %.2F seconds" % (end - start))
 
+    compact_timings(args.out_dir)
+
+    if args.refspack and pack_refs(args, max_task) != 0:
+        exit(1)
+
     sys.exit()
 
 